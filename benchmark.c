@@ -0,0 +1,2161 @@
+/*
+ * Self-checks and microbenchmarks for the Uptime Clock core.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Usage: uclockbench [-c] [-d] [-t] [-s] [name...]
+ *
+ * Runs every self-check, then every benchmark whose name is given on the
+ * command line (or all of them if none are). With -c, only the self-checks
+ * are run. With -d, each rendered frame size is also saved as a PPM image.
+ * With -t, the whole per-tick path is instead run on a simulated clock for
+ * a few seconds, and the sustained number of ticks per second reported.
+ * With -s, each timestamp source is instead timed, and its drift from the
+ * OS monotonic clock measured over a few seconds.
+ * Exits with a nonzero status if any self-check fails, so the benchmark
+ * numbers are never reported for code that gives wrong answers.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for clock_gettime() and setenv()
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "clockcore.h"
+#include "cpuprobe.h"
+#include "drift.h"
+#include "eventring.h"
+#include "hdrlog.h"
+#include "hiccup.h"
+#include "histogram.h"
+#include "history.h"
+#include "journal.h"
+#include "metrics.h"
+#include "render.h"
+#include "simclock.h"
+#include "statepage.h"
+#include "termscreen.h"
+#include "thread.h"
+#include "timestamp.h"
+#include "uclockstate.h"
+#include "uiprobe.h"
+
+// Number of events the event ring check sends between threads
+#define RING_EVENTS 200000
+
+// Number of ticks the state page check publishes while reading
+#define STATE_TICKS 200000
+
+// How long -t runs the simulated clock, in seconds
+#define SIMULATION_TIME 3.0
+
+// How long -s measures the drift of each timestamp source, in seconds
+#define DRIFT_TIME 3
+
+// Number of iterations for each benchmark
+#define ITERATIONS 1000000
+
+// Fixed reference time: 03/30/2023 12:34:56 AM UTC
+#define REFERENCE_TIME ((time_t) 1680136496)
+
+typedef int (*CHECKPROC)(void);
+typedef void (*BENCHPROC)(unsigned long iterations, const void *arg);
+
+typedef struct tagCHECK {
+    const char *name;
+    CHECKPROC proc;
+} CHECK;
+
+typedef struct tagBENCHMARK {
+    const char *name;
+    BENCHPROC proc;
+    unsigned long iterations;
+    const void *arg;
+} BENCHMARK;
+
+typedef struct tagTIMESOURCE {
+    const char *name;
+    unsigned long long (*read)(void);   // in microseconds
+} TIMESOURCE;
+
+typedef struct tagFRAMESIZE {
+    int width, height;
+} FRAMESIZE;
+
+static const FRAMESIZE frameSizes[] = {
+    { 640, 480 },
+    { 1920, 1080 },
+    { 3840, 2160 },
+    { 7680, 4320 },
+};
+
+static const TIMESOURCE timeSources[] = {
+    { "MonotonicTime",  GetMonotonicTime },
+    { "Timestamp",      GetTimestamp },
+    { "WallTime",       GetWallTime },
+};
+#define cTimeSources (sizeof(timeSources) / sizeof(timeSources[0]))
+
+// Checksum of the reference frame at 320x240
+#define REFERENCE_FRAME_HASH 0xEC56B9E5UL
+
+// Keeps the compiler from optimizing away benchmark results
+static volatile unsigned long long sink;
+
+// Save rendered frames as PPM images?
+static int fDumpFrames;
+
+static double Seconds(void);
+static int Selected(const char *name, int argc, char *argv[]);
+
+static int CheckTickSchedule(void);
+static int CheckTimestamps(void);
+static int CheckBreakDownUptime(void);
+static int CheckFormatClock(void);
+static int CheckFormatUptime(void);
+static int CheckClockString(void);
+static int CheckUptimeString(void);
+static int CheckRenderFrame(void);
+static int CheckRenderChanges(void);
+static int CheckTermScreen(void);
+static int CheckHistogram(void);
+static int CheckFormatLatencies(void);
+static int CheckHiccupMeter(void);
+static int CheckUIProbe(void);
+static int CheckCPUProbes(void);
+static int CheckEventRing(void);
+static int CheckTickJournal(void);
+static int CheckHistoryEncoding(void);
+static int CheckHistoryFile(void);
+static int CheckHistoryQuery(void);
+static int CheckHdrLog(void);
+static int CheckMetrics(void);
+static int CheckStatePage(void);
+static int CheckSimClock(void);
+static int CheckSimTicks(SIMCLOCK *sim, CLOCKSTATE *state, int cTicks);
+static int CheckAwakeTime(void);
+static int CheckDriftDetector(void);
+static int CheckDriftLog(void);
+static void PostRingEvents(void *arg);
+static void PublishTestStates(void *arg);
+static void CountGap(const HISTORYSAMPLE *before,
+                     const HISTORYSAMPLE *after, void *arg);
+static void GetTempPath(char *path, size_t size, const char *ext);
+static void GetStateName(char *name, size_t size);
+static int ConnectMetrics(unsigned short port);
+static int Scrape(int sock, const char *path, char *buf, size_t size);
+static unsigned long HashFrame(const FRAMEBUFFER *fb);
+
+static void BenchBreakDownUptime(unsigned long iterations, const void *arg);
+static void BenchFormatClock(unsigned long iterations, const void *arg);
+static void BenchClockString(unsigned long iterations, const void *arg);
+static void BenchFormatUptime(unsigned long iterations, const void *arg);
+static void BenchUptimeString(unsigned long iterations, const void *arg);
+static void BenchSetClockState(unsigned long iterations, const void *arg);
+static void BenchRenderFrame(unsigned long iterations, const void *arg);
+static void BenchRenderTick(unsigned long iterations, const void *arg);
+static void BenchTermTick(unsigned long iterations, const void *arg);
+static void BenchRecordValue(unsigned long iterations, const void *arg);
+static void BenchAppendTick(unsigned long iterations, const void *arg);
+static void BenchEncodeHistory(unsigned long iterations, const void *arg);
+static void BenchEventRing(unsigned long iterations, const void *arg);
+static void BenchPublishMetrics(unsigned long iterations, const void *arg);
+static void BenchScrape(unsigned long iterations, const void *arg);
+static void BenchPublishState(unsigned long iterations, const void *arg);
+static void BenchReadState(unsigned long iterations, const void *arg);
+static void BenchSimulatedTick(unsigned long iterations, const void *arg);
+static void BenchTimeSource(unsigned long iterations, const void *arg);
+static void RunSimulation(const FRAMESIZE *size);
+static void CompareTimeSources(void);
+
+static const CHECK checks[] = {
+    { "TickSchedule",       CheckTickSchedule },
+    { "Timestamps",         CheckTimestamps },
+    { "BreakDownUptime",    CheckBreakDownUptime },
+    { "FormatClock",        CheckFormatClock },
+    { "FormatUptime",       CheckFormatUptime },
+    { "ClockString",        CheckClockString },
+    { "UptimeString",       CheckUptimeString },
+    { "RenderFrame",        CheckRenderFrame },
+    { "RenderChanges",      CheckRenderChanges },
+    { "TermScreen",         CheckTermScreen },
+    { "Histogram",          CheckHistogram },
+    { "FormatLatencies",    CheckFormatLatencies },
+    { "HiccupMeter",        CheckHiccupMeter },
+    { "UIProbe",            CheckUIProbe },
+    { "CPUProbes",          CheckCPUProbes },
+    { "EventRing",          CheckEventRing },
+    { "TickJournal",        CheckTickJournal },
+    { "HistoryEncoding",    CheckHistoryEncoding },
+    { "HistoryFile",        CheckHistoryFile },
+    { "HistoryQuery",       CheckHistoryQuery },
+    { "HdrLog",             CheckHdrLog },
+    { "Metrics",            CheckMetrics },
+    { "StatePage",          CheckStatePage },
+    { "SimClock",           CheckSimClock },
+    { "AwakeTime",          CheckAwakeTime },
+    { "DriftDetector",      CheckDriftDetector },
+    { "DriftLog",           CheckDriftLog },
+};
+#define cChecks (sizeof(checks) / sizeof(checks[0]))
+
+static const BENCHMARK benchmarks[] = {
+    { "BreakDownUptime",    BenchBreakDownUptime, ITERATIONS },
+    { "FormatClock",        BenchFormatClock, ITERATIONS },
+    { "ClockString",        BenchClockString, ITERATIONS },
+    { "FormatUptime",       BenchFormatUptime, ITERATIONS },
+    { "UptimeString",       BenchUptimeString, ITERATIONS },
+    { "SetClockState",      BenchSetClockState, ITERATIONS },
+    { "MonotonicTime",      BenchTimeSource, ITERATIONS, &timeSources[0] },
+    { "Timestamp",          BenchTimeSource, ITERATIONS, &timeSources[1] },
+    { "RenderFrame/640x480",    BenchRenderFrame, 200, &frameSizes[0] },
+    { "RenderFrame/1920x1080",  BenchRenderFrame, 50, &frameSizes[1] },
+    { "RenderFrame/3840x2160",  BenchRenderFrame, 20, &frameSizes[2] },
+    { "RenderFrame/7680x4320",  BenchRenderFrame, 5, &frameSizes[3] },
+    { "RenderTick/640x480",     BenchRenderTick, 10000, &frameSizes[0] },
+    { "RenderTick/1920x1080",   BenchRenderTick, 10000, &frameSizes[1] },
+    { "RenderTick/3840x2160",   BenchRenderTick, 5000, &frameSizes[2] },
+    { "RenderTick/7680x4320",   BenchRenderTick, 2000, &frameSizes[3] },
+    { "TermTick",           BenchTermTick, 100000 },
+    { "RecordValue",        BenchRecordValue, ITERATIONS },
+    { "AppendTick",         BenchAppendTick, ITERATIONS },
+    { "EncodeHistory",      BenchEncodeHistory, ITERATIONS },
+    { "EventRing",          BenchEventRing, ITERATIONS },
+    { "PublishMetrics",     BenchPublishMetrics, 100000 },
+    { "Scrape",             BenchScrape, 20000 },
+    { "PublishState",       BenchPublishState, ITERATIONS },
+    { "ReadState",          BenchReadState, ITERATIONS },
+    { "SimulatedTick",      BenchSimulatedTick, ITERATIONS },
+    { "SimulatedTick/640x480",  BenchSimulatedTick, 100000, &frameSizes[0] },
+};
+#define cBenchmarks (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+/*
+ * Return a monotonic timestamp in seconds.
+ */
+double
+Seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Return nonzero if the named item was selected on the command line.
+ */
+int
+Selected(const char *name, int argc, char *argv[])
+{
+    int i;
+
+    if (argc == 0)
+        return 1;
+    for (i = 0; i < argc; ++i)
+        if (strcmp(name, argv[i]) == 0)
+            return 1;
+    return 0;
+}
+
+int
+CheckTickSchedule(void)
+{
+    TICKSCHEDULE schedule;
+
+    memset(&schedule, 0, sizeof(schedule));
+
+    // First tick is due on the next second boundary. Until we say
+    // otherwise, the monotonic clock reads the same as the wall clock.
+    ScheduleNextTick(&schedule, 1500000, 1500000);
+    if (schedule.due != 2000000 || schedule.dueMono != 2000000)
+        return -1;
+
+    // A slightly late tick doesn't push back the next one
+    if (CompleteTick(&schedule, 2000300, 2000300) != 300
+        || schedule.due != 3000000)
+        return -1;
+
+    // An early tick waits again for the same second
+    if (CompleteTick(&schedule, 2999900, 2999900) != -1
+        || schedule.due != 3000000)
+        return -1;
+    if (CompleteTick(&schedule, 3000100, 3000100) != 100
+        || schedule.due != 4000000)
+        return -1;
+
+    // After a freeze, we resynchronize with the current second
+    if (CompleteTick(&schedule, 10200000, 10200000) != 6200000
+        || schedule.due != 11000000)
+        return -1;
+
+    // If the wall clock is set back, the next tick is still within a second
+    if (CompleteTick(&schedule, 5300000, 10300000) != -1
+        || schedule.due != 6000000 || schedule.dueMono != 11000000)
+        return -1;
+
+    // Stepping the wall clock forward doesn't make a tick late...
+    if (CompleteTick(&schedule, 9000200, 11000200) != 200
+        || schedule.due != 10000000 || schedule.dueMono != 12000000)
+        return -1;
+
+    // ...and neither does a suspend the monotonic clock didn't count
+    if (CompleteTick(&schedule, 3610000100ULL, 12000100) != 100
+        || schedule.due != 3611000000ULL)
+        return -1;
+
+    return (schedule.maxLateness == 6200000) ? 0 : -1;
+}
+
+/*
+ * Check that timestamps never go backward, and keep pace with the OS
+ * monotonic clock whichever source they come from.
+ */
+int
+CheckTimestamps(void)
+{
+    unsigned long long start, startMono, last, now, elapsed, elapsedMono;
+    int i;
+
+    if ((GetTimestampSource() == TIMESTAMP_TSC) != (GetTSCRate() > 0))
+        return -1;
+
+    start = last = GetTimestamp();
+    startMono = GetMonotonicTime();
+    for (i = 0; i < 100000; ++i) {
+        now = GetTimestamp();
+        if (now < last)
+            return -1;
+        last = now;
+    }
+
+    SleepMicroseconds(20000);
+    elapsed = GetTimestamp() - start;
+    elapsedMono = GetMonotonicTime() - startMono;
+    return (elapsed + 200 < elapsedMono || elapsed > elapsedMono + 200)
+           ? -1 : 0;
+}
+
+int
+CheckBreakDownUptime(void)
+{
+    UPTIME uptime;
+    unsigned long long ticks;
+
+    // 365 d, 23 hr, 59 min, 59 sec and a bit
+    ticks = 365ULL * MSEC_PER_DAY + 23ULL * MSEC_PER_HR
+            + 59ULL * MSEC_PER_MIN + 59ULL * MSEC_PER_SEC + 999;
+    BreakDownUptime(ticks, &uptime);
+    return (uptime.days == 365
+            && uptime.hours == 23
+            && uptime.minutes == 59
+            && uptime.seconds == 59) ? 0 : -1;
+}
+
+int
+CheckFormatClock(void)
+{
+    CCHAR szClock[CLOCK_LEN + 1];
+
+    if (FormatClock(szClock, REFERENCE_TIME) != 0)
+        return -1;
+    return strcmp(szClock, "03/30/2023 12:34:56 AM");
+}
+
+int
+CheckFormatUptime(void)
+{
+    CCHAR szUptime[UPTIME_LEN + 1];
+    UPTIME uptime = { 365, 23, 59, 59 };
+
+    if (FormatUptime(szUptime, &uptime) != 0)
+        return -1;
+    if (strcmp(szUptime, "365 d, 23 hr, 59 min, 59 sec") != 0)
+        return -1;
+
+    uptime.days = 0;
+    uptime.hours = 1;
+    uptime.minutes = 2;
+    uptime.seconds = 3;
+    if (FormatUptime(szUptime, &uptime) != 0)
+        return -1;
+    return strcmp(szUptime, "0 d, 1 hr, 2 min, 3 sec");
+}
+
+/*
+ * Check that the incremental clock string always matches a full
+ * re-format, including across a DST transition and when ticks are missed,
+ * and that the reported change range covers every changed character.
+ */
+int
+CheckClockString(void)
+{
+    static const int steps[] = { 1, 1, 1, 2, 1, 1, 7, 1, 61, 1, -5, 1 };
+    CLOCKSTATE state;
+    CCHAR szPrev[CLOCK_LEN + 1], szClock[CLOCK_LEN + 1];
+    time_t now;
+    int i, j, result = 0;
+
+    // US Eastern time; DST started at 2:00 AM on 03/12/2023
+    setenv("TZ", "EST5EDT,M3.2.0,M11.1.0", 1);
+    tzset();
+
+    memset(&state, 0, sizeof(state));
+    now = (time_t) 1678597200 - 3600;   // 03/12/2023 1:00:00 AM EST
+    for (i = 0; i < 3 * 3600; ++i) {
+        memcpy(szPrev, state.szClock, sizeof(szPrev));
+        if (UpdateClockString(&state, now) != 0
+            || FormatClock(szClock, now) != 0
+            || memcmp(state.szClock, szClock, sizeof(szClock)) != 0) {
+            result = -1;
+            break;
+        }
+        for (j = 0; j < CLOCK_LEN + 1; ++j) {
+            if (szPrev[j] != szClock[j]
+                && (j < state.clockChange.first
+                    || j >= state.clockChange.end))
+                result = -1;
+        }
+        now += steps[i % (sizeof(steps) / sizeof(steps[0]))];
+    }
+
+    setenv("TZ", "UTC0", 1);
+    tzset();
+    return result;
+}
+
+/*
+ * Check that the incremental uptime string always matches a full
+ * re-format, including across day boundaries and when the tick count
+ * jumps, and that the reported change range covers every changed
+ * character.
+ */
+int
+CheckUptimeString(void)
+{
+    static const int steps[] = {
+        1000, 999, 1001, 1000, 1003, 998, 15000, 1000, 2500, -3000, 1000,
+    };
+    CLOCKSTATE state;
+    UPTIME uptime;
+    CCHAR szPrev[UPTIME_LEN + 1], szUptime[UPTIME_LEN + 1];
+    unsigned long long ticks;
+    int i, j;
+
+    memset(&state, 0, sizeof(state));
+    ticks = 9ULL * MSEC_PER_DAY - 2ULL * MSEC_PER_HR + 123;
+    for (i = 0; i < 4 * 3600 * 2; ++i) {
+        memcpy(szPrev, state.szUptime, sizeof(szPrev));
+        BreakDownUptime(ticks, &uptime);
+        if (UpdateUptimeString(&state, ticks) != 0
+            || FormatUptime(szUptime, &uptime) != 0
+            || memcmp(state.szUptime, szUptime, sizeof(szUptime)) != 0
+            || memcmp(&state.uptime, &uptime, sizeof(uptime)) != 0)
+            return -1;
+        for (j = 0; j < UPTIME_LEN + 1; ++j) {
+            if (szPrev[j] != szUptime[j]
+                && (j < state.uptimeChange.first
+                    || j >= state.uptimeChange.end))
+                return -1;
+        }
+        ticks += steps[i % (sizeof(steps) / sizeof(steps[0]))];
+    }
+
+    return 0;
+}
+
+/*
+ * Check the rendered reference frame against a known checksum.
+ */
+int
+CheckRenderFrame(void)
+{
+    CLOCKFACE face;
+    CLOCKSTATE state;
+    unsigned long hash;
+
+    memset(&state, 0, sizeof(state));
+    if (SetClockState(&state, REFERENCE_TIME, 123456789ULL) != 0
+        || CreateClockFace(&face, 320, 240) != 0)
+        return -1;
+
+    RenderClockFace(&face, &state, NULL);
+    hash = HashFrame(&face.fb);
+    FreeClockFace(&face);
+
+    return (hash == REFERENCE_FRAME_HASH) ? 0 : -1;
+}
+
+/*
+ * Check that redrawing only the changed areas after each tick gives the
+ * same result as redrawing the whole frame.
+ */
+int
+CheckRenderChanges(void)
+{
+    static const CCHAR *status[] = {
+        CTEXT("Hiccups: 99% 0.1 ms, 99.9% 0.4 ms, max 12.3 ms"),
+        CTEXT("Hiccups: 99% 0.1 ms, 99.9% 0.5 ms, max 12.3 ms"),
+        CTEXT("Hiccups: 99% 0.1 ms, 99.9% 0.5 ms, max 123.4 ms"),
+        CTEXT(""),
+    };
+    CLOCKFACE face, full;
+    CLOCKSTATE state;
+    FBRECT rects[MAX_FACE_CHANGES];
+    int i, j, cRects, result = 0;
+
+    memset(&state, 0, sizeof(state));
+    if (CreateClockFace(&face, 640, 480) != 0)
+        return -1;
+    if (CreateClockFace(&full, 640, 480) != 0) {
+        FreeClockFace(&face);
+        return -1;
+    }
+
+    // Start at 9 d, 23 hr, 59 min, 50 sec so the uptime changes width
+    for (i = 0; i < 20 && result == 0; ++i) {
+        if (SetClockState(&state, REFERENCE_TIME + i,
+                          (9ULL * 24 * 3600 - 10 + i) * MSEC_PER_SEC) != 0) {
+            result = -1;
+            break;
+        }
+        SetStatusLine(&state, STATUS_HICCUPS, status[i % 4]);
+
+        cRects = GetClockFaceChanges(&face, &state, rects);
+        if (i == 0)
+            RenderClockFace(&face, &state, NULL);
+        else
+            for (j = 0; j < cRects; ++j)
+                RenderClockFace(&face, &state, &rects[j]);
+
+        RenderClockFace(&full, &state, NULL);
+        if (memcmp(face.fb.pixels, full.fb.pixels,
+                   sizeof(PIXEL) * face.fb.width * face.fb.height) != 0)
+            result = -1;
+    }
+
+    FreeClockFace(&face);
+    FreeClockFace(&full);
+    return result;
+}
+
+/*
+ * Check that terminal updates send only what changed, with the cheapest
+ * cursor movement, and that a normal tick fits a slow serial line.
+ */
+int
+CheckTermScreen(void)
+{
+    TERMSCREEN screen;
+    CLOCKSTATE state;
+    size_t len;
+    int result = -1;
+
+    memset(&state, 0, sizeof(state));
+    if (CreateTermScreen(&screen, 80, 24, TERM_ASCII_BLOCK) != 0)
+        return -1;
+
+    // The first update clears the screen, and the next has nothing to do
+    SetClockState(&state, REFERENCE_TIME, 123456789ULL);
+    DrawTermClock(&screen, &state);
+    len = UpdateTermScreen(&screen);
+    if (len < 4 || memcmp(screen.out, "\033[H\033[2J", 4) != 0
+        || UpdateTermScreen(&screen) != 0)
+        goto done;
+
+    // Nearby changes are joined by rewriting what's between them, and
+    // distant ones by moving the cursor forward
+    screen.cells[80 + 10] = 'x';
+    screen.cells[80 + 12] = 'y';
+    screen.cells[80 + 30] = 'z';
+    len = UpdateTermScreen(&screen);
+    if (len != 16 || memcmp(screen.out, "\033[2;11Hx y\033[17Cz", len) != 0)
+        goto done;
+
+    // The cursor's position is unknown after the last column
+    screen.cells[80 + 79] = 'x';
+    screen.cells[160] = 'y';
+    len = UpdateTermScreen(&screen);
+    if (len != 15 || memcmp(screen.out, "\033[2;80Hx\033[3;1Hy", len) != 0)
+        goto done;
+
+    // A normal tick changes a digit or two
+    SetClockState(&state, REFERENCE_TIME + 1, 123457789ULL);
+    DrawTermClock(&screen, &state);
+    len = UpdateTermScreen(&screen);
+    if (len == 0 || len > 100
+        || memcmp(screen.cells, screen.shown, 80 * 24) != 0)
+        goto done;
+
+    result = 0;
+done:
+    FreeTermScreen(&screen);
+    return result;
+}
+
+/*
+ * Check histogram bucketing and percentiles against known values.
+ */
+int
+CheckHistogram(void)
+{
+    static HISTOGRAM histogram;
+    static HISTSNAPSHOT snapshot;
+    unsigned long long value;
+    int i;
+
+    // Values up to 255 are exact; above that, within 1%
+    for (value = 0; value < 256; ++value)
+        if (GetValueFromIndex(GetCountsIndex(value)) != value)
+            return -1;
+    for (value = 256; value <= HIST_HIGHEST; value = value * 3 / 2) {
+        i = GetCountsIndex(value);
+        if (GetValueFromIndex(i) > value
+            || GetValueFromIndex(i + 1) <= value
+            || (GetValueFromIndex(i + 1) - GetValueFromIndex(i)) * 100
+               > value)
+            return -1;
+    }
+
+    // 1..1000 once each
+    InitHistogram(&histogram);
+    for (value = 1; value <= 1000; ++value)
+        RecordValue(&histogram, value);
+    SnapshotHistogram(&histogram, &snapshot);
+    if (snapshot.totalCount != 1000
+        || snapshot.maxValue != 1000
+        || GetValueAtPercentile(&snapshot, 50.0) != 501
+        || GetValueAtPercentile(&snapshot, 99.0) != 991
+        || GetValueAtPercentile(&snapshot, 100.0) != 1000)
+        return -1;
+
+    // One 10 ms stall at a 1 ms interval fills in the 9 samples it missed
+    InitHistogram(&histogram);
+    RecordCorrectedValue(&histogram, 10000, 1000);
+    SnapshotHistogram(&histogram, &snapshot);
+    if (snapshot.totalCount != 10
+        || snapshot.counts[GetCountsIndex(1000)] != 1)
+        return -1;
+
+    // A value that wrapped around is clamped before being filled in
+    InitHistogram(&histogram);
+    RecordCorrectedValue(&histogram, ~0ULL - 5, USEC_PER_SEC);
+    SnapshotHistogram(&histogram, &snapshot);
+    if (snapshot.totalCount != HIST_HIGHEST / USEC_PER_SEC)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * Check the latency summary string.
+ */
+int
+CheckFormatLatencies(void)
+{
+    static HISTOGRAM histogram;
+    static HISTSNAPSHOT snapshot;
+    CCHAR sz[STATUS_LEN + 1];
+    int i, len;
+
+    InitHistogram(&histogram);
+    for (i = 0; i < 998; ++i)
+        RecordValue(&histogram, 40);
+    RecordValue(&histogram, 460);
+    RecordValue(&histogram, 12345);
+    SnapshotHistogram(&histogram, &snapshot);
+
+    len = FormatLatencies(sz, HICCUP_LABEL, &snapshot);
+    return (len <= STATUS_LEN
+            && strcmp(sz, "Hiccups: 99% 0.0 ms, 99.9% 0.5 ms, max 12.3 ms")
+               == 0) ? 0 : -1;
+}
+
+/*
+ * Check that the hiccup meter takes samples and stops when asked.
+ */
+int
+CheckHiccupMeter(void)
+{
+    static HICCUPMETER meter;
+    static HISTSNAPSHOT snapshot;
+
+    if (StartHiccupMeter(&meter, HICCUP_INTERVAL, HICCUP_ANY_CPU) != 0)
+        return -1;
+    SleepMicroseconds(20 * USEC_PER_MSEC);
+    StopHiccupMeter(&meter);
+
+    SnapshotHistogram(&meter.histogram, &snapshot);
+    return (snapshot.totalCount > 0) ? 0 : -1;
+}
+
+/*
+ * Check that the UI probe sees an event loop stall.
+ */
+int
+CheckUIProbe(void)
+{
+    static UIPROBE probe;
+    static HISTSNAPSHOT snapshot;
+
+    if (StartUIProbe(&probe, USEC_PER_MSEC, NULL, NULL) != 0)
+        return -1;
+
+    // Stall the "event loop" for 20 ms, then catch up
+    SleepMicroseconds(20 * USEC_PER_MSEC);
+    ReadUIProbePings(&probe);
+    StopUIProbe(&probe);
+
+    // The first ping waited out most of the stall
+    SnapshotHistogram(&probe.histogram, &snapshot);
+    return (snapshot.totalCount > 1
+            && snapshot.maxValue >= 15 * USEC_PER_MSEC) ? 0 : -1;
+}
+
+/*
+ * Check that a probe runs on every CPU, and the per-CPU display strings.
+ */
+int
+CheckCPUProbes(void)
+{
+    static HICCUPMETER meters[130];
+    static HISTSNAPSHOT snapshot;
+    CPUPROBES probes;
+    CCHAR sz[STATUS_LEN + 1];
+    int i;
+
+    if (StartCPUProbes(&probes, HICCUP_INTERVAL) != 0)
+        return -1;
+    SleepMicroseconds(20 * USEC_PER_MSEC);
+    for (i = 0; i < probes.cCPUs; ++i)
+        atomic_store(&probes.meters[i].fStop, 1);
+    for (i = 0; i < probes.cCPUs; ++i) {
+        JoinThread(&probes.meters[i].thread);
+        SnapshotHistogram(&probes.meters[i].histogram, &snapshot);
+        if (snapshot.totalCount == 0
+            || (uintptr_t) &probes.meters[i] % CACHE_LINE_SIZE != 0)
+            break;
+    }
+    StopCPUProbes(&probes);
+    if (i < probes.cCPUs)
+        return -1;
+
+    // Pretend we have 130 CPUs, one of them very slow
+    probes.meters = meters;
+    probes.cCPUs = 130;
+    for (i = 0; i < 130; ++i)
+        atomic_init(&meters[i].histogram.maxValue, (i % 10) * 40);
+    atomic_init(&meters[77].histogram.maxValue, 12345);
+    FormatCPUSummary(sz, &probes);
+    if (strcmp(sz, "CPU latency: max 12.3 ms on CPU 77 of 130") != 0)
+        return -1;
+    FormatCPUMap(sz, &probes);
+    if (strcmp(sz, ".222122122.222122122.222172122.222122122.222") != 0)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * Check that events come out of the ring in order, that overflow is
+ * counted, and that nothing is lost or garbled between threads.
+ */
+int
+CheckEventRing(void)
+{
+    static EVENTRING ring;
+    EVENTRECORD event;
+    THREAD producer;
+    long long next;
+    unsigned int received, lost;
+    int i;
+
+    // Overfill it on one thread
+    InitEventRing(&ring);
+    memset(&event, 0, sizeof(event));
+    event.type = EVENT_STALL;
+    for (i = 0; i < EVENT_RING_SIZE + 3; ++i) {
+        event.amount = i;
+        if (PostEvent(&ring, &event) != ((i < EVENT_RING_SIZE) ? 0 : -1))
+            return -1;
+    }
+    if (TakeEventOverflow(&ring) != 3 || TakeEventOverflow(&ring) != 0)
+        return -1;
+    for (i = 0; ReadEvent(&ring, &event); ++i)
+        if (event.type != EVENT_STALL || event.amount != i)
+            return -1;
+    if (i != EVENT_RING_SIZE)
+        return -1;
+
+    // Now have another thread flood it while we read; every event should
+    // either arrive in order or be counted as dropped
+    InitEventRing(&ring);
+    if (StartThread(&producer, PostRingEvents, &ring) != 0)
+        return -1;
+    next = 0;
+    received = 0;
+    lost = 0;
+    while (received + lost < RING_EVENTS) {
+        if (!ReadEvent(&ring, &event)) {
+            lost += TakeEventOverflow(&ring);
+            continue;
+        }
+        if (event.amount < next || event.source != (int) event.amount)
+            break;
+        next = event.amount + 1;
+        ++received;
+    }
+    JoinThread(&producer);
+    return (received + lost == RING_EVENTS) ? 0 : -1;
+}
+
+/*
+ * Post RING_EVENTS events to a ring as fast as possible.
+ */
+void
+PostRingEvents(void *arg)
+{
+    EVENTRECORD event;
+    int i;
+
+    memset(&event, 0, sizeof(event));
+    event.type = EVENT_STALL;
+    for (i = 0; i < RING_EVENTS; ++i) {
+        event.source = i;
+        event.amount = i;
+        PostEvent(arg, &event);
+    }
+}
+
+/*
+ * Check that the tick journal wraps around, survives being reopened, and
+ * can recover from a record or header that never made it to disk.
+ */
+int
+CheckTickJournal(void)
+{
+    TICKJOURNAL journal;
+    TICKRECORD record;
+    CLOCKSTATE state;
+    char path[256];
+    int i, result = -1;
+
+    GetTempPath(path, sizeof(path), "jnl");
+    memset(&state, 0, sizeof(state));
+
+    if (OpenTickJournal(&journal, path, 10) != 0)
+        return -1;
+    for (i = 1; i <= 25; ++i) {
+        state.wallTime = (REFERENCE_TIME + i) * 1000000ULL;
+        state.ticks = i * MSEC_PER_SEC;
+        AppendTick(&journal, &state);
+    }
+    CloseTickJournal(&journal);
+
+    // Pick up where we left off
+    if (OpenTickJournal(&journal, path, 10) != 0)
+        goto done;
+    if (ReadLastTick(&journal, &record) != 0
+        || record.sequence != 25
+        || record.ticks != 25 * MSEC_PER_SEC)
+        goto close;
+    state.ticks = 26 * MSEC_PER_SEC;
+    AppendTick(&journal, &state);
+
+    // Pretend the records were written to disk but the header wasn't
+    journal.header->sequence = 22;
+    if (ReadLastTick(&journal, &record) != 0
+        || record.sequence != 26
+        || record.ticks != 26 * MSEC_PER_SEC)
+        goto close;
+
+    // Pretend the header was written to disk but the record wasn't
+    journal.header->sequence = 27;
+    if (ReadLastTick(&journal, &record) != 0
+        || record.sequence != 26
+        || record.ticks != 26 * MSEC_PER_SEC)
+        goto close;
+    CloseTickJournal(&journal);
+
+    // Reopening catches the header up, so we don't overwrite anything
+    if (OpenTickJournal(&journal, path, 10) != 0)
+        goto done;
+    if (journal.header->sequence != 26)
+        goto close;
+    CloseTickJournal(&journal);
+
+    // A journal with a different capacity is started over
+    if (OpenTickJournal(&journal, path, 20) != 0)
+        goto done;
+    if (ReadLastTick(&journal, &record) == 0)
+        goto close;
+    result = 0;
+
+close:
+    CloseTickJournal(&journal);
+done:
+    unlink(path);
+    return result;
+}
+
+/*
+ * Check that history samples survive compression, and that a normal
+ * second costs one bit.
+ */
+int
+CheckHistoryEncoding(void)
+{
+    static HISTORYENCODER encoder;
+    static HISTORYSAMPLE samples[2000];
+    HISTORYCURSOR cursor;
+    HISTORYSAMPLE sample;
+    unsigned int i, first, end;
+
+    for (i = 0; i < 2000; ++i) {
+        samples[i].time = REFERENCE_TIME + i;
+        samples[i].uptime = 123456 + i;
+    }
+    samples[1100].time += 30;               // 30-second freeze
+    samples[1100].uptime += 30;
+    samples[1200].time -= 3600;             // clock set back an hour
+    samples[1300].uptime = 5;               // reboot
+    samples[1400].time += 300000;           // a few days' suspend
+    samples[1400].uptime += 300000;
+    for (i = 1500; i < 2000; ++i)           // clock set way ahead
+        samples[i].time += 4000000000LL;
+    for (i = 1600; i < 2000; i += 7)        // jitter
+        samples[i].uptime += 1;
+
+    // Normal seconds cost one bit each
+    StartHistoryBlock(&encoder, &samples[0]);
+    for (i = 1; i < 1100; ++i)
+        EncodeHistorySample(&encoder, &samples[i]);
+    if (encoder.block.cBits != 1099)
+        return -1;
+
+    // The jump at 1500 is too big to encode, so it starts a new block
+    for (first = 0; first < 2000; first = end) {
+        StartHistoryBlock(&encoder, &samples[first]);
+        for (end = first + 1; end < 2000; ++end)
+            if (EncodeHistorySample(&encoder, &samples[end]) != 0)
+                break;
+        if (end != ((first == 0) ? 1500 : 2000))
+            return -1;
+
+        StartHistoryCursor(&cursor, &encoder.block);
+        for (i = first; NextHistorySample(&cursor, &sample) == 0; ++i)
+            if (i >= end
+                || sample.time != samples[i].time
+                || sample.uptime != samples[i].uptime)
+                return -1;
+        if (i != end)
+            return -1;
+    }
+
+    // A resumed block picks up where it left off
+    if (ResumeHistoryBlock(&encoder) != 0
+        || encoder.last.time != samples[1999].time
+        || encoder.last.uptime != samples[1999].uptime)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * Check that the history file can be closed and reopened, and that a
+ * block is started over if it's damaged.
+ */
+int
+CheckHistoryFile(void)
+{
+    static HISTORYFILE history;
+    static HISTORYBLOCK block;
+    HISTORYCURSOR cursor;
+    HISTORYSAMPLE sample;
+    CLOCKSTATE state;
+    char path[256];
+    FILE *fp;
+    int i, result = -1;
+
+    GetTempPath(path, sizeof(path), "hst");
+    unlink(path);
+    memset(&state, 0, sizeof(state));
+
+    // Two sessions, with a reboot in between. The ticks land just before
+    // a second of uptime, with enough jitter to straddle it sometimes.
+    for (i = 0; i < 150; ++i) {
+        if ((i == 0 || i == 100) && OpenHistory(&history, path) != 0)
+            goto done;
+        state.now = REFERENCE_TIME + i;
+        state.ticks = (i < 100 ? 1000000 + i : i - 100) * MSEC_PER_SEC
+                      + 998 + i % 3;
+        AppendHistory(&history, &state);
+        if (i == 99)
+            CloseHistory(&history);
+    }
+    CloseHistory(&history);
+
+    // Both sessions should be in a single block
+    fp = fopen(path, "rb");
+    if (fp == NULL)
+        goto done;
+    i = (fread(&block, sizeof(block), 1, fp) == 1 && fgetc(fp) == EOF);
+    fclose(fp);
+    if (!i)
+        goto done;
+
+    StartHistoryCursor(&cursor, &block);
+    for (i = 0; NextHistorySample(&cursor, &sample) == 0; ++i)
+        if (sample.time != REFERENCE_TIME + i
+            || sample.uptime != (i < 100 ? 1000000 + i : i - 100))
+            goto done;
+    if (i == 150)
+        result = 0;
+
+done:
+    unlink(path);
+    return result;
+}
+
+/*
+ * Check the awake time source and its display string.
+ */
+int
+CheckAwakeTime(void)
+{
+    unsigned long long awakeTicks, ticks;
+    CCHAR sz[STATUS_LEN + 1];
+
+    // Linux always has CLOCK_MONOTONIC, and it can't be ahead of the uptime
+    if (GetAwakeTicks(&awakeTicks) != 0)
+        return -1;
+    ticks = GetUptimeTicks();
+    if (awakeTicks > ticks + 1)
+        return -1;
+
+    if (FormatAwakeTime(sz, 9ULL * MSEC_PER_DAY + 3723456ULL) != 0
+        || strcmp(sz, "Awake 9 d, 1 hr, 2 min, 3 sec") != 0)
+        return -1;
+    return 0;
+}
+
+/*
+ * Check that the drift detector ignores tick jitter but catches steps
+ * and slews.
+ */
+int
+CheckDriftDetector(void)
+{
+    DRIFTDETECTOR detector;
+    DRIFTEVENT event;
+    CLOCKSTATE state;
+    int i, cSteps = 0, cSlews = 0, cSuspends = 0;
+
+    memset(&detector, 0, sizeof(detector));
+    memset(&state, 0, sizeof(state));
+    state.wallTime = REFERENCE_TIME * 1000000ULL;
+    state.ticks = 123456789ULL;
+    state.awakeTicks = 12345678ULL;
+    state.fAwakeValid = 1;
+
+    for (i = 0; i < 4000; ++i) {
+        // Up to 16 ms of jitter, like GetTickCount()
+        state.wallTime += USEC_PER_SEC;
+        state.ticks += MSEC_PER_SEC + ((i % 2) ? 16 : -16);
+        state.awakeTicks += MSEC_PER_SEC;
+
+        if (i == 500) {                 // suspend for an hour
+            state.wallTime += 3600ULL * USEC_PER_SEC;
+            state.ticks += 3600ULL * MSEC_PER_SEC;
+        } else if (i == 1000)           // step ahead two seconds
+            state.wallTime += 2 * USEC_PER_SEC;
+        else if (i >= 2000 && i < 3000) // slew 300 ppm behind
+            state.wallTime -= 300;
+
+        if (!CheckDrift(&detector, &state, &event))
+            continue;
+        if (event.type == DRIFT_SUSPEND
+            && i == 500
+            && event.amount >= 3599984000LL && event.amount <= 3600016000LL)
+            ++cSuspends;
+        else if (event.type == DRIFT_STEP
+                 && i == 1000
+                 && event.amount >= 1984000 && event.amount <= 2016000)
+            ++cSteps;
+        else if (event.type == DRIFT_SLEW
+                 && i >= 2000 && i < 3600
+                 && event.amount <= -DRIFT_SLEW_THRESHOLD
+                 && event.amount >= -300)
+            ++cSlews;
+        else
+            return -1;
+    }
+
+    return (cSuspends == 1 && cSteps == 1 && cSlews >= 1) ? 0 : -1;
+}
+
+/*
+ * Check the drift event log.
+ */
+int
+CheckDriftLog(void)
+{
+    DRIFTEVENT event;
+    char path[256], line[DRIFT_EVENT_LEN + 2];
+    CCHAR sz[STATUS_LEN + 1];
+    FILE *fp;
+    int result = -1;
+
+    event.type = DRIFT_STEP;
+    event.wallTime = REFERENCE_TIME * 1000000ULL;
+    event.amount = -1234567;
+    if (FormatDriftStatus(sz, &event, REFERENCE_TIME + 60) == 0
+        || strcmp(sz, "Clock stepped -1.234 s at 00:34:56") != 0
+        || FormatDriftStatus(sz, &event,
+                             REFERENCE_TIME + DRIFT_DISPLAY_TIME + 1) != 0)
+        return -1;
+    event.type = DRIFT_STALL;
+    event.amount = 2345678;
+    if (FormatDriftStatus(sz, &event, REFERENCE_TIME + 60) == 0
+        || strcmp(sz, "Stalled 2.345 s until 00:34:56") != 0)
+        return -1;
+    event.type = DRIFT_STEP;
+    event.amount = -1234567;
+
+    GetTempPath(path, sizeof(path), "log");
+    unlink(path);
+    if (LogDriftEvent(path, &event) != 0)
+        return -1;
+    event.type = DRIFT_SLEW;
+    event.amount = 250;
+    if (LogDriftEvent(path, &event) != 0)
+        goto done;
+
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        goto done;
+    if (fgets(line, sizeof(line), fp) != NULL
+        && strcmp(line, "2023-03-30T00:34:56Z step -1.234567 s\n") == 0
+        && fgets(line, sizeof(line), fp) != NULL
+        && strcmp(line, "2023-03-30T00:34:56Z slew +250 ppm\n") == 0)
+        result = 0;
+    fclose(fp);
+
+done:
+    unlink(path);
+    return result;
+}
+
+/*
+ * Check that a block's header indexes its samples, and that gap queries
+ * find what they should and skip what they can.
+ */
+int
+CheckHistoryQuery(void)
+{
+    static HISTORYENCODER encoder;
+    HISTORYQUERY query;
+    HISTORYSAMPLE sample;
+    long long gaps[2];
+    int i;
+
+    sample.time = REFERENCE_TIME;
+    sample.uptime = 123456;
+    StartHistoryBlock(&encoder, &sample);
+    for (i = 1; i < 1000; ++i) {
+        sample.time += 1;
+        sample.uptime += 1;
+        if (i == 100) {                     // 30-second freeze
+            sample.time += 29;
+            sample.uptime += 29;
+        } else if (i == 200) {              // clock set back an hour
+            sample.time -= 3600;
+        } else if (i == 300) {              // reboot after five minutes
+            sample.time += 300;
+            sample.uptime = 60;
+        }
+        EncodeHistorySample(&encoder, &sample);
+    }
+
+    // The clock change isn't a gap, but it does widen the time range
+    if (encoder.block.maxGap != 301
+        || encoder.block.minTime != REFERENCE_TIME + 29 + 200 - 3600
+        || encoder.block.maxTime != REFERENCE_TIME + 29 + 199
+        || encoder.block.last.time != sample.time
+        || encoder.block.last.uptime != sample.uptime)
+        return -1;
+
+    // Everything over 10 seconds
+    query.start = REFERENCE_TIME - 4000;
+    query.end = REFERENCE_TIME + 1000;
+    query.threshold = 10;
+    gaps[0] = gaps[1] = 0;
+    if (ScanHistoryBlock(&query, &encoder.block, CountGap, gaps) != 2
+        || gaps[0] != 30 || gaps[1] != 301)
+        return -1;
+
+    // Only the freeze, by time
+    query.start = REFERENCE_TIME;
+    if (ScanHistoryBlock(&query, &encoder.block, CountGap, gaps) != 1)
+        return -1;
+
+    // Nothing, and the header says so without decoding anything
+    query.threshold = 301;
+    if (MayMatchHistoryBlock(&query, &encoder.block))
+        return -1;
+    query.threshold = 1;
+    query.start = REFERENCE_TIME + 2000;
+    query.end = REFERENCE_TIME + 3000;
+    if (MayMatchHistoryBlock(&query, &encoder.block))
+        return -1;
+
+    return 0;
+}
+
+/*
+ * Check that histograms are logged in a form HdrHistogram can read.
+ * The expected line was checked by decoding it with Python's zlib.
+ */
+int
+CheckHdrLog(void)
+{
+    static HISTOGRAM histogram;
+    static HISTSNAPSHOT snapshot;
+    static HDRLOG log;
+    static char sz[HDRLOG_LINE_LEN];
+    static const char szExpected[] =
+        "Tag=test,1680136496.000,60.000,0.009,"
+        "HISTFAAAADl4AQEuANH/HISTEwAAAAYAAAAAAAAAAgAAAAAAAAABAAAAANaTpAA/"
+        "8AAAAAAAAAAGAAIJBG0JBKE=";
+    char path[256], line[256];
+    FILE *fp;
+    int i, result = -1;
+
+    // Counts of 0, 3, 0, 1, five zeros, then 2 encode as 0 6 0 2 9 4
+    InitHistogram(&histogram);
+    for (i = 0; i < 3; ++i)
+        RecordValue(&histogram, 1);
+    RecordValue(&histogram, 3);
+    RecordValue(&histogram, 9);
+    RecordValue(&histogram, 9);
+    SnapshotHistogram(&histogram, &snapshot);
+    FormatHdrLogLine(sz, "test", REFERENCE_TIME * 1000000ULL,
+                     (REFERENCE_TIME + 60) * 1000000ULL, &snapshot);
+    if (strcmp(sz, szExpected) != 0)
+        return -1;
+
+    // Only what's recorded after the log starts goes in it
+    GetTempPath(path, sizeof(path), "hlog");
+    unlink(path);
+    memset(&log, 0, sizeof(log));
+    AddHdrLogSource(&log, "test", &histogram);
+    if (StartHdrLog(&log, path, HDRLOG_INTERVAL) != 0)
+        return -1;
+    RecordValue(&histogram, 9);
+    StopHdrLog(&log);
+
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        goto done;
+    for (i = 0; fgets(line, sizeof(line), fp) != NULL; ++i) {
+        if ((i == 0 && strncmp(line, "#[Histogram log format", 22) != 0)
+            || (i == 4 && (strncmp(line, "Tag=test,", 9) != 0
+                           || strstr(line, ",0.009,HISTF") == NULL)))
+            break;
+    }
+    if (i == 5)
+        result = 0;
+    fclose(fp);
+
+done:
+    unlink(path);
+    return result;
+}
+
+/*
+ * Check that metrics are served in the OpenMetrics format, and that
+ * scrapes get the latest published response.
+ */
+int
+CheckMetrics(void)
+{
+    static HISTOGRAM histogram;
+    static METRICSERVER server;
+    static char response[METRICS_RESPONSE_SIZE];
+    CLOCKSTATE state;
+    int sock, result = -1;
+
+    InitHistogram(&histogram);
+    RecordValue(&histogram, 50);
+    RecordValue(&histogram, 50);
+    RecordValue(&histogram, 300);
+    RecordValue(&histogram, 2000000);
+
+    memset(&server, 0, sizeof(server));
+    AddMetricHistogram(&server, "test_seconds", "Test.", &histogram);
+    if (StartMetricServer(&server, 0) != 0)
+        return -1;
+    sock = ConnectMetrics(server.port);
+    if (sock == -1)
+        goto done;
+
+    // Nothing to serve until the first tick
+    if (Scrape(sock, "/metrics", response, sizeof(response)) <= 0
+        || strncmp(response, "HTTP/1.1 503 ", 13) != 0)
+        goto done;
+
+    memset(&state, 0, sizeof(state));
+    SetClockState(&state, REFERENCE_TIME, 123456789ULL);
+    state.wallTime = REFERENCE_TIME * 1000000ULL;
+    PublishMetrics(&server, &state);
+    if (Scrape(sock, "/metrics", response, sizeof(response)) <= 0
+        || strncmp(response, "HTTP/1.1 200 OK\r\n", 17) != 0
+        || strstr(response, "\nuclock_uptime_seconds 123456.789\n") == NULL
+        || strstr(response, "\nuclock_wall_drift_seconds 0.000\n") == NULL
+        || strstr(response, "\ntest_seconds_bucket{le=\"0.0001\"} 2\n")
+           == NULL
+        || strstr(response, "\ntest_seconds_bucket{le=\"0.00025\"} 2\n")
+           == NULL
+        || strstr(response, "\ntest_seconds_bucket{le=\"1\"} 3\n") == NULL
+        || strstr(response, "\ntest_seconds_bucket{le=\"+Inf\"} 4\n")
+           == NULL
+        || strstr(response, "\ntest_seconds_count 4\n") == NULL
+        || strcmp(response + strlen(response) - 6, "# EOF\n") != 0)
+        goto done;
+
+    // The wall clock gains a second on the uptime
+    SetClockState(&state, REFERENCE_TIME + 2, 123457789ULL);
+    state.wallTime = (REFERENCE_TIME + 2) * 1000000ULL;
+    PublishMetrics(&server, &state);
+    if (Scrape(sock, "/metrics", response, sizeof(response)) <= 0
+        || strstr(response, "\nuclock_wall_drift_seconds 1.000\n") == NULL)
+        goto done;
+
+    if (Scrape(sock, "/", response, sizeof(response)) <= 0
+        || strncmp(response, "HTTP/1.1 404 ", 13) != 0)
+        goto done;
+
+    result = 0;
+done:
+    if (sock != -1)
+        close(sock);
+    StopMetricServer(&server);
+    return result;
+}
+
+/*
+ * Check that the shared state page can be read back, that only one clock
+ * can publish it at a time, and that a reader never sees a torn update
+ * while another thread publishes as fast as it can.
+ */
+int
+CheckStatePage(void)
+{
+    static STATEPAGE statePage, other;
+    CLOCKSTATEREADER reader;
+    CLOCKSNAPSHOT snapshot;
+    CLOCKSTATE state;
+    THREAD publisher;
+    char name[64];
+    unsigned long long last;
+
+    GetStateName(name, sizeof(name));
+    if (OpenStatePage(&statePage, name) != 0)
+        return -1;
+    if (OpenStatePage(&other, name) == 0) {
+        CloseStatePage(&other);
+        goto done;
+    }
+    if (OpenClockStateReader(&reader, name) != 0)
+        goto done;
+
+    memset(&state, 0, sizeof(state));
+    SetClockState(&state, REFERENCE_TIME, 123456789ULL);
+    state.wallTime = REFERENCE_TIME * 1000000ULL;
+    state.lateness = 250;
+    CountStall(&statePage, state.wallTime - 5000000, 150000);
+    CountStall(&statePage, state.wallTime - 1000000, 300000);
+    CountDroppedEvents(&statePage, 2);
+    PublishState(&statePage, &state);
+    if (ReadClockSnapshot(&reader, &snapshot) != 0
+        || snapshot.wallTime != REFERENCE_TIME * 1000000ULL
+        || snapshot.ticks != 123456789ULL
+        || snapshot.lateness != 250
+        || snapshot.tickCount != 1
+        || snapshot.stalls != 2
+        || snapshot.stallTime != 450000
+        || snapshot.longestStall != 300000
+        || snapshot.lastStall != state.wallTime - 1000000
+        || snapshot.dropped != 2
+        || snapshot.fStopped)
+        goto close;
+
+    // Every state the other thread publishes has lateness and wallTime
+    // derived from ticks, so a torn read shows up as a mismatch
+    if (StartThread(&publisher, PublishTestStates, &statePage) != 0)
+        goto close;
+    last = 0;
+    do {
+        if (ReadClockSnapshot(&reader, &snapshot) != 0)
+            break;
+        if (snapshot.tickCount == 1)    // still the state from above
+            continue;
+        if (snapshot.ticks < last
+            || snapshot.wallTime != snapshot.ticks * 1000
+            || snapshot.lateness != (long long) snapshot.ticks % 1000)
+            break;
+        last = snapshot.ticks;
+    } while (snapshot.tickCount < STATE_TICKS + 1);
+    JoinThread(&publisher);
+    if (snapshot.tickCount < STATE_TICKS + 1)
+        goto close;
+
+    // A reader that still has the page open sees the clock stop
+    CloseStatePage(&statePage);
+    if (ReadClockSnapshot(&reader, &snapshot) != 0 || !snapshot.fStopped)
+        goto close;
+    CloseClockStateReader(&reader);
+    return (OpenClockStateReader(&reader, name) == 0) ? -1 : 0;
+
+close:
+    CloseClockStateReader(&reader);
+done:
+    CloseStatePage(&statePage);
+    return -1;
+}
+
+/*
+ * Publish STATE_TICKS states to a state page as fast as possible.
+ */
+void
+PublishTestStates(void *arg)
+{
+    CLOCKSTATE state;
+    int i;
+
+    memset(&state, 0, sizeof(state));
+    for (i = 1; i <= STATE_TICKS; ++i) {
+        state.ticks = i;
+        state.wallTime = i * 1000ULL;
+        state.lateness = i % 1000;
+        PublishState(arg, &state);
+    }
+}
+
+/*
+ * Check the whole per-tick path on a simulated clock, across dates and
+ * uptimes that would take too long to wait for.
+ */
+int
+CheckSimClock(void)
+{
+    SIMCLOCK sim;
+    CLOCKSTATE state;
+
+    memset(&state, 0, sizeof(state));
+    state.source = &sim.source;
+
+    // A leap day at the same moment as GetTickCount() wraps around
+    StartSimClock(&sim, 1709164797ULL * USEC_PER_SEC,   // 02/28 11:59:57 PM
+                  0xFFFFFFFFULL - 2500, 1);
+    if (CheckSimTicks(&sim, &state, 5) != 0
+        || strcmp(state.szClock, "02/29/2024 12:00:01 AM") != 0
+        || strcmp(state.szUptime, "49 d, 17 hr, 2 min, 48 sec") != 0)
+        return -1;
+
+    // And the next day
+    StepSimClock(&sim, 86400LL * USEC_PER_SEC - 5 * USEC_PER_SEC);
+    if (CheckSimTicks(&sim, &state, 5) != 0
+        || strcmp(state.szClock, "03/01/2024 12:00:00 AM") != 0)
+        return -1;
+
+    // A year of uptime
+    StartSimClock(&sim, REFERENCE_TIME * 1000000ULL,
+                  366ULL * MSEC_PER_DAY - 2 * MSEC_PER_SEC, 0);
+    if (CheckSimTicks(&sim, &state, 3) != 0
+        || strcmp(state.szUptime, "366 d, 0 hr, 0 min, 0 sec") != 0)
+        return -1;
+
+    // Time spent suspended counts as uptime but not awake time
+    SuspendSimClock(&sim, 3600ULL * USEC_PER_SEC);
+    if (CheckSimTicks(&sim, &state, 1) != 0
+        || !state.fAwakeValid
+        || state.ticks - state.awakeTicks != 3600ULL * MSEC_PER_SEC)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * Tick a simulated clock once a second, checking that the incremental
+ * display strings match ones formatted from scratch each time.
+ * Leaves the clock where it was on the last tick.
+ */
+int
+CheckSimTicks(SIMCLOCK *sim, CLOCKSTATE *state, int cTicks)
+{
+    CCHAR szClock[CLOCK_LEN + 1], szUptime[UPTIME_LEN + 1];
+    UPTIME uptime;
+    int i;
+
+    for (i = 0; i < cTicks; ++i) {
+        if (i > 0)
+            AdvanceSimClock(sim, USEC_PER_SEC);
+        if (UpdateClockState(state) != 0
+            || state->ticks != sim->uptime / USEC_PER_MSEC)
+            return -1;
+
+        FormatClock(szClock, (time_t) (sim->wallTime / USEC_PER_SEC));
+        BreakDownUptime(sim->uptime / USEC_PER_MSEC, &uptime);
+        FormatUptime(szUptime, &uptime);
+        if (strcmp(state->szClock, szClock) != 0
+            || strcmp(state->szUptime, szUptime) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Collect the lengths of the first two gaps found.
+ */
+void
+CountGap(const HISTORYSAMPLE *before, const HISTORYSAMPLE *after, void *arg)
+{
+    long long *gaps = arg;
+
+    if (gaps[0] == 0)
+        gaps[0] = GetHistoryGap(before, after);
+    else if (gaps[1] == 0)
+        gaps[1] = GetHistoryGap(before, after);
+}
+
+/*
+ * Make up a name for a temporary file.
+ */
+void
+GetTempPath(char *path, size_t size, const char *ext)
+{
+    const char *dir = getenv("TMPDIR");
+
+    snprintf(path, size, "%s/uclockbench-%ld.%s",
+             (dir == NULL) ? "/tmp" : dir, (long) getpid(), ext);
+}
+
+/*
+ * Make up a name for a shared state page.
+ */
+void
+GetStateName(char *name, size_t size)
+{
+    snprintf(name, size, "/uclockbench-%ld", (long) getpid());
+}
+
+/*
+ * Connect to a metrics server on the loopback interface.
+ * Returns the socket, or -1 on failure.
+ */
+int
+ConnectMetrics(unsigned short port)
+{
+    struct sockaddr_in addr;
+    int sock;
+
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == -1)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/*
+ * Request a path from a metrics server and read the whole response into
+ * buf, as a string.
+ * Returns the length of the response, or -1 on failure.
+ */
+int
+Scrape(int sock, const char *path, char *buf, size_t size)
+{
+    char request[128];
+    const char *body, *length;
+    size_t len, cb = 0;
+    ssize_t cbRead;
+
+    len = snprintf(request, sizeof(request),
+                   "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n", path);
+    if (send(sock, request, len, 0) != (ssize_t) len)
+        return -1;
+
+    for (;;) {
+        cbRead = recv(sock, buf + cb, size - 1 - cb, 0);
+        if (cbRead <= 0)
+            return -1;
+        cb += cbRead;
+        buf[cb] = '\0';
+
+        body = strstr(buf, "\r\n\r\n");
+        length = strstr(buf, "Content-Length: ");
+        if (body != NULL && length != NULL
+            && cb >= (size_t) (body + 4 - buf)
+                     + strtoul(length + 16, NULL, 10))
+            return (int) cb;
+    }
+}
+
+/*
+ * Return an FNV-1a checksum of a frame's pixels.
+ */
+unsigned long
+HashFrame(const FRAMEBUFFER *fb)
+{
+    unsigned long hash = 2166136261UL;
+    long i, count;
+
+    count = (long) fb->width * fb->height;
+    for (i = 0; i < count; ++i)
+        hash = ((hash ^ fb->pixels[i]) * 16777619UL) & 0xFFFFFFFFUL;
+    return hash;
+}
+
+void
+BenchBreakDownUptime(unsigned long iterations, const void *arg)
+{
+    UPTIME uptime;
+    unsigned long i;
+
+    for (i = 0; i < iterations; ++i) {
+        BreakDownUptime(123456789ULL + i * MSEC_PER_SEC, &uptime);
+        sink += uptime.seconds;
+    }
+}
+
+void
+BenchFormatClock(unsigned long iterations, const void *arg)
+{
+    CCHAR szClock[CLOCK_LEN + 1];
+    unsigned long i;
+
+    for (i = 0; i < iterations; ++i) {
+        FormatClock(szClock, REFERENCE_TIME + i);
+        sink += szClock[18];
+    }
+}
+
+void
+BenchClockString(unsigned long iterations, const void *arg)
+{
+    CLOCKSTATE state;
+    unsigned long i;
+
+    memset(&state, 0, sizeof(state));
+    for (i = 0; i < iterations; ++i) {
+        UpdateClockString(&state, REFERENCE_TIME + i);
+        sink += state.szClock[18];
+    }
+}
+
+void
+BenchFormatUptime(unsigned long iterations, const void *arg)
+{
+    CCHAR szUptime[UPTIME_LEN + 1];
+    UPTIME uptime;
+    unsigned long i;
+
+    for (i = 0; i < iterations; ++i) {
+        BreakDownUptime(123456789ULL + i * MSEC_PER_SEC, &uptime);
+        FormatUptime(szUptime, &uptime);
+        sink += szUptime[0];
+    }
+}
+
+void
+BenchUptimeString(unsigned long iterations, const void *arg)
+{
+    CLOCKSTATE state;
+    unsigned long i;
+
+    memset(&state, 0, sizeof(state));
+    for (i = 0; i < iterations; ++i) {
+        UpdateUptimeString(&state, 123456789ULL + i * MSEC_PER_SEC);
+        sink += state.szUptime[0];
+    }
+}
+
+void
+BenchSetClockState(unsigned long iterations, const void *arg)
+{
+    CLOCKSTATE state;
+    unsigned long i;
+
+    memset(&state, 0, sizeof(state));
+    for (i = 0; i < iterations; ++i) {
+        SetClockState(&state, REFERENCE_TIME + i,
+                      123456789ULL + i * MSEC_PER_SEC);
+        sink += state.szClock[18];
+    }
+}
+
+void
+BenchRenderFrame(unsigned long iterations, const void *arg)
+{
+    const FRAMESIZE *size = arg;
+    CLOCKFACE face;
+    CLOCKSTATE state;
+    char szFilename[64];
+    FILE *fp;
+    unsigned long i;
+
+    memset(&state, 0, sizeof(state));
+    if (CreateClockFace(&face, size->width, size->height) != 0)
+        return;
+
+    for (i = 0; i < iterations; ++i) {
+        SetClockState(&state, REFERENCE_TIME + i,
+                      123456789ULL + i * MSEC_PER_SEC);
+        RenderClockFace(&face, &state, NULL);
+        sink += face.fb.pixels[0];
+    }
+
+    if (fDumpFrames) {
+        snprintf(szFilename, sizeof(szFilename), "uclock-%dx%d.ppm",
+                 size->width, size->height);
+        fp = fopen(szFilename, "wb");
+        if (fp != NULL) {
+            WriteFramebufferPPM(&face.fb, fp);
+            fclose(fp);
+        }
+    }
+
+    FreeClockFace(&face);
+}
+
+void
+BenchRenderTick(unsigned long iterations, const void *arg)
+{
+    const FRAMESIZE *size = arg;
+    CLOCKFACE face;
+    CLOCKSTATE state;
+    FBRECT rects[MAX_FACE_CHANGES];
+    unsigned long i;
+    int j, cRects;
+
+    memset(&state, 0, sizeof(state));
+    if (CreateClockFace(&face, size->width, size->height) != 0)
+        return;
+    SetClockState(&state, REFERENCE_TIME, 123456789ULL);
+    GetClockFaceChanges(&face, &state, rects);
+    RenderClockFace(&face, &state, NULL);
+
+    for (i = 1; i <= iterations; ++i) {
+        SetClockState(&state, REFERENCE_TIME + i,
+                      123456789ULL + i * MSEC_PER_SEC);
+        cRects = GetClockFaceChanges(&face, &state, rects);
+        for (j = 0; j < cRects; ++j)
+            RenderClockFace(&face, &state, &rects[j]);
+        sink += face.fb.pixels[0];
+    }
+
+    FreeClockFace(&face);
+}
+
+void
+BenchTermTick(unsigned long iterations, const void *arg)
+{
+    TERMSCREEN screen;
+    CLOCKSTATE state;
+    unsigned long i;
+
+    memset(&state, 0, sizeof(state));
+    if (CreateTermScreen(&screen, 80, 24, TERM_UTF8_BLOCK) != 0)
+        return;
+
+    for (i = 0; i < iterations; ++i) {
+        SetClockState(&state, REFERENCE_TIME + i,
+                      123456789ULL + i * MSEC_PER_SEC);
+        DrawTermClock(&screen, &state);
+        sink += UpdateTermScreen(&screen);
+    }
+
+    FreeTermScreen(&screen);
+}
+
+void
+BenchRecordValue(unsigned long iterations, const void *arg)
+{
+    static HISTOGRAM histogram;
+    unsigned long i;
+
+    InitHistogram(&histogram);
+    for (i = 0; i < iterations; ++i)
+        RecordValue(&histogram, (i * 2654435761UL) % 100000);
+    sink += atomic_load(&histogram.maxValue);
+}
+
+void
+BenchAppendTick(unsigned long iterations, const void *arg)
+{
+    TICKJOURNAL journal;
+    CLOCKSTATE state;
+    char path[256];
+    unsigned long i;
+
+    GetTempPath(path, sizeof(path), "jnl");
+    memset(&state, 0, sizeof(state));
+    if (OpenTickJournal(&journal, path, JOURNAL_CAPACITY) != 0)
+        return;
+
+    for (i = 0; i < iterations; ++i) {
+        state.wallTime = (REFERENCE_TIME + i) * 1000000ULL;
+        state.ticks = i * MSEC_PER_SEC;
+        AppendTick(&journal, &state);
+    }
+
+    CloseTickJournal(&journal);
+    unlink(path);
+}
+
+void
+BenchEncodeHistory(unsigned long iterations, const void *arg)
+{
+    static HISTORYENCODER encoder;
+    HISTORYSAMPLE sample;
+    unsigned long i;
+
+    sample.time = REFERENCE_TIME;
+    sample.uptime = 123456;
+    StartHistoryBlock(&encoder, &sample);
+
+    // Mostly normal seconds, with a hiccup every so often
+    for (i = 1; i < iterations; ++i) {
+        sample.time += 1;
+        sample.uptime += (i % 97 == 0) ? 2 : 1;
+        if (EncodeHistorySample(&encoder, &sample) != 0)
+            StartHistoryBlock(&encoder, &sample);
+    }
+    sink += encoder.block.cBits;
+}
+
+void
+BenchEventRing(unsigned long iterations, const void *arg)
+{
+    static EVENTRING ring;
+    EVENTRECORD event;
+    unsigned long i;
+
+    InitEventRing(&ring);
+    memset(&event, 0, sizeof(event));
+    event.type = EVENT_STALL;
+    for (i = 0; i < iterations; ++i) {
+        event.amount = i;
+        PostEvent(&ring, &event);
+        ReadEvent(&ring, &event);
+    }
+    sink += event.amount;
+}
+
+void
+BenchPublishMetrics(unsigned long iterations, const void *arg)
+{
+    static METRICSERVER server;
+    static HISTOGRAM histograms[3];
+    CLOCKSTATE state;
+    unsigned long i;
+    int j;
+
+    memset(&server, 0, sizeof(server));
+    for (j = 0; j < 3; ++j) {
+        InitHistogram(&histograms[j]);
+        RecordValue(&histograms[j], 100 + j);
+        AddMetricHistogram(&server, "test_seconds", "Test.", &histograms[j]);
+    }
+    if (StartMetricServer(&server, 0) != 0)
+        return;
+
+    memset(&state, 0, sizeof(state));
+    for (i = 0; i < iterations; ++i) {
+        SetClockState(&state, REFERENCE_TIME + i,
+                      123456789ULL + i * MSEC_PER_SEC);
+        PublishMetrics(&server, &state);
+    }
+
+    StopMetricServer(&server);
+}
+
+void
+BenchScrape(unsigned long iterations, const void *arg)
+{
+    static METRICSERVER server;
+    static HISTOGRAM histograms[3];
+    static char response[METRICS_RESPONSE_SIZE];
+    CLOCKSTATE state;
+    unsigned long i;
+    int j, sock;
+
+    memset(&server, 0, sizeof(server));
+    for (j = 0; j < 3; ++j) {
+        InitHistogram(&histograms[j]);
+        RecordValue(&histograms[j], 100 + j);
+        AddMetricHistogram(&server, "test_seconds", "Test.", &histograms[j]);
+    }
+    if (StartMetricServer(&server, 0) != 0)
+        return;
+
+    memset(&state, 0, sizeof(state));
+    SetClockState(&state, REFERENCE_TIME, 123456789ULL);
+    PublishMetrics(&server, &state);
+
+    sock = ConnectMetrics(server.port);
+    for (i = 0; sock != -1 && i < iterations; ++i)
+        sink += Scrape(sock, "/metrics", response, sizeof(response));
+
+    if (sock != -1)
+        close(sock);
+    StopMetricServer(&server);
+}
+
+void
+BenchPublishState(unsigned long iterations, const void *arg)
+{
+    static STATEPAGE statePage;
+    CLOCKSTATE state;
+    char name[64];
+    unsigned long i;
+
+    GetStateName(name, sizeof(name));
+    if (OpenStatePage(&statePage, name) != 0)
+        return;
+
+    memset(&state, 0, sizeof(state));
+    for (i = 0; i < iterations; ++i) {
+        state.ticks = i;
+        state.wallTime = i * 1000ULL;
+        PublishState(&statePage, &state);
+    }
+
+    CloseStatePage(&statePage);
+}
+
+void
+BenchReadState(unsigned long iterations, const void *arg)
+{
+    static STATEPAGE statePage;
+    CLOCKSTATEREADER reader;
+    CLOCKSNAPSHOT snapshot;
+    CLOCKSTATE state;
+    char name[64];
+    unsigned long i;
+
+    GetStateName(name, sizeof(name));
+    if (OpenStatePage(&statePage, name) != 0)
+        return;
+    memset(&state, 0, sizeof(state));
+    SetClockState(&state, REFERENCE_TIME, 123456789ULL);
+    PublishState(&statePage, &state);
+
+    if (OpenClockStateReader(&reader, name) == 0) {
+        for (i = 0; i < iterations; ++i) {
+            if (ReadClockSnapshot(&reader, &snapshot) == 0)
+                sink += snapshot.ticks;
+        }
+        CloseClockStateReader(&reader);
+    }
+
+    CloseStatePage(&statePage);
+}
+
+void
+BenchTimeSource(unsigned long iterations, const void *arg)
+{
+    const TIMESOURCE *source = arg;
+    unsigned long i;
+
+    for (i = 0; i < iterations; ++i)
+        sink += source->read();
+}
+
+void
+BenchSimulatedTick(unsigned long iterations, const void *arg)
+{
+    const FRAMESIZE *size = arg;
+    static SIMCLOCK sim;
+    CLOCKFACE face;
+    CLOCKSTATE state;
+    FBRECT rects[MAX_FACE_CHANGES];
+    unsigned long i;
+    int j, cRects;
+
+    memset(&state, 0, sizeof(state));
+    state.source = &sim.source;
+    StartSimClock(&sim, REFERENCE_TIME * 1000000ULL, 123456789ULL, 0);
+
+    // Without a frame size, just update the clock state
+    if (size == NULL) {
+        for (i = 0; i < iterations; ++i) {
+            AdvanceSimClock(&sim, USEC_PER_SEC);
+            UpdateClockState(&state);
+        }
+        sink += state.szUptime[0];
+        return;
+    }
+
+    if (CreateClockFace(&face, size->width, size->height) != 0)
+        return;
+    for (i = 0; i < iterations; ++i) {
+        AdvanceSimClock(&sim, USEC_PER_SEC);
+        UpdateClockState(&state);
+        cRects = GetClockFaceChanges(&face, &state, rects);
+        for (j = 0; j < cRects; ++j)
+            RenderClockFace(&face, &state, &rects[j]);
+    }
+    sink += face.fb.pixels[0];
+    FreeClockFace(&face);
+}
+
+/*
+ * Run the simulated tick benchmark for SIMULATION_TIME seconds, and report
+ * the sustained rate. If size is NULL, nothing is rendered.
+ */
+void
+RunSimulation(const FRAMESIZE *size)
+{
+    unsigned long long cTicks = 0;
+    double start, elapsed;
+
+    start = Seconds();
+    do {
+        BenchSimulatedTick(100000, size);
+        cTicks += 100000;
+        elapsed = Seconds() - start;
+    } while (elapsed < SIMULATION_TIME);
+
+    printf("%-24s %14.0f ticks/s (%.0f days in %.1f s)\n",
+           (size == NULL) ? "SimulatedTick" : "SimulatedTick/640x480",
+           cTicks / elapsed, (double) cTicks / 86400, elapsed);
+}
+
+/*
+ * Time each timestamp source, and how far it drifts from the OS clock.
+ */
+void
+CompareTimeSources(void)
+{
+    unsigned long long start[cTimeSources], end[cTimeSources];
+    double startSeconds, elapsed;
+    unsigned long i;
+
+    if (GetTimestampSource() == TIMESTAMP_TSC)
+        printf("Timestamps come from the TSC at %.1f MHz.\n", GetTSCRate());
+    else
+        printf("Timestamps come from the OS clock.\n");
+
+    for (i = 0; i < cTimeSources; ++i)
+        start[i] = timeSources[i].read();
+    SleepMicroseconds(DRIFT_TIME * USEC_PER_SEC);
+    for (i = 0; i < cTimeSources; ++i)
+        end[i] = timeSources[i].read();
+
+    // Drift is measured from the first source, the OS monotonic clock
+    for (i = 0; i < cTimeSources; ++i) {
+        startSeconds = Seconds();
+        BenchTimeSource(ITERATIONS, &timeSources[i]);
+        elapsed = Seconds() - startSeconds;
+        printf("%-24s %14.1f ns/op %+10.1f ppm\n", timeSources[i].name,
+               elapsed * 1e9 / ITERATIONS,
+               ((double) (end[i] - start[i]) / (end[0] - start[0]) - 1)
+               * 1e6);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    int checkOnly = 0, simulate = 0, compare = 0, failed = 0;
+    unsigned long i;
+    double start, elapsed;
+
+    --argc;
+    ++argv;
+    while (argc > 0 && argv[0][0] == '-') {
+        if (strcmp(argv[0], "-c") == 0)
+            checkOnly = 1;
+        else if (strcmp(argv[0], "-d") == 0)
+            fDumpFrames = 1;
+        else if (strcmp(argv[0], "-t") == 0)
+            simulate = 1;
+        else if (strcmp(argv[0], "-s") == 0)
+            compare = 1;
+        --argc;
+        ++argv;
+    }
+
+    // Make the results independent of the local time zone
+    setenv("TZ", "UTC0", 1);
+    tzset();
+
+    InitTickSource();
+    InitTimestamps();
+
+    for (i = 0; i < cChecks; ++i) {
+        if (checks[i].proc() != 0) {
+            printf("FAIL %s\n", checks[i].name);
+            failed = 1;
+        }
+    }
+    if (failed)
+        return 1;
+    printf("All %u self-checks passed.\n", (unsigned) cChecks);
+
+    if (checkOnly)
+        return 0;
+    if (simulate) {
+        RunSimulation(NULL);
+        RunSimulation(&frameSizes[0]);
+        return 0;
+    }
+    if (compare) {
+        CompareTimeSources();
+        return 0;
+    }
+
+    for (i = 0; i < cBenchmarks; ++i) {
+        if (!Selected(benchmarks[i].name, argc, argv))
+            continue;
+
+        start = Seconds();
+        benchmarks[i].proc(benchmarks[i].iterations, benchmarks[i].arg);
+        elapsed = Seconds() - start;
+
+        printf("%-24s %14.1f ns/op\n", benchmarks[i].name,
+               elapsed * 1e9 / benchmarks[i].iterations);
+    }
+
+    return 0;
+}
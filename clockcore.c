@@ -0,0 +1,638 @@
+/*
+ * Portable clock core for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef _WIN32
+#  define WINVER 0x400
+#  include <windows.h>
+#else
+#  define _GNU_SOURCE   // for CLOCK_BOOTTIME
+#  include <errno.h>
+#endif
+
+#include <string.h> // for memset()
+#include <time.h>   // for time() and localtime()
+
+#include "clockcore.h"
+
+#ifdef UNICODE
+#  define SNPRINTF swprintf
+#  define STRFTIME wcsftime
+#else
+#  include <stdio.h>
+#  define SNPRINTF snprintf
+#  define STRFTIME strftime
+#endif
+
+// Two-digit decimal strings for 00 through 99
+static const char digitPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static CCHAR *AppendNumber(CCHAR *p, unsigned int value);
+static CCHAR *AppendText(CCHAR *p, const char *text);
+
+#ifdef _WIN32
+/*
+ * GetTickCount64() (available on Windows Vista and newer) is preferred
+ * because GetTickCount() overflows around 49.7 days, but we will fall back
+ * for compatiblity with older Windows versions. Plenty of legacy systems
+ * still run these obsolete OSes, and someone may find this tool useful for
+ * troubleshooting such a system.
+ */
+typedef unsigned long long (__cdecl *PROC_GTC64)(void);
+static PROC_GTC64 pGetTickCount64;
+static TICKWIDENER tickWidener;
+#define GetTickCount64OrOtherwise() \
+    ((pGetTickCount64 == NULL) \
+     ? WidenTickCount(&tickWidener, GetTickCount()) : pGetTickCount64())
+
+/*
+ * GetTickCount64() counts time spent asleep or hibernating. To tell that
+ * apart from time spent awake, we also need QueryUnbiasedInterruptTime()
+ * (available on Windows 7 and newer), which doesn't.
+ */
+typedef BOOL (WINAPI *PROC_QUIT)(PULONGLONG);
+static PROC_QUIT pQueryUnbiasedInterruptTime;
+#endif
+
+/*
+ * Initialize the tick source.
+ * Call this once before the first call to GetUptimeTicks().
+ */
+void
+InitTickSource(void)
+{
+#ifdef _WIN32
+    HMODULE hmodKernel32;
+
+    // kernel32.dll is always loaded, so we don't need to LoadLibrary() it
+    hmodKernel32 = GetModuleHandle(TEXT("kernel32.dll"));
+    if (hmodKernel32 == NULL) {
+        pGetTickCount64 = NULL;
+        pQueryUnbiasedInterruptTime = NULL;
+    } else {
+        pGetTickCount64 = (PROC_GTC64)
+            GetProcAddress(hmodKernel32, "GetTickCount64");
+        pQueryUnbiasedInterruptTime = (PROC_QUIT)
+            GetProcAddress(hmodKernel32, "QueryUnbiasedInterruptTime");
+    }
+#endif
+}
+
+/*
+ * Return the number of milliseconds since the system was started.
+ * On Windows versions without GetTickCount64(), this only counts from
+ * zero if the clock was started in the first 49.7 days; after that it
+ * keeps counting from where GetTickCount() was when it started.
+ */
+unsigned long long
+GetUptimeTicks(void)
+{
+#ifdef _WIN32
+    return GetTickCount64OrOtherwise();
+#else
+    struct timespec ts;
+
+    // CLOCK_BOOTTIME counts time spent suspended, like GetTickCount()
+    if (clock_gettime(CLOCK_BOOTTIME, &ts) != 0)
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * MSEC_PER_SEC
+           + ts.tv_nsec / 1000000;
+#endif
+}
+
+/*
+ * Get the number of milliseconds the system has been awake since it was
+ * started; that is, the uptime less any time spent suspended.
+ * Returns 0 on success, -1 if this isn't available.
+ */
+int
+GetAwakeTicks(unsigned long long *ticks)
+{
+#ifdef _WIN32
+    ULONGLONG unbiased;
+
+    // This is in 100-nanosecond units
+    if (pQueryUnbiasedInterruptTime == NULL
+        || !pQueryUnbiasedInterruptTime(&unbiased))
+        return -1;
+    *ticks = unbiased / 10000;
+    return 0;
+#else
+    struct timespec ts;
+
+    // Unlike CLOCK_BOOTTIME, this stops while the system is suspended
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        return -1;
+    *ticks = (unsigned long long) ts.tv_sec * MSEC_PER_SEC
+             + ts.tv_nsec / 1000000;
+    return 0;
+#endif
+}
+
+/*
+ * Return the wall clock time in microseconds since the Unix epoch.
+ */
+unsigned long long
+GetWallTime(void)
+{
+#ifdef _WIN32
+    FILETIME ft;
+    unsigned long long t;
+
+    GetSystemTimeAsFileTime(&ft);
+    t = ((unsigned long long) ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    return (t - FILETIME_UNIX_EPOCH) / 10;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (unsigned long long) ts.tv_sec * USEC_PER_SEC
+           + ts.tv_nsec / 1000;
+#endif
+}
+
+/*
+ * Extend a 32-bit millisecond tick count past its wrap at about 49.7 days.
+ * This must be called at least once every 49.7 days to notice each wrap.
+ */
+unsigned long long
+WidenTickCount(TICKWIDENER *widener, unsigned int ticks)
+{
+    if (ticks < widener->last)
+        widener->high += 0x100000000ULL;
+    widener->last = ticks;
+    return widener->high | ticks;
+}
+
+/*
+ * Return a high-resolution monotonic timestamp in microseconds.
+ * This is only meaningful relative to other calls.
+ */
+unsigned long long
+GetMonotonicTime(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+
+    // Split the conversion so the multiplication can't overflow
+    return (counter.QuadPart / frequency.QuadPart) * USEC_PER_SEC
+           + (counter.QuadPart % frequency.QuadPart) * USEC_PER_SEC
+             / frequency.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * USEC_PER_SEC
+           + ts.tv_nsec / 1000;
+#endif
+}
+
+/*
+ * Schedule the next tick for the first second boundary after now, which
+ * is the wall clock time; mono is the monotonic time at the same moment.
+ *
+ * We always compute an absolute due time from the current wall clock
+ * rather than waiting a fixed interval, so scheduling delays never
+ * accumulate into drift. We also note when that is on the monotonic
+ * clock, to measure lateness against.
+ */
+void
+ScheduleNextTick(TICKSCHEDULE *schedule, unsigned long long now,
+                 unsigned long long mono)
+{
+    schedule->due = (now / USEC_PER_SEC + 1) * USEC_PER_SEC;
+    schedule->dueMono = mono + (schedule->due - now);
+}
+
+/*
+ * Record that a tick arrived at the specified wall clock and monotonic
+ * times, and schedule the next one. Returns how late the tick was, in
+ * microseconds, or -1 if the tick isn't due yet and the caller should
+ * wait again.
+ *
+ * Lateness is measured on the monotonic clock, so stepping the wall clock
+ * forward or suspending the system doesn't count as the tick being late.
+ */
+long long
+CompleteTick(TICKSCHEDULE *schedule, unsigned long long now,
+             unsigned long long mono)
+{
+    if (now < schedule->due) {
+        // If the wall clock was set back, the due time is now further
+        // away than a second; resynchronize rather than wait it out.
+        // Otherwise we woke up early, so wait again for the same second.
+        if (schedule->due - now > USEC_PER_SEC)
+            ScheduleNextTick(schedule, now, mono);
+        return -1;
+    }
+
+    schedule->lateness = (mono > schedule->dueMono)
+                         ? (long long) (mono - schedule->dueMono)
+                         : 0;
+    ScheduleNextTick(schedule, now, mono);
+    if (schedule->lateness > schedule->maxLateness)
+        schedule->maxLateness = schedule->lateness;
+    return schedule->lateness;
+}
+
+#ifndef _WIN32
+/*
+ * Sleep until the next scheduled tick.
+ * Returns how late the tick was, in microseconds.
+ *
+ * We sleep for an interval on the monotonic clock rather than until an
+ * absolute wall clock time, so setting the clock back can't stall us
+ * for longer than a second.
+ */
+long long
+WaitForNextTick(TICKSCHEDULE *schedule)
+{
+    struct timespec ts;
+    unsigned long long now, wait;
+    long long lateness;
+
+    for (;;) {
+        now = GetWallTime();
+        if ((lateness = CompleteTick(schedule, now, GetMonotonicTime())) >= 0)
+            return lateness;
+
+        wait = schedule->due - now;
+        ts.tv_sec = wait / USEC_PER_SEC;
+        ts.tv_nsec = (wait % USEC_PER_SEC) * 1000;
+        clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+    }
+}
+#endif
+
+/*
+ * Lay out the clock display in an area of the specified size.
+ */
+void
+LayOutClock(CLOCKLAYOUT *layout, int width, int height)
+{
+    long displayHeight;
+
+    layout->width = width;
+    layout->height = height;
+
+    // Scale the font size with the window height
+    layout->cHeightClock = height / 8;
+    layout->cHeightUptime = height / 12;
+
+    // Center the display in the window, leaving a blank line after the
+    // date and time
+    displayHeight = layout->cHeightClock + 3 * layout->cHeightUptime;
+    layout->x = width / 2;
+    layout->yClock = (height - displayHeight) / 2;
+    layout->yLabel = layout->yClock
+                     + layout->cHeightClock + layout->cHeightUptime;
+    layout->yUptime = layout->yLabel + layout->cHeightUptime;
+
+    // Status lines go below the centered display, after a blank line,
+    // so showing them doesn't move anything else
+    layout->cHeightStatus = height / 24;
+    layout->yStatus = layout->yUptime + layout->cHeightUptime
+                      + layout->cHeightStatus;
+}
+
+/*
+ * Break a tick count down into days, hours, minutes, and seconds.
+ */
+void
+BreakDownUptime(unsigned long long ticks, UPTIME *uptime)
+{
+    uptime->days = ticks / MSEC_PER_DAY;
+    ticks %= MSEC_PER_DAY;
+    uptime->hours = ticks / MSEC_PER_HR;
+    ticks %= MSEC_PER_HR;
+    uptime->minutes = ticks / MSEC_PER_MIN;
+    ticks %= MSEC_PER_MIN;
+    uptime->seconds = ticks / MSEC_PER_SEC;
+    uptime->msec = ticks % MSEC_PER_SEC;
+}
+
+/*
+ * Advance the uptime by the specified number of milliseconds.
+ *
+ * This avoids the 64-bit division in BreakDownUptime(), which is a library
+ * call on 32-bit systems, but it counts through each carry one at a time,
+ * so it should only be used for small deltas (see MAX_UPTIME_ADVANCE).
+ */
+void
+AdvanceUptime(UPTIME *uptime, unsigned int delta)
+{
+    uptime->msec += delta;
+    while (uptime->msec >= MSEC_PER_SEC) {
+        uptime->msec -= MSEC_PER_SEC;
+        if (++uptime->seconds < 60)
+            continue;
+        uptime->seconds = 0;
+        if (++uptime->minutes < 60)
+            continue;
+        uptime->minutes = 0;
+        if (++uptime->hours < 24)
+            continue;
+        uptime->hours = 0;
+        ++uptime->days;
+    }
+}
+
+/*
+ * Format the date and time.
+ * szClock must have room for CLOCK_LEN + 1 characters.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+FormatClock(CCHAR *szClock, time_t now)
+{
+    struct tm *timeinfo;
+
+    // Don't free timeinfo -- it's a pointer to static memory
+    timeinfo = localtime(&now);
+    if (timeinfo == NULL)
+        return -1;
+
+    memset(szClock, 0, (CLOCK_LEN + 1) * sizeof(CCHAR));
+    if (STRFTIME(szClock, CLOCK_LEN + 1, CLOCK_FMT, timeinfo) == 0)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * Format the system uptime.
+ * szUptime must have room for UPTIME_LEN + 1 characters.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+FormatUptime(CCHAR *szUptime, const UPTIME *uptime)
+{
+    memset(szUptime, 0, (UPTIME_LEN + 1) * sizeof(CCHAR));
+    if (SNPRINTF(szUptime, UPTIME_LEN + 1, UPTIME_FMT,
+                 uptime->days,
+                 (unsigned long long) uptime->hours,
+                 (unsigned long long) uptime->minutes,
+                 (unsigned long long) uptime->seconds) <= 0)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * Format the time the system has been awake, like:
+ *   Awake 12 d, 3 hr, 4 min, 5 sec
+ * sz must have room for STATUS_LEN + 1 characters.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+FormatAwakeTime(CCHAR *sz, unsigned long long awakeTicks)
+{
+    UPTIME awake;
+
+    BreakDownUptime(awakeTicks, &awake);
+    return FormatUptime(AppendText(sz, "Awake "), &awake);
+}
+
+/*
+ * Copy only the characters that differ from src into dest, and record
+ * which ones changed. dest must have room for len characters; anything
+ * after the end of src is treated as nulls.
+ */
+void
+PatchString(CCHAR *dest, const CCHAR *src, int len, CHANGE *change)
+{
+    CCHAR c;
+    int i, fEnded;
+
+    change->first = change->end = 0;
+    for (i = 0, fEnded = 0; i < len; ++i) {
+        c = fEnded ? '\0' : src[i];
+        if (c == '\0')
+            fEnded = 1;
+        if (dest[i] != c) {
+            if (change->first == change->end)
+                change->first = i;
+            change->end = i + 1;
+            dest[i] = c;
+        }
+    }
+}
+
+/*
+ * Update the date and time string.
+ *
+ * Calling localtime() and strftime() every second is wasteful when only
+ * the seconds usually change, so we only do that when the minute changes
+ * (which also covers hour, midnight, and DST boundaries) or the clock
+ * jumps. Otherwise we advance the seconds and patch their digits in place.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+UpdateClockString(HCLOCKSTATE state, time_t now)
+{
+    CCHAR szClock[CLOCK_LEN + 1];
+    CCHAR *pSec, tens, ones;
+    int sec;
+
+    pSec = state->szClock + CLOCK_SEC_POS;
+    if (state->fClockValid && now >= state->now) {
+        sec = (pSec[0] - '0') * 10 + (pSec[1] - '0');
+        if (now - state->now < 60 - sec) {
+            sec += now - state->now;
+            tens = '0' + sec / 10;
+            ones = '0' + sec % 10;
+
+            state->clockChange.first = state->clockChange.end =
+                CLOCK_SEC_POS + 2;
+            if (pSec[1] != ones) {
+                pSec[1] = ones;
+                state->clockChange.first = CLOCK_SEC_POS + 1;
+            }
+            if (pSec[0] != tens) {
+                pSec[0] = tens;
+                state->clockChange.first = CLOCK_SEC_POS;
+            }
+
+            state->now = now;
+            return 0;
+        }
+    }
+
+    // Re-derive the whole string the slow way
+    state->fClockValid = 0;
+    if (FormatClock(szClock, now) != 0)
+        return -1;
+    PatchString(state->szClock, szClock, CLOCK_LEN + 1, &state->clockChange);
+    state->fClockValid = 1;
+    state->now = now;
+
+    return 0;
+}
+
+/*
+ * Append a number less than 100 to a string, without leading zeros.
+ * Returns a pointer to the end of the string.
+ */
+CCHAR *
+AppendNumber(CCHAR *p, unsigned int value)
+{
+    if (value >= 10)
+        *p++ = digitPairs[2 * value];
+    *p++ = digitPairs[2 * value + 1];
+    return p;
+}
+
+/*
+ * Append ASCII text to a string.
+ * Returns a pointer to the end of the string.
+ */
+CCHAR *
+AppendText(CCHAR *p, const char *text)
+{
+    while (*text != '\0')
+        *p++ = *text++;
+    return p;
+}
+
+/*
+ * Update the system uptime and its display string.
+ *
+ * Like the date and time, the uptime mostly changes a second at a time, so
+ * we count forward from the previous tick rather than dividing the tick
+ * count down from scratch. We re-derive it from the tick count when the
+ * uptime jumps (e.g., after a freeze or resume) and once an hour to be
+ * safe. The string is built by hand, reusing the day count unless it
+ * changed, and then patched in place.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+UpdateUptimeString(HCLOCKSTATE state, unsigned long long ticks)
+{
+    CCHAR szUptime[2 * UPTIME_LEN];
+    CCHAR *p;
+    const CCHAR *pDays;
+    unsigned long long oldDays;
+    unsigned int oldHours;
+
+    oldDays = state->uptime.days;
+    oldHours = state->uptime.hours;
+    if (state->fUptimeValid
+        && ticks >= state->ticks
+        && ticks - state->ticks <= MAX_UPTIME_ADVANCE) {
+        AdvanceUptime(&state->uptime, (unsigned int) (ticks - state->ticks));
+        if (state->uptime.hours != oldHours)
+            BreakDownUptime(ticks, &state->uptime);
+    } else {
+        BreakDownUptime(ticks, &state->uptime);
+    }
+
+    // The day count can be any length, so format it the slow way
+    // only when it changes
+    if (!state->fUptimeValid || state->uptime.days != oldDays) {
+        state->fUptimeValid = 0;
+        if (FormatUptime(szUptime, &state->uptime) != 0)
+            return -1;
+    } else {
+        p = szUptime;
+        for (pDays = state->szUptime; *pDays != ' '; ++pDays)
+            *p++ = *pDays;
+        p = AppendText(p, " d, ");
+        p = AppendNumber(p, state->uptime.hours);
+        p = AppendText(p, " hr, ");
+        p = AppendNumber(p, state->uptime.minutes);
+        p = AppendText(p, " min, ");
+        p = AppendNumber(p, state->uptime.seconds);
+        p = AppendText(p, " sec");
+        *p = '\0';
+        szUptime[UPTIME_LEN] = '\0';
+    }
+
+    PatchString(state->szUptime, szUptime, UPTIME_LEN + 1,
+                &state->uptimeChange);
+    state->ticks = ticks;
+    state->fUptimeValid = 1;
+
+    return 0;
+}
+
+/*
+ * Set a line of status text.
+ * sz must be no more than STATUS_LEN characters.
+ */
+void
+SetStatusLine(HCLOCKSTATE state, int line, const CCHAR *sz)
+{
+    PatchString(state->szStatus[line], sz, STATUS_LEN + 1,
+                &state->statusChange[line]);
+}
+
+/*
+ * Read the current time and uptime into the clock state, from its tick
+ * source if it has one, or else from the system.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+UpdateClockState(HCLOCKSTATE state)
+{
+    const TICKSOURCE *source = state->source;
+    unsigned long long ticks;
+
+    if (source == NULL) {
+        state->wallTime = GetWallTime();
+        state->fAwakeValid = (GetAwakeTicks(&state->awakeTicks) == 0);
+        ticks = GetUptimeTicks();
+    } else {
+        state->wallTime = source->getWallTime(source->arg);
+        state->fAwakeValid =
+            (source->getAwakeTicks(source->arg, &state->awakeTicks) == 0);
+        ticks = source->getUptimeTicks(source->arg);
+    }
+
+    return SetClockState(state, (time_t) (state->wallTime / USEC_PER_SEC),
+                         ticks);
+}
+
+/*
+ * Set the clock state to the specified time and uptime.
+ * This is separate from UpdateClockState() so it can be tested with
+ * known values.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+SetClockState(HCLOCKSTATE state, time_t now, unsigned long long ticks)
+{
+    if (UpdateClockString(state, now) != 0)
+        return -1;
+    if (UpdateUptimeString(state, ticks) != 0)
+        return -1;
+
+    return 0;
+}
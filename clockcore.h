@@ -0,0 +1,182 @@
+/*
+ * Portable clock core for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Everything the clock does once per tick that doesn't involve drawing:
+ * reading the tick source, breaking the uptime down into days, hours,
+ * minutes, and seconds, and formatting the display strings. This file
+ * deliberately avoids <windows.h> so it can be built and profiled on
+ * other platforms.
+ */
+
+#ifndef CLOCKCORE_H
+#define CLOCKCORE_H
+
+#include <time.h>
+
+/*
+ * Display strings use the same character type as the Windows shell so
+ * they can be passed straight to TextOut(). Everywhere else it's char.
+ */
+#if defined(_WIN32) && defined(UNICODE)
+#  include <wchar.h>
+typedef wchar_t CCHAR;
+#  define CTEXT(s) L##s
+#else
+typedef char CCHAR;
+#  define CTEXT(s) s
+#endif
+
+// Clock format: 03/30/2023 12:34:56 AM (22 chars)
+#define CLOCK_FMT CTEXT("%m/%d/%Y %I:%M:%S %p")
+#define CLOCK_LEN 22
+#define CLOCK_SEC_POS 17    // where the seconds are in the above
+
+// Uptime format: 365 d, 23 hr, 59 min, 59 sec (28 chars)
+// We're unlikely to see more than a three-digit day count. If Windows has
+// really been running that long without rebooting, we've got other problems.
+#define UPTIME_FMT CTEXT("%lld d, %lld hr, %lld min, %lld sec")
+#define UPTIME_LEN 28
+
+// Label for the uptime display
+#define UPTIME_LABEL     CTEXT("System Uptime")
+#define UPTIME_LABEL_LEN 13
+
+// Extra lines of status text shown below the uptime
+#define MAX_STATUS_LINES 6
+#define STATUS_LEN       63
+#define STATUS_AWAKE     0
+#define STATUS_HICCUPS   1
+#define STATUS_UI        2
+#define STATUS_DRIFT     3
+#define STATUS_CPUS      4
+#define STATUS_CPU_MAP   5
+
+// Largest tick delta we'll count forward rather than re-derive the uptime
+#define MAX_UPTIME_ADVANCE (10 * (MSEC_PER_SEC))
+
+// Unit conversions
+#define MSEC_PER_SEC 1000
+#define MSEC_PER_MIN ((MSEC_PER_SEC) * 60)
+#define MSEC_PER_HR  ((MSEC_PER_MIN) * 60)
+#define MSEC_PER_DAY ((MSEC_PER_HR)  * 24)
+#define USEC_PER_MSEC 1000
+#define USEC_PER_SEC  1000000
+
+// The Unix epoch as a Windows FILETIME, in 100-nanosecond units
+#define FILETIME_UNIX_EPOCH 116444736000000000ULL
+
+// System uptime broken down into display units
+typedef struct tagUPTIME {
+    unsigned long long days;
+    unsigned int hours;
+    unsigned int minutes;
+    unsigned int seconds;
+    unsigned int msec;
+} UPTIME;
+
+// Range of characters changed by an update
+typedef struct tagCHANGE {
+    int first;                  // first changed character
+    int end;                    // one past the last; same as first if none
+} CHANGE;
+
+// Where the clock gets the time, if not from the system
+typedef struct tagTICKSOURCE {
+    unsigned long long (*getWallTime)(void *arg);
+    unsigned long long (*getUptimeTicks)(void *arg);
+    int (*getAwakeTicks)(void *arg, unsigned long long *ticks);
+    void *arg;
+} TICKSOURCE;
+
+// Extends a 32-bit tick count like GetTickCount()'s past its wrap
+typedef struct tagTICKWIDENER {
+    unsigned long long high;    // the part above 32 bits
+    unsigned int last;          // the last tick count seen
+} TICKWIDENER;
+
+// Everything computed on a single clock tick
+typedef struct tagCLOCKSTATE {
+    const TICKSOURCE *source;   // or NULL for the system's own
+    time_t now;                 // wall clock time
+    unsigned long long wallTime; // same, in microseconds
+    unsigned long long ticks;   // milliseconds since boot
+    unsigned long long awakeTicks;  // same, not counting time suspended
+    int fAwakeValid;            // nonzero if awakeTicks is available
+    long long lateness;         // how late this tick was, in microseconds
+    UPTIME uptime;
+    CCHAR szClock[CLOCK_LEN + 1];
+    CCHAR szUptime[UPTIME_LEN + 1];
+    CCHAR szStatus[MAX_STATUS_LINES][STATUS_LEN + 1];
+    CHANGE clockChange;
+    CHANGE uptimeChange;
+    CHANGE statusChange[MAX_STATUS_LINES];
+    int fClockValid;            // nonzero if szClock matches now
+    int fUptimeValid;           // nonzero if uptime and szUptime match ticks
+} CLOCKSTATE, *HCLOCKSTATE;
+
+// Where everything goes in the clock display
+typedef struct tagCLOCKLAYOUT {
+    int width, height;          // size of the display area
+    int cHeightClock;           // height of the date and time text
+    int cHeightUptime;          // height of the uptime text
+    int cHeightStatus;          // height of each status line
+    long x;                     // horizontal center of the text
+    long yClock, yLabel, yUptime;
+    long yStatus;               // top of the first status line
+} CLOCKLAYOUT;
+
+// Schedule for ticking on each wall clock second boundary
+typedef struct tagTICKSCHEDULE {
+    unsigned long long due;     // wall time the next tick is due, in usec
+    unsigned long long dueMono; // same, on the monotonic clock
+    long long lateness;         // how late the last tick was
+    long long maxLateness;      // worst lateness seen so far
+} TICKSCHEDULE;
+
+void InitTickSource(void);
+unsigned long long GetUptimeTicks(void);
+int GetAwakeTicks(unsigned long long *ticks);
+unsigned long long GetWallTime(void);
+unsigned long long GetMonotonicTime(void);
+unsigned long long WidenTickCount(TICKWIDENER *widener, unsigned int ticks);
+
+void ScheduleNextTick(TICKSCHEDULE *schedule, unsigned long long now,
+                      unsigned long long mono);
+long long CompleteTick(TICKSCHEDULE *schedule, unsigned long long now,
+                       unsigned long long mono);
+#ifndef _WIN32
+long long WaitForNextTick(TICKSCHEDULE *schedule);
+#endif
+
+void LayOutClock(CLOCKLAYOUT *layout, int width, int height);
+
+void BreakDownUptime(unsigned long long ticks, UPTIME *uptime);
+void AdvanceUptime(UPTIME *uptime, unsigned int delta);
+int FormatClock(CCHAR *szClock, time_t now);
+int FormatUptime(CCHAR *szUptime, const UPTIME *uptime);
+int FormatAwakeTime(CCHAR *sz, unsigned long long awakeTicks);
+void PatchString(CCHAR *dest, const CCHAR *src, int len, CHANGE *change);
+
+int UpdateClockString(HCLOCKSTATE state, time_t now);
+int UpdateUptimeString(HCLOCKSTATE state, unsigned long long ticks);
+void SetStatusLine(HCLOCKSTATE state, int line, const CCHAR *sz);
+
+int UpdateClockState(HCLOCKSTATE state);
+int SetClockState(HCLOCKSTATE state, time_t now, unsigned long long ticks);
+
+#endif /* CLOCKCORE_H */
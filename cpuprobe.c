@@ -0,0 +1,164 @@
+/*
+ * Per-CPU latency probes for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h> // for uintptr_t
+#include <stdio.h>
+#include <stdlib.h> // for malloc() and free()
+#include <string.h> // for memset()
+
+#include "cpuprobe.h"
+
+static unsigned long long GetMaxLatency(const CPUPROBES *probes, int cpu);
+static CCHAR GetLatencyLevel(unsigned long long latency);
+
+/*
+ * Start a hiccup meter on each CPU, sampling every interval microseconds.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+StartCPUProbes(CPUPROBES *probes, unsigned long interval)
+{
+    int i, cCPUs;
+
+    memset(probes, 0, sizeof(CPUPROBES));
+    cCPUs = GetCPUCount();
+
+    // malloc() doesn't promise to align to a cache line, so we do it
+    probes->block = malloc(cCPUs * sizeof(HICCUPMETER) + CACHE_LINE_SIZE - 1);
+    if (probes->block == NULL)
+        return -1;
+    probes->meters = (HICCUPMETER *)
+        (((uintptr_t) probes->block + CACHE_LINE_SIZE - 1)
+         & ~(uintptr_t) (CACHE_LINE_SIZE - 1));
+    memset(probes->meters, 0, cCPUs * sizeof(HICCUPMETER));
+    probes->cCPUs = cCPUs;
+
+    for (i = 0; i < probes->cCPUs; ++i) {
+        if (StartHiccupMeter(&probes->meters[i], interval, i) != 0) {
+            StopCPUProbes(probes);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Stop the probes and free their memory.
+ */
+void
+StopCPUProbes(CPUPROBES *probes)
+{
+    int i;
+
+    // Tell them all to stop first so we don't wait for each in turn
+    for (i = 0; i < probes->cCPUs; ++i)
+        atomic_store(&probes->meters[i].fStop, 1);
+    for (i = 0; i < probes->cCPUs; ++i)
+        StopHiccupMeter(&probes->meters[i]);
+
+    free(probes->block);
+    memset(probes, 0, sizeof(CPUPROBES));
+}
+
+/*
+ * Format a line summarizing the worst latency on any CPU, like:
+ *   CPU latency: max 12.3 ms on CPU 17 of 128
+ * sz must have room for STATUS_LEN characters.
+ * Returns the length of the formatted string.
+ */
+int
+FormatCPUSummary(CCHAR *sz, const CPUPROBES *probes)
+{
+    char buf[STATUS_LEN + 1];
+    unsigned long long latency, worst;
+    int i, iWorst;
+
+    for (i = 0, iWorst = 0, worst = 0; i < probes->cCPUs; ++i) {
+        latency = GetMaxLatency(probes, i);
+        if (latency > worst) {
+            worst = latency;
+            iWorst = i;
+        }
+    }
+
+    // Round to the nearest tenth of a millisecond
+    worst = (worst + 50) / 100;
+    snprintf(buf, sizeof(buf), "CPU latency: max %llu.%llu ms on CPU %d of %d",
+             worst / 10, worst % 10, iWorst, probes->cCPUs);
+
+    // It's all ASCII, so this works for wide characters too
+    for (i = 0; buf[i] != '\0'; ++i)
+        sz[i] = buf[i];
+    sz[i] = 0;
+    return i;
+}
+
+/*
+ * Format a map of the worst latency on each CPU, one character per CPU.
+ * If there are more than STATUS_LEN CPUs, each character covers several
+ * consecutive CPUs and shows the worst of them.
+ * sz must have room for STATUS_LEN characters.
+ * Returns the length of the formatted string.
+ */
+int
+FormatCPUMap(CCHAR *sz, const CPUPROBES *probes)
+{
+    unsigned long long latency, worst;
+    int i, j, cPerChar, len;
+
+    cPerChar = (probes->cCPUs + STATUS_LEN - 1) / STATUS_LEN;
+    for (i = 0, len = 0; i < probes->cCPUs; i += cPerChar) {
+        for (j = i, worst = 0; j < i + cPerChar && j < probes->cCPUs; ++j) {
+            latency = GetMaxLatency(probes, j);
+            if (latency > worst)
+                worst = latency;
+        }
+        sz[len++] = GetLatencyLevel(worst);
+    }
+
+    sz[len] = 0;
+    return len;
+}
+
+/*
+ * Return the worst latency seen on a CPU.
+ */
+unsigned long long
+GetMaxLatency(const CPUPROBES *probes, int cpu)
+{
+    return atomic_load_explicit(&probes->meters[cpu].histogram.maxValue,
+                                memory_order_relaxed);
+}
+
+/*
+ * Return the character for a latency in the CPU map:
+ * '.' for less than CPU_MAP_BASE, then '1' through '9' for each doubling.
+ */
+CCHAR
+GetLatencyLevel(unsigned long long latency)
+{
+    int level;
+
+    if (latency < CPU_MAP_BASE)
+        return CTEXT('.');
+    for (level = 1, latency /= 2 * CPU_MAP_BASE;
+         latency > 0 && level < 9;
+         ++level, latency /= 2)
+        ;
+    return CTEXT('0') + level;
+}
@@ -0,0 +1,51 @@
+/*
+ * Per-CPU latency probes for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A single hiccup meter tells us that some CPU was unavailable, but a
+ * freeze is often one CPU stuck in an interrupt storm while the rest carry
+ * on. Like cyclictest, this runs a hiccup meter pinned to each CPU, and
+ * shows the worst latency seen by each one.
+ *
+ * Each meter is written only by its own probe thread, and they're aligned
+ * to cache lines, so the probes never contend with each other however
+ * many CPUs there are.
+ */
+
+#ifndef CPUPROBE_H
+#define CPUPROBE_H
+
+#include "clockcore.h"
+#include "hiccup.h"
+
+// Latencies below this are shown as '.' in the map, in microseconds;
+// each digit after that is twice as much as the one before
+#define CPU_MAP_BASE 100
+
+typedef struct tagCPUPROBES {
+    HICCUPMETER *meters;        // one per CPU
+    void *block;                // memory the meters are in
+    int cCPUs;
+} CPUPROBES;
+
+int StartCPUProbes(CPUPROBES *probes, unsigned long interval);
+void StopCPUProbes(CPUPROBES *probes);
+
+int FormatCPUSummary(CCHAR *sz, const CPUPROBES *probes);
+int FormatCPUMap(CCHAR *sz, const CPUPROBES *probes);
+
+#endif /* CPUPROBE_H */
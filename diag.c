@@ -0,0 +1,166 @@
+/*
+ * Diagnostics shared by the Unix front-ends for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h> // for memset()
+
+#include "diag.h"
+#include "eventring.h"
+#include "histogram.h"
+#include "timestamp.h"
+
+static void CollectStalls(DIAGNOSTICS *diag);
+static void ReportEvent(DIAGNOSTICS *diag, const DRIFTEVENT *event);
+
+/*
+ * Start the probes.
+ * If szDriftLog is not NULL, clock changes and stalls are logged there.
+ * If metricsPort is not 0, metrics are served on that port.
+ * If szStateName is not NULL, the state is published to a shared memory
+ * page by that name; the rest still works if it can't be.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+StartDiagnostics(DIAGNOSTICS *diag, const CCHAR *szDriftLog,
+                 unsigned short metricsPort, const char *szStateName)
+{
+    memset(diag, 0, sizeof(DIAGNOSTICS));
+    diag->szDriftLog = szDriftLog;
+    InitHistogram(&diag->tickLateness);
+
+    if (StartHiccupMeter(&diag->hiccupMeter, HICCUP_INTERVAL,
+                         HICCUP_ANY_CPU) != 0)
+        return -1;
+    if (StartUIProbe(&diag->uiProbe, UIPROBE_INTERVAL, NULL, NULL) != 0) {
+        StopHiccupMeter(&diag->hiccupMeter);
+        return -1;
+    }
+
+    if (metricsPort != 0) {
+        AddMetricHistogram(&diag->metrics, METRIC_TICK_LATENESS,
+                           METRIC_TICK_LATENESS_HELP, &diag->tickLateness);
+        AddMetricHistogram(&diag->metrics, METRIC_HICCUPS,
+                           METRIC_HICCUPS_HELP,
+                           &diag->hiccupMeter.histogram);
+        AddMetricHistogram(&diag->metrics, METRIC_UI_DISPATCH,
+                           METRIC_UI_DISPATCH_HELP, &diag->uiProbe.histogram);
+        if (StartMetricServer(&diag->metrics, metricsPort) != 0) {
+            StopDiagnostics(diag);
+            return -1;
+        }
+    }
+    if (szStateName != NULL)
+        OpenStatePage(&diag->statePage, szStateName);
+    return 0;
+}
+
+/*
+ * Stop the probes.
+ */
+void
+StopDiagnostics(DIAGNOSTICS *diag)
+{
+    StopMetricServer(&diag->metrics);
+    CloseStatePage(&diag->statePage);
+    StopUIProbe(&diag->uiProbe);
+    StopHiccupMeter(&diag->hiccupMeter);
+}
+
+/*
+ * Check for clock changes and stalls, update the status lines, and
+ * publish the metrics and state, and keep the probes' timestamps
+ * calibrated. Call this on each tick after UpdateClockState().
+ */
+void
+UpdateDiagnostics(DIAGNOSTICS *diag, CLOCKSTATE *state)
+{
+    static HISTSNAPSHOT snapshot;   // too big for the stack
+    CCHAR sz[STATUS_LEN + 2];
+    DRIFTEVENT event;
+
+    RecordValue(&diag->tickLateness, state->lateness);
+    if (CheckDrift(&diag->driftDetector, state, &event))
+        ReportEvent(diag, &event);
+    CollectStalls(diag);
+
+    if (state->fAwakeValid)
+        FormatAwakeTime(sz, state->awakeTicks);
+    else
+        sz[0] = CTEXT('\0');
+    SetStatusLine(state, STATUS_AWAKE, sz);
+
+    SnapshotHistogram(&diag->hiccupMeter.histogram, &snapshot);
+    FormatLatencies(sz, HICCUP_LABEL, &snapshot);
+    SetStatusLine(state, STATUS_HICCUPS, sz);
+
+    SnapshotHistogram(&diag->uiProbe.histogram, &snapshot);
+    FormatLatencies(sz, UIPROBE_LABEL, &snapshot);
+    SetStatusLine(state, STATUS_UI, sz);
+
+    FormatDriftStatus(sz, &diag->driftDetector.last, state->now);
+    SetStatusLine(state, STATUS_DRIFT, sz);
+
+    PublishMetrics(&diag->metrics, state);
+    PublishState(&diag->statePage, state);
+    RecalibrateTimestamps();
+}
+
+/*
+ * Report the stalls posted by the hiccup meter.
+ * Like CollectStalls() in uclock.c, stalls that overlap are merged into
+ * the longest of them.
+ */
+void
+CollectStalls(DIAGNOSTICS *diag)
+{
+    EVENTRECORD event;
+    DRIFTEVENT stall;
+
+    stall.type = DRIFT_NONE;
+    while (ReadEvent(&diag->hiccupMeter.events, &event)) {
+        if (event.type != EVENT_STALL)
+            continue;
+
+        if (stall.type != DRIFT_NONE
+            && event.wallTime - event.amount > stall.wallTime) {
+            ReportEvent(diag, &stall);
+            stall.type = DRIFT_NONE;
+        }
+        if (stall.type == DRIFT_NONE || event.amount > stall.amount) {
+            stall.type = DRIFT_STALL;
+            stall.wallTime = event.wallTime;
+            stall.amount = event.amount;
+        }
+    }
+    if (stall.type != DRIFT_NONE)
+        ReportEvent(diag, &stall);
+    CountDroppedEvents(&diag->statePage,
+                       TakeEventOverflow(&diag->hiccupMeter.events));
+}
+
+/*
+ * Log an event and show it on screen if it's the most recent.
+ */
+void
+ReportEvent(DIAGNOSTICS *diag, const DRIFTEVENT *event)
+{
+    if (event->wallTime >= diag->driftDetector.last.wallTime)
+        diag->driftDetector.last = *event;
+    if (event->type == DRIFT_STALL)
+        CountStall(&diag->statePage, event->wallTime, event->amount);
+    if (diag->szDriftLog != NULL)
+        LogDriftEvent(diag->szDriftLog, event);
+}
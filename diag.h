@@ -0,0 +1,53 @@
+/*
+ * Diagnostics shared by the Unix front-ends for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Everything the Unix front-ends show below the uptime: the hiccup meter,
+ * the UI responsiveness probe, and the drift detector, along with the
+ * stalls the hiccup meter posts, and optionally an OpenMetrics endpoint
+ * for all of it and the shared state page for other programs. The UI
+ * probe pings through a pipe, so the event loop should call
+ * ReadUIProbePings() whenever uiProbe.fd is readable.
+ */
+
+#ifndef DIAG_H
+#define DIAG_H
+
+#include "clockcore.h"
+#include "drift.h"
+#include "hiccup.h"
+#include "histogram.h"
+#include "metrics.h"
+#include "statepage.h"
+#include "uiprobe.h"
+
+typedef struct tagDIAGNOSTICS {
+    HICCUPMETER hiccupMeter;
+    UIPROBE uiProbe;
+    DRIFTDETECTOR driftDetector;
+    HISTOGRAM tickLateness;
+    METRICSERVER metrics;
+    STATEPAGE statePage;
+    const CCHAR *szDriftLog;    // where to log events, or NULL
+} DIAGNOSTICS;
+
+int StartDiagnostics(DIAGNOSTICS *diag, const CCHAR *szDriftLog,
+                     unsigned short metricsPort, const char *szStateName);
+void StopDiagnostics(DIAGNOSTICS *diag);
+void UpdateDiagnostics(DIAGNOSTICS *diag, CLOCKSTATE *state);
+
+#endif /* DIAG_H */
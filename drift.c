@@ -0,0 +1,245 @@
+/*
+ * Wall clock drift detector for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef _WIN32
+#  define WINVER 0x400
+#  include <windows.h>
+#  define NEWLINE "\r\n"
+#else
+#  define _GNU_SOURCE
+#  include <fcntl.h>
+#  include <unistd.h>
+#  define NEWLINE "\n"
+#endif
+
+#include <stdio.h>
+#include <string.h> // for strcpy() and strlen()
+
+#include "drift.h"
+
+static long long Magnitude(long long n);
+
+/*
+ * Compare the wall clock and uptime on a tick.
+ * Returns 1 and fills in event if the wall clock was stepped or is being
+ * slewed, or 0 otherwise.
+ */
+int
+CheckDrift(DRIFTDETECTOR *detector, const CLOCKSTATE *state,
+           DRIFTEVENT *event)
+{
+    long long offset, change, suspended, slept, rate;
+    unsigned long long elapsed;
+
+    offset = (long long) state->wallTime
+             - (long long) (state->ticks * USEC_PER_MSEC);
+    suspended = state->fAwakeValid
+                ? (long long) (state->ticks - state->awakeTicks)
+                  * USEC_PER_MSEC
+                : 0;
+    if (!detector->fStarted) {
+        detector->fStarted = 1;
+        detector->offset = detector->windowOffset = offset;
+        detector->windowTicks = state->ticks;
+        detector->suspended = suspended;
+        return 0;
+    }
+
+    change = offset - detector->offset;
+    detector->offset = offset;
+    slept = suspended - detector->suspended;
+    detector->suspended = suspended;
+
+    event->type = DRIFT_NONE;
+    event->wallTime = state->wallTime;
+    if (slept >= DRIFT_SUSPEND_THRESHOLD) {
+        // A suspend doesn't change the offset, but the wall clock is often
+        // corrected on resume; that's reported from the next window on
+        event->type = DRIFT_SUSPEND;
+        event->amount = slept;
+        detector->windowOffset = offset;
+        detector->windowTicks = state->ticks;
+    } else if (Magnitude(change) >= DRIFT_STEP_THRESHOLD) {
+        // Start measuring slew over from here, so the step isn't counted
+        event->type = DRIFT_STEP;
+        event->amount = change;
+        detector->windowOffset = offset;
+        detector->windowTicks = state->ticks;
+    } else {
+        elapsed = state->ticks - detector->windowTicks;
+        if (elapsed < DRIFT_SLEW_WINDOW * MSEC_PER_SEC)
+            return 0;
+
+        // Microseconds per millisecond is thousandths, so scale to ppm
+        rate = (offset - detector->windowOffset) * 1000 / (long long) elapsed;
+        detector->windowOffset = offset;
+        detector->windowTicks = state->ticks;
+        if (Magnitude(rate) < DRIFT_SLEW_THRESHOLD)
+            return 0;
+
+        event->type = DRIFT_SLEW;
+        event->amount = rate;
+    }
+
+    detector->last = *event;
+    return 1;
+}
+
+/*
+ * Format an event for the log, like:
+ *   2023-03-30T00:34:56Z step +1.234567 s
+ *   2023-03-30T00:44:56Z slew -250 ppm
+ *   2023-03-30T00:54:56Z suspend 3600.000000 s
+ * sz must have room for DRIFT_EVENT_LEN characters.
+ * Returns the length of the formatted string.
+ */
+int
+FormatDriftEvent(char *sz, const DRIFTEVENT *event)
+{
+    time_t t;
+    struct tm *tm;
+    long long amount;
+    size_t len;
+
+    // The wall clock may be somewhere gmtime() can't follow it
+    t = (time_t) (event->wallTime / USEC_PER_SEC);
+    tm = gmtime(&t);
+    len = (tm != NULL)
+          ? strftime(sz, DRIFT_EVENT_LEN + 1, "%Y-%m-%dT%H:%M:%SZ", tm)
+          : 0;
+    if (len == 0)
+        len = snprintf(sz, DRIFT_EVENT_LEN + 1, "@%lld", (long long) t);
+
+    amount = Magnitude(event->amount);
+    if (event->type == DRIFT_STEP)
+        snprintf(sz + len, DRIFT_EVENT_LEN + 1 - len, " step %c%lld.%06lld s",
+                 (event->amount < 0) ? '-' : '+',
+                 amount / USEC_PER_SEC, amount % USEC_PER_SEC);
+    else if (event->type == DRIFT_SLEW)
+        snprintf(sz + len, DRIFT_EVENT_LEN + 1 - len, " slew %c%lld ppm",
+                 (event->amount < 0) ? '-' : '+', amount);
+    else if (event->type == DRIFT_SUSPEND)
+        snprintf(sz + len, DRIFT_EVENT_LEN + 1 - len, " suspend %lld.%06lld s",
+                 amount / USEC_PER_SEC, amount % USEC_PER_SEC);
+    else
+        snprintf(sz + len, DRIFT_EVENT_LEN + 1 - len, " stall %lld.%06lld s",
+                 amount / USEC_PER_SEC, amount % USEC_PER_SEC);
+
+    return strlen(sz);
+}
+
+/*
+ * Format a status line for the most recent event, like:
+ *   Clock stepped +1.235 s at 12:34:56
+ *   Suspended 3600 s until 12:34:56
+ * This is empty if there hasn't been an event in DRIFT_DISPLAY_TIME.
+ * sz must have room for STATUS_LEN characters.
+ * Returns the length of the formatted string.
+ */
+int
+FormatDriftStatus(CCHAR *sz, const DRIFTEVENT *event, time_t now)
+{
+    char buf[STATUS_LEN + 1], szTime[9];
+    time_t t;
+    struct tm *tm;
+    long long amount;
+    int i;
+
+    t = (time_t) (event->wallTime / USEC_PER_SEC);
+    if (event->type == DRIFT_NONE || now - t > DRIFT_DISPLAY_TIME) {
+        sz[0] = 0;
+        return 0;
+    }
+
+    tm = localtime(&t);
+    if (tm == NULL || strftime(szTime, sizeof(szTime), "%H:%M:%S", tm) == 0)
+        strcpy(szTime, "--:--:--");
+
+    amount = Magnitude(event->amount);
+    if (event->type == DRIFT_STEP)
+        snprintf(buf, sizeof(buf),
+                 "Clock stepped %c%lld.%03lld s at %s",
+                 (event->amount < 0) ? '-' : '+',
+                 amount / USEC_PER_SEC,
+                 (amount % USEC_PER_SEC) / USEC_PER_MSEC, szTime);
+    else if (event->type == DRIFT_SLEW)
+        snprintf(buf, sizeof(buf),
+                 "Clock slewing %c%lld ppm at %s",
+                 (event->amount < 0) ? '-' : '+', amount, szTime);
+    else if (event->type == DRIFT_SUSPEND)
+        snprintf(buf, sizeof(buf),
+                 "Suspended %lld s until %s",
+                 amount / USEC_PER_SEC, szTime);
+    else
+        snprintf(buf, sizeof(buf),
+                 "Stalled %lld.%03lld s until %s",
+                 amount / USEC_PER_SEC,
+                 (amount % USEC_PER_SEC) / USEC_PER_MSEC, szTime);
+
+    // It's all ASCII, so this works for wide characters too
+    for (i = 0; buf[i] != '\0'; ++i)
+        sz[i] = buf[i];
+    sz[i] = 0;
+    return i;
+}
+
+/*
+ * Append an event to a log file, creating it if needed.
+ * Events are rare, so we just open and close the file each time.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+LogDriftEvent(const CCHAR *path, const DRIFTEVENT *event)
+{
+    char sz[DRIFT_EVENT_LEN + sizeof(NEWLINE)];
+    int len, result;
+#ifdef _WIN32
+    HANDLE hFile;
+    DWORD cbWritten;
+#else
+    int fd;
+#endif
+
+    len = FormatDriftEvent(sz, event);
+    memcpy(sz + len, NEWLINE, sizeof(NEWLINE));
+    len += sizeof(NEWLINE) - 1;
+
+#ifdef _WIN32
+    hFile = CreateFile(path, GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                       OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return -1;
+    SetFilePointer(hFile, 0, NULL, FILE_END);
+    result = (WriteFile(hFile, sz, len, &cbWritten, NULL)
+              && cbWritten == (DWORD) len) ? 0 : -1;
+    CloseHandle(hFile);
+#else
+    fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return -1;
+    result = (write(fd, sz, len) == len) ? 0 : -1;
+    close(fd);
+#endif
+
+    return result;
+}
+
+long long
+Magnitude(long long n)
+{
+    return (n < 0) ? -n : n;
+}
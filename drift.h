@@ -0,0 +1,94 @@
+/*
+ * Wall clock drift detector for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The wall clock and the uptime should advance together, so the
+ * difference between them -- the offset -- should stay put. When it
+ * doesn't, someone or something changed the wall clock: a sudden jump is
+ * a step (NTP correcting a large error, or someone setting the clock by
+ * hand), and a steady change is a slew (NTP gradually correcting a small
+ * one, or a bad RTC). Either one can look like a freeze if you're only
+ * watching the seconds, so we point them out.
+ *
+ * The uptime comes from the same tick source as the display, which keeps
+ * counting while the system is suspended, so a resume isn't a step.
+ * Instead, we compare the uptime with the time the system has been awake,
+ * which doesn't, and report the difference as a suspend. Telling a
+ * suspend apart from a freeze is one of the first questions in triage.
+ */
+
+#ifndef DRIFT_H
+#define DRIFT_H
+
+#include <stddef.h>
+
+#include "clockcore.h"
+
+// Offset changes bigger than this between ticks are steps, in microseconds
+// This is comfortably above the tick source's resolution on Windows
+#define DRIFT_STEP_THRESHOLD 100000
+
+// Slews are measured over this many seconds
+#define DRIFT_SLEW_WINDOW 600
+
+// Slews faster than this are reported, in parts per million
+#define DRIFT_SLEW_THRESHOLD 100
+
+// Suspends shorter than this aren't reported, in microseconds
+#define DRIFT_SUSPEND_THRESHOLD 1000000
+
+// How long to show the last event on screen, in seconds
+#define DRIFT_DISPLAY_TIME 3600
+
+// Event log file name, in the same directory as the clock itself
+#define DRIFT_LOG_FILE_NAME CTEXT("uclock.log")
+
+// Longest line FormatDriftEvent() produces
+#define DRIFT_EVENT_LEN 63
+
+// Event types
+#define DRIFT_NONE 0
+#define DRIFT_STEP 1
+#define DRIFT_SLEW 2
+#define DRIFT_SUSPEND 3
+#define DRIFT_STALL 4           // from a hiccup meter, not detected here
+
+typedef struct tagDRIFTEVENT {
+    int type;
+    unsigned long long wallTime;    // when it was detected, in microseconds
+    long long amount;           // size of a step in microseconds,
+                                // rate of a slew in parts per million,
+                                // or length of a suspend or stall
+                                // in microseconds
+} DRIFTEVENT;
+
+typedef struct tagDRIFTDETECTOR {
+    int fStarted;               // nonzero after the first tick
+    long long offset;           // wall time minus uptime at the last tick
+    long long windowOffset;     // offset at the start of the slew window
+    unsigned long long windowTicks; // uptime at the start of the window
+    long long suspended;        // uptime minus awake time at the last tick
+    DRIFTEVENT last;            // most recent event
+} DRIFTDETECTOR;
+
+int CheckDrift(DRIFTDETECTOR *detector, const CLOCKSTATE *state,
+               DRIFTEVENT *event);
+int FormatDriftEvent(char *sz, const DRIFTEVENT *event);
+int FormatDriftStatus(CCHAR *sz, const DRIFTEVENT *event, time_t now);
+int LogDriftEvent(const CCHAR *path, const DRIFTEVENT *event);
+
+#endif /* DRIFT_H */
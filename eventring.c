@@ -0,0 +1,93 @@
+/*
+ * Lock-free event rings for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "eventring.h"
+
+// Mask for turning a free-running index into a slot number
+#define EVENT_RING_MASK ((EVENT_RING_SIZE) - 1)
+
+/*
+ * Initialize an empty event ring.
+ */
+void
+InitEventRing(EVENTRING *ring)
+{
+    atomic_init(&ring->head, 0);
+    ring->cachedTail = 0;
+    atomic_init(&ring->overflow, 0);
+    atomic_init(&ring->tail, 0);
+    ring->cachedHead = 0;
+}
+
+/*
+ * Add an event to the ring. Only one thread may call this for each ring.
+ * Returns 0 on success, -1 if the ring was full and the event was dropped.
+ */
+int
+PostEvent(EVENTRING *ring, const EVENTRECORD *event)
+{
+    unsigned int head;
+
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - ring->cachedTail == EVENT_RING_SIZE) {
+        // Looks full, but the consumer may have caught up since we checked
+        ring->cachedTail = atomic_load_explicit(&ring->tail,
+                                                memory_order_acquire);
+        if (head - ring->cachedTail == EVENT_RING_SIZE) {
+            atomic_fetch_add_explicit(&ring->overflow, 1,
+                                      memory_order_relaxed);
+            return -1;
+        }
+    }
+
+    ring->records[head & EVENT_RING_MASK] = *event;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 0;
+}
+
+/*
+ * Remove the oldest event from the ring. Only one thread may call this
+ * for each ring.
+ * Returns 1 if an event was read, 0 if the ring was empty.
+ */
+int
+ReadEvent(EVENTRING *ring, EVENTRECORD *event)
+{
+    unsigned int tail;
+
+    tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail == ring->cachedHead) {
+        ring->cachedHead = atomic_load_explicit(&ring->head,
+                                                memory_order_acquire);
+        if (tail == ring->cachedHead)
+            return 0;
+    }
+
+    *event = ring->records[tail & EVENT_RING_MASK];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+/*
+ * Return the number of events dropped since the last call.
+ * Safe to call from the consumer while the producer is running.
+ */
+unsigned int
+TakeEventOverflow(EVENTRING *ring)
+{
+    return atomic_exchange_explicit(&ring->overflow, 0, memory_order_relaxed);
+}
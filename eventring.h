@@ -0,0 +1,66 @@
+/*
+ * Lock-free event rings for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Background threads hand their results to the user interface thread
+ * through an event ring: a bounded single-producer, single-consumer queue
+ * of fixed-size records. Each producer gets its own ring, so neither side
+ * ever takes a lock or waits on the other. If the user interface falls
+ * behind and a ring fills up, new events are dropped and counted rather
+ * than blocking the producer -- a probe that waits on the thing it's
+ * measuring isn't measuring anything.
+ */
+
+#ifndef EVENTRING_H
+#define EVENTRING_H
+
+#include <stdatomic.h>
+
+#include "thread.h"
+
+// Number of events a ring holds; must be a power of two
+#define EVENT_RING_SIZE 64
+
+// Event types
+#define EVENT_NONE 0
+#define EVENT_STALL 1           // a probe was stalled
+
+typedef struct tagEVENTRECORD {
+    int type;
+    int source;                 // where it came from, like a CPU number
+    unsigned long long wallTime;    // when it happened, in microseconds
+    long long amount;           // how big it was; depends on the type
+} EVENTRECORD;
+
+// The producer's and consumer's indexes are on separate cache lines, each
+// with a private copy of the other's, so they only share a line when the
+// ring looks full or empty
+typedef struct tagEVENTRING {
+    _Alignas(CACHE_LINE_SIZE) atomic_uint head; // next slot to write
+    unsigned int cachedTail;    // producer's copy of tail
+    atomic_uint overflow;       // events dropped because the ring was full
+    _Alignas(CACHE_LINE_SIZE) atomic_uint tail; // next slot to read
+    unsigned int cachedHead;    // consumer's copy of head
+    _Alignas(CACHE_LINE_SIZE) EVENTRECORD records[EVENT_RING_SIZE];
+} EVENTRING;
+
+void InitEventRing(EVENTRING *ring);
+int PostEvent(EVENTRING *ring, const EVENTRECORD *event);
+int ReadEvent(EVENTRING *ring, EVENTRECORD *event);
+unsigned int TakeEventOverflow(EVENTRING *ring);
+
+#endif /* EVENTRING_H */
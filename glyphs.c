@@ -0,0 +1,252 @@
+/*
+ * Pre-rendered glyphs for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define WINVER 0x400
+#include <windows.h>
+
+#include <string.h> // for memset()
+
+#include "glyphs.h"
+
+/*
+ * Create a glyph atlas using the specified font.
+ *
+ * The atlas takes ownership of the font, and the glyphs are rendered in
+ * the current system colors, so the atlas should be re-created when
+ * either of those change. szLabel may be NULL if there is no label.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+CreateGlyphAtlas(GLYPHATLAS *atlas, HDC hdc, HFONT hFont,
+                 LPCTSTR szLabel, int cchLabel)
+{
+    LPCTSTR pch;
+    SIZE size;
+    RECT rect;
+    int cxAtlas, cxPad;
+
+    memset(atlas, 0, sizeof(GLYPHATLAS));
+    atlas->hFont = hFont;
+    if (atlas->hFont == NULL)
+        goto error;
+
+    atlas->hdc = CreateCompatibleDC(hdc);
+    if (atlas->hdc == NULL)
+        goto error;
+    SelectObject(atlas->hdc, atlas->hFont);
+
+    // Measure each glyph and decide where it goes, leaving some space
+    // between them so one glyph's overhang doesn't bleed into the next
+    GetTextExtentPoint32(atlas->hdc, TEXT("0"), 1, &size);
+    atlas->cy = size.cy;
+    cxPad = size.cy / 8;
+    cxAtlas = cxPad;
+    for (pch = GLYPH_CHARS; *pch != '\0'; ++pch) {
+        GetTextExtentPoint32(atlas->hdc, pch, 1, &size);
+        atlas->x[(unsigned) *pch] = cxAtlas;
+        atlas->cx[(unsigned) *pch] = size.cx;
+        cxAtlas += size.cx + cxPad;
+    }
+
+    // The label goes after the glyphs
+    if (szLabel != NULL) {
+        GetTextExtentPoint32(atlas->hdc, szLabel, cchLabel, &size);
+        atlas->xLabel = cxAtlas;
+        atlas->cxLabel = size.cx;
+        cxAtlas += size.cx + cxPad;
+    }
+
+    atlas->hbm = CreateCompatibleBitmap(hdc, cxAtlas, atlas->cy);
+    if (atlas->hbm == NULL)
+        goto error;
+    atlas->hbmOld = SelectObject(atlas->hdc, atlas->hbm);
+
+    // Render everything on the window background
+    SetRect(&rect, 0, 0, cxAtlas, atlas->cy);
+    FillRect(atlas->hdc, &rect, GetSysColorBrush(COLOR_BTNFACE));
+    SetTextAlign(atlas->hdc, TA_TOP | TA_LEFT | TA_NOUPDATECP);
+    SetTextColor(atlas->hdc, GetSysColor(COLOR_BTNTEXT));
+    SetBkMode(atlas->hdc, TRANSPARENT);
+
+    for (pch = GLYPH_CHARS; *pch != '\0'; ++pch)
+        TextOut(atlas->hdc, atlas->x[(unsigned) *pch], 0, pch, 1);
+    if (szLabel != NULL)
+        TextOut(atlas->hdc, atlas->xLabel, 0, szLabel, cchLabel);
+
+    return 0;
+
+error:
+    FreeGlyphAtlas(atlas);
+    return -1;
+}
+
+/*
+ * Free a glyph atlas, including its font.
+ */
+void
+FreeGlyphAtlas(GLYPHATLAS *atlas)
+{
+    if (atlas->hdc != NULL) {
+        if (atlas->hbmOld != NULL)
+            SelectObject(atlas->hdc, atlas->hbmOld);
+        DeleteDC(atlas->hdc);
+    }
+    if (atlas->hbm != NULL)
+        DeleteObject(atlas->hbm);
+    if (atlas->hFont != NULL)
+        DeleteObject(atlas->hFont);
+
+    memset(atlas, 0, sizeof(GLYPHATLAS));
+}
+
+/*
+ * Return the width of a string drawn with the atlas font.
+ */
+long
+MeasureGlyphs(GLYPHATLAS *atlas, LPCTSTR sz, int cch)
+{
+    SIZE size;
+    long cx;
+    int i;
+
+    for (i = 0, cx = 0; i < cch; ++i) {
+        if ((unsigned) sz[i] >= GLYPH_MAX || atlas->cx[(unsigned) sz[i]] == 0)
+            break;
+        cx += atlas->cx[(unsigned) sz[i]];
+    }
+    if (i == cch)
+        return cx;
+
+    // The string has characters we didn't render, so ask GDI
+    GetTextExtentPoint32(atlas->hdc, sz, cch, &size);
+    return size.cx;
+}
+
+/*
+ * Draw a string centered horizontally on x, with its top at y.
+ *
+ * The background must already be filled with the window color. If the
+ * string contains any characters not in the atlas, we fall back to
+ * drawing it with TextOut().
+ */
+void
+DrawGlyphs(GLYPHATLAS *atlas, HDC hdc, long x, long y, LPCTSTR sz, int cch)
+{
+    HGDIOBJ hOldObj;
+    UINT fOldAlign;
+    int i;
+
+    x -= MeasureGlyphs(atlas, sz, cch) / 2;
+
+    for (i = 0; i < cch; ++i)
+        if ((unsigned) sz[i] >= GLYPH_MAX || atlas->cx[(unsigned) sz[i]] == 0)
+            break;
+
+    if (i < cch) {
+        hOldObj = SelectObject(hdc, atlas->hFont);
+        fOldAlign = SetTextAlign(hdc, TA_TOP | TA_LEFT | TA_NOUPDATECP);
+        TextOut(hdc, x, y, sz, cch);
+        SetTextAlign(hdc, fOldAlign);
+        SelectObject(hdc, hOldObj);
+        return;
+    }
+
+    for (i = 0; i < cch; ++i) {
+        BitBlt(hdc, x, y, atlas->cx[(unsigned) sz[i]], atlas->cy,
+               atlas->hdc, atlas->x[(unsigned) sz[i]], 0, SRCCOPY);
+        x += atlas->cx[(unsigned) sz[i]];
+    }
+}
+
+/*
+ * Draw the label strip centered horizontally on x, with its top at y.
+ */
+void
+DrawGlyphLabel(GLYPHATLAS *atlas, HDC hdc, long x, long y)
+{
+    BitBlt(hdc, x - atlas->cxLabel / 2, y, atlas->cxLabel, atlas->cy,
+           atlas->hdc, atlas->xLabel, 0, SRCCOPY);
+}
+
+/*
+ * Get an atlas for the specified font height and label from a cache,
+ * creating it if no window is using one already.
+ * Release it with ReleaseGlyphAtlas() when done.
+ * Returns NULL on failure.
+ */
+GLYPHATLAS *
+AcquireGlyphAtlas(GLYPHCACHE *cache, HDC hdc, int cHeight,
+                  LPCTSTR szLabel, int cchLabel)
+{
+    GLYPHCACHEENTRY *entry, *empty = NULL;
+    int i;
+
+    for (i = 0; i < GLYPH_CACHE_SIZE; ++i) {
+        entry = &cache->entries[i];
+        if (entry->cRefs == 0) {
+            if (empty == NULL)
+                empty = entry;
+        } else if (!entry->fStale
+                   && entry->cHeight == cHeight
+                   && entry->szLabel == szLabel) {
+            ++entry->cRefs;
+            return &entry->atlas;
+        }
+    }
+
+    if (empty == NULL
+        || CreateGlyphAtlas(&empty->atlas, hdc, cache->createFont(cHeight),
+                            szLabel, cchLabel) != 0)
+        return NULL;
+    empty->cHeight = cHeight;
+    empty->szLabel = szLabel;
+    empty->cRefs = 1;
+    empty->fStale = FALSE;
+    return &empty->atlas;
+}
+
+/*
+ * Release an atlas from a cache, freeing it if no one else is using it.
+ * This is safe to call with NULL.
+ */
+void
+ReleaseGlyphAtlas(GLYPHCACHE *cache, GLYPHATLAS *atlas)
+{
+    GLYPHCACHEENTRY *entry;
+
+    if (atlas == NULL)
+        return;
+
+    // The atlas is the first member, so this finds its entry
+    entry = (GLYPHCACHEENTRY *) atlas;
+    if (--entry->cRefs == 0)
+        FreeGlyphAtlas(&entry->atlas);
+}
+
+/*
+ * Keep a cache from handing out any atlases it already has.
+ * Call this when the system colors or display settings change; atlases
+ * in use are freed when the last window using them releases them.
+ */
+void
+FlushGlyphCache(GLYPHCACHE *cache)
+{
+    int i;
+
+    for (i = 0; i < GLYPH_CACHE_SIZE; ++i)
+        cache->entries[i].fStale = TRUE;
+}
@@ -0,0 +1,80 @@
+/*
+ * Pre-rendered glyphs for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The clock only ever displays a few dozen distinct characters, so rather
+ * than have GDI rasterize them every time, we render each one once into
+ * an offscreen bitmap (the "atlas") and blit them into place as needed.
+ * A static label, like "System Uptime", can be rendered as a single strip.
+ *
+ * Windows of the same size need the same atlases, so a glyph cache lets
+ * them share one copy of each rather than every window rendering its own.
+ */
+
+#ifndef GLYPHS_H
+#define GLYPHS_H
+
+#include <windows.h>
+
+// Characters included in the atlas
+#define GLYPH_CHARS TEXT("0123456789/:,.%+- ACHIMPSUacdefghiklmnoprstuwxy")
+
+// Character codes below this can be included in the atlas
+#define GLYPH_MAX 128
+
+typedef struct tagGLYPHATLAS {
+    HFONT hFont;
+    HDC hdc;
+    HBITMAP hbm, hbmOld;
+    int cy;                     // height of the atlas
+    int x[GLYPH_MAX];           // where each glyph is in the atlas
+    int cx[GLYPH_MAX];          // width of each glyph; 0 if not included
+    int xLabel, cxLabel;        // where the label strip is in the atlas
+} GLYPHATLAS;
+
+// Most atlases a glyph cache holds at once
+#define GLYPH_CACHE_SIZE 48
+
+// An atlas in a glyph cache, and what it was made for
+typedef struct tagGLYPHCACHEENTRY {
+    GLYPHATLAS atlas;
+    int cHeight;                // font height
+    LPCTSTR szLabel;            // label, compared by address
+    int cRefs;                  // 0 if the entry is free
+    BOOL fStale;                // made before the last display change
+} GLYPHCACHEENTRY;
+
+typedef struct tagGLYPHCACHE {
+    HFONT (*createFont)(int cHeight);
+    GLYPHCACHEENTRY entries[GLYPH_CACHE_SIZE];
+} GLYPHCACHE;
+
+int CreateGlyphAtlas(GLYPHATLAS *atlas, HDC hdc, HFONT hFont,
+                     LPCTSTR szLabel, int cchLabel);
+void FreeGlyphAtlas(GLYPHATLAS *atlas);
+
+long MeasureGlyphs(GLYPHATLAS *atlas, LPCTSTR sz, int cch);
+void DrawGlyphs(GLYPHATLAS *atlas, HDC hdc, long x, long y,
+                LPCTSTR sz, int cch);
+void DrawGlyphLabel(GLYPHATLAS *atlas, HDC hdc, long x, long y);
+
+GLYPHATLAS *AcquireGlyphAtlas(GLYPHCACHE *cache, HDC hdc, int cHeight,
+                              LPCTSTR szLabel, int cchLabel);
+void ReleaseGlyphAtlas(GLYPHCACHE *cache, GLYPHATLAS *atlas);
+void FlushGlyphCache(GLYPHCACHE *cache);
+
+#endif /* GLYPHS_H */
@@ -0,0 +1,445 @@
+/*
+ * HdrHistogram log export for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef _WIN32
+#  define WINVER 0x400
+#  include <windows.h>
+#  define NEWLINE "\r\n"
+#else
+#  define _GNU_SOURCE
+#  include <fcntl.h>
+#  include <unistd.h>
+#  define NEWLINE "\n"
+#endif
+
+#include <stdio.h>
+#include <string.h> // for memcpy() and strlen()
+
+#include "hdrlog.h"
+
+// Largest block of data zlib can store in one piece
+#define STORED_BLOCK_MAX 65535
+
+// How often the log thread checks whether it's time to stop, in usec
+#define HDRLOG_POLL_INTERVAL 100000
+
+static void RunHdrLog(void *arg);
+static void WriteHdrLogHeader(HDRLOG *log);
+static void WriteHdrLogInterval(HDRLOG *log, unsigned long long end);
+static int AppendToFile(const CCHAR *path, const char *sz, size_t len);
+static unsigned char *PutInt32(unsigned char *p, unsigned long n);
+static unsigned char *PutInt64(unsigned char *p, unsigned long long n);
+static unsigned char *PutZigZag(unsigned char *p, long long n);
+static unsigned long Adler32(const unsigned char *buf, size_t len);
+static size_t EncodeBase64(char *sz, const unsigned char *buf, size_t len);
+static void SubtractSnapshot(HISTSNAPSHOT *snapshot, HISTSNAPSHOT *last);
+
+/*
+ * Add a histogram to a log that hasn't been started yet.
+ * The log must start out zeroed, like a static variable.
+ * Returns 0 on success, -1 if there are already HDRLOG_MAX_SOURCES.
+ */
+int
+AddHdrLogSource(HDRLOG *log, const char *tag, HISTOGRAM *histogram)
+{
+    HDRLOGSOURCE *source;
+
+    if (log->cSources >= HDRLOG_MAX_SOURCES)
+        return -1;
+    source = &log->sources[log->cSources++];
+    source->tag = tag;
+    source->histogram = histogram;
+    return 0;
+}
+
+/*
+ * Start logging the histograms every interval seconds.
+ * Only what's recorded from now on is logged.
+ * Returns 0 on success, -1 if the log thread couldn't be started.
+ */
+int
+StartHdrLog(HDRLOG *log, const CCHAR *path, unsigned long interval)
+{
+    int i;
+
+    for (i = 0; path[i] != 0 && i < (int) (sizeof(log->szPath)
+                                           / sizeof(CCHAR)) - 1; ++i)
+        log->szPath[i] = path[i];
+    log->szPath[i] = 0;
+
+    atomic_init(&log->fStop, 0);
+    log->interval = interval;
+    log->start = GetWallTime();
+    for (i = 0; i < log->cSources; ++i)
+        SnapshotHistogram(log->sources[i].histogram, &log->sources[i].last);
+
+    WriteHdrLogHeader(log);
+    return StartThread(&log->thread, RunHdrLog, log);
+}
+
+/*
+ * Stop logging, after writing out the last partial interval.
+ */
+void
+StopHdrLog(HDRLOG *log)
+{
+    atomic_store(&log->fStop, 1);
+    JoinThread(&log->thread);
+}
+
+/*
+ * Encode a histogram the way HdrHistogram's encodeIntoByteBuffer() does.
+ * buf must have room for HDRLOG_PAYLOAD_SIZE bytes.
+ * Returns the length of the encoding.
+ */
+size_t
+EncodeHistogram(unsigned char *buf, const HISTSNAPSHOT *snapshot)
+{
+    unsigned char *p;
+    union {
+        double d;
+        unsigned long long n;
+    } ratio;
+    int i, limit;
+    long long zeros;
+
+    // Only encode up to the last non-zero count
+    for (limit = HIST_COUNTS_LEN; limit > 0; --limit)
+        if (snapshot->counts[limit - 1] != 0)
+            break;
+
+    p = buf + HDRLOG_HEADER_SIZE;
+    for (i = 0; i < limit; ) {
+        if (snapshot->counts[i] != 0) {
+            p = PutZigZag(p, snapshot->counts[i++]);
+            continue;
+        }
+
+        // Runs of more than one zero are stored as a negative count
+        for (zeros = 0; i < limit && snapshot->counts[i] == 0; ++i)
+            ++zeros;
+        p = PutZigZag(p, (zeros > 1) ? -zeros : 0);
+    }
+
+    // Now that we know how long the counts are, fill in the header
+    ratio.d = 1.0;
+    PutInt32(buf, HDRLOG_COOKIE);
+    PutInt32(buf + 4, (unsigned long) (p - buf - HDRLOG_HEADER_SIZE));
+    PutInt32(buf + 8, 0);       // normalizing index offset
+    PutInt32(buf + 12, HIST_SIGNIFICANT_DIGITS);
+    PutInt64(buf + 16, HIST_LOWEST);
+    PutInt64(buf + 24, HIST_HIGHEST);
+    PutInt64(buf + 32, ratio.n); // integer to double conversion ratio
+    return p - buf;
+}
+
+/*
+ * Encode a histogram the way HdrHistogram's
+ * encodeIntoCompressedByteBuffer() does.
+ * buf must have room for HDRLOG_COMPRESSED_SIZE bytes.
+ * Returns the length of the encoding.
+ */
+size_t
+CompressHistogram(unsigned char *buf, const HISTSNAPSHOT *snapshot)
+{
+    unsigned char *payload, *p;
+    unsigned long checksum;
+    size_t len, cb, i;
+
+    // Encode it uncompressed at the end of the buffer, then wrap it
+    payload = buf + HDRLOG_COMPRESSED_SIZE - HDRLOG_PAYLOAD_SIZE;
+    len = EncodeHistogram(payload, snapshot);
+    checksum = Adler32(payload, len);
+
+    p = buf + 8;
+    *p++ = 0x78;                // deflate, 32K window
+    *p++ = 0x01;                // no dictionary, fastest compression
+    for (i = 0; i == 0 || i < len; i += cb) {
+        cb = (len - i > STORED_BLOCK_MAX) ? STORED_BLOCK_MAX : len - i;
+        *p++ = (i + cb == len) ? 1 : 0;     // final block?
+        *p++ = cb & 0xff;
+        *p++ = cb >> 8;
+        *p++ = ~cb & 0xff;
+        *p++ = (~cb >> 8) & 0xff;
+        memmove(p, payload + i, cb);    // overlaps, moving it forward
+        p += cb;
+    }
+    p = PutInt32(p, checksum);
+
+    PutInt32(buf, HDRLOG_COMPRESSED_COOKIE);
+    PutInt32(buf + 4, (unsigned long) (p - buf - 8));
+    return p - buf;
+}
+
+/*
+ * Format a log line for an interval histogram, like:
+ *   Tag=hiccups,1680136440.000,60.000,12.287,HISTFAAAA...
+ * sz must have room for HDRLOG_LINE_LEN characters.
+ * Returns the length of the line, not including a newline.
+ */
+size_t
+FormatHdrLogLine(char *sz, const char *tag,
+                 unsigned long long start, unsigned long long end,
+                 const HISTSNAPSHOT *snapshot)
+{
+    static unsigned char buf[HDRLOG_COMPRESSED_SIZE];
+    unsigned long long maxValue = 0;
+    size_t len;
+    int i;
+
+    // Like HdrHistogram, report the highest value equivalent to the max
+    for (i = HIST_COUNTS_LEN - 1; i >= 0; --i) {
+        if (snapshot->counts[i] != 0) {
+            maxValue = GetValueFromIndex(i + 1) - 1;
+            break;
+        }
+    }
+
+    len = snprintf(sz, HDRLOG_LINE_LEN,
+                   "Tag=%s,%llu.%03llu,%llu.%03llu,%llu.%03llu,",
+                   tag,
+                   start / USEC_PER_SEC,
+                   (start % USEC_PER_SEC) / USEC_PER_MSEC,
+                   (end - start) / USEC_PER_SEC,
+                   ((end - start) % USEC_PER_SEC) / USEC_PER_MSEC,
+                   maxValue / USEC_PER_MSEC,
+                   maxValue % USEC_PER_MSEC);
+    return len + EncodeBase64(sz + len, buf, CompressHistogram(buf, snapshot));
+}
+
+/*
+ * Body of the log thread.
+ */
+void
+RunHdrLog(void *arg)
+{
+    HDRLOG *log = arg;
+    unsigned long long now, due, interval;
+
+    // Line up the intervals with the wall clock, so logs from different
+    // machines cover the same minutes
+    interval = (unsigned long long) log->interval * USEC_PER_SEC;
+    due = (log->start / interval + 1) * interval;
+
+    while (!atomic_load_explicit(&log->fStop, memory_order_relaxed)) {
+        SleepMicroseconds(HDRLOG_POLL_INTERVAL);
+        now = GetWallTime();
+        if (now < log->start) {
+            // The clock was set back; start the interval over
+            due = (now / interval + 1) * interval;
+            log->start = now;
+        } else if (now >= due) {
+            WriteHdrLogInterval(log, now);
+            due = (now / interval + 1) * interval;
+        }
+    }
+
+    WriteHdrLogInterval(log, GetWallTime());
+}
+
+/*
+ * Write the comments that start a log.
+ */
+void
+WriteHdrLogHeader(HDRLOG *log)
+{
+    char sz[256], szTime[32];
+    time_t t;
+    struct tm *tm;
+    int len;
+
+    // The StartTime comment wants a date, but any label will do
+    t = (time_t) (log->start / USEC_PER_SEC);
+    tm = gmtime(&t);
+    if (tm == NULL
+        || strftime(szTime, sizeof(szTime), "%Y-%m-%dT%H:%M:%SZ", tm) == 0)
+        snprintf(szTime, sizeof(szTime), "@%lld", (long long) t);
+    len = snprintf(sz, sizeof(sz),
+                   "#[Histogram log format version 1.3]" NEWLINE
+                   "#[StartTime: %llu.%03llu (seconds since epoch), %s]"
+                   NEWLINE
+                   "#[BaseTime: 0.000 (seconds since epoch)]" NEWLINE
+                   "\"StartTimestamp\",\"Interval_Length\","
+                   "\"Interval_Max\",\"Interval_Compressed_Histogram\""
+                   NEWLINE,
+                   log->start / USEC_PER_SEC,
+                   (log->start % USEC_PER_SEC) / USEC_PER_MSEC, szTime);
+    AppendToFile(log->szPath, sz, len);
+}
+
+/*
+ * Write what each histogram recorded since the last interval.
+ */
+void
+WriteHdrLogInterval(HDRLOG *log, unsigned long long end)
+{
+    HDRLOGSOURCE *source;
+    size_t len;
+    int i;
+
+    for (i = 0; i < log->cSources; ++i) {
+        source = &log->sources[i];
+        SnapshotHistogram(source->histogram, &log->snapshot);
+        SubtractSnapshot(&log->snapshot, &source->last);
+
+        len = FormatHdrLogLine(log->szLine, source->tag, log->start, end,
+                               &log->snapshot);
+        memcpy(log->szLine + len, NEWLINE, sizeof(NEWLINE));
+        AppendToFile(log->szPath, log->szLine, len + sizeof(NEWLINE) - 1);
+    }
+
+    log->start = end;
+}
+
+/*
+ * Append text to a file, creating it if needed.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+AppendToFile(const CCHAR *path, const char *sz, size_t len)
+{
+    int result;
+#ifdef _WIN32
+    HANDLE hFile;
+    DWORD cbWritten;
+
+    hFile = CreateFile(path, GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                       OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return -1;
+    SetFilePointer(hFile, 0, NULL, FILE_END);
+    result = (WriteFile(hFile, sz, (DWORD) len, &cbWritten, NULL)
+              && cbWritten == (DWORD) len) ? 0 : -1;
+    CloseHandle(hFile);
+#else
+    int fd;
+
+    fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return -1;
+    result = (write(fd, sz, len) == (ssize_t) len) ? 0 : -1;
+    close(fd);
+#endif
+    return result;
+}
+
+/*
+ * Store a 32-bit integer in big-endian order.
+ */
+unsigned char *
+PutInt32(unsigned char *p, unsigned long n)
+{
+    *p++ = (n >> 24) & 0xff;
+    *p++ = (n >> 16) & 0xff;
+    *p++ = (n >> 8) & 0xff;
+    *p++ = n & 0xff;
+    return p;
+}
+
+/*
+ * Store a 64-bit integer in big-endian order.
+ */
+unsigned char *
+PutInt64(unsigned char *p, unsigned long long n)
+{
+    p = PutInt32(p, (unsigned long) (n >> 32));
+    return PutInt32(p, (unsigned long) (n & 0xffffffffUL));
+}
+
+/*
+ * Store an integer in ZigZag LEB128 form, as HdrHistogram does.
+ * Ours never need all 64 bits, so the 9-byte special case never comes up.
+ */
+unsigned char *
+PutZigZag(unsigned char *p, long long n)
+{
+    unsigned long long value;
+
+    value = ((unsigned long long) n << 1) ^ (unsigned long long) (n >> 63);
+    while (value >= 0x80) {
+        *p++ = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    *p++ = (unsigned char) value;
+    return p;
+}
+
+/*
+ * Return the Adler-32 checksum zlib puts at the end of a stream.
+ */
+unsigned long
+Adler32(const unsigned char *buf, size_t len)
+{
+    unsigned long a = 1, b = 0;
+    size_t i;
+
+    for (i = 0; i < len; ++i) {
+        a = (a + buf[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+}
+
+/*
+ * Encode bytes in Base64.
+ * Returns the length of the encoding, which is null-terminated.
+ */
+size_t
+EncodeBase64(char *sz, const unsigned char *buf, size_t len)
+{
+    static const char digits[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    unsigned long n;
+    size_t i;
+    char *p = sz;
+
+    for (i = 0; i < len; i += 3) {
+        n = (unsigned long) buf[i] << 16;
+        if (i + 1 < len)
+            n |= (unsigned long) buf[i + 1] << 8;
+        if (i + 2 < len)
+            n |= buf[i + 2];
+        *p++ = digits[(n >> 18) & 0x3f];
+        *p++ = digits[(n >> 12) & 0x3f];
+        *p++ = (i + 1 < len) ? digits[(n >> 6) & 0x3f] : '=';
+        *p++ = (i + 2 < len) ? digits[n & 0x3f] : '=';
+    }
+
+    *p = '\0';
+    return p - sz;
+}
+
+/*
+ * Subtract an earlier snapshot of the same histogram, leaving what was
+ * recorded in between, and make the later one the new earlier one.
+ */
+void
+SubtractSnapshot(HISTSNAPSHOT *snapshot, HISTSNAPSHOT *last)
+{
+    unsigned int count;
+    int i;
+
+    snapshot->totalCount = 0;
+    for (i = 0; i < HIST_COUNTS_LEN; ++i) {
+        count = snapshot->counts[i];
+        snapshot->counts[i] = count - last->counts[i];
+        snapshot->totalCount += snapshot->counts[i];
+        last->counts[i] = count;
+    }
+    last->totalCount += snapshot->totalCount;
+    last->maxValue = snapshot->maxValue;
+}
@@ -0,0 +1,108 @@
+/*
+ * HdrHistogram log export for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The status lines only show a few percentiles since the clock started.
+ * For monitoring, we can also write interval histograms -- what was
+ * recorded in each minute -- to a log in HdrHistogram's own format, so
+ * any of its tools can read them, and histograms from many machines or
+ * many minutes can be added together without losing anything.
+ *
+ * Each line of the log holds one histogram, tagged with what it measures:
+ *
+ *   Tag=hiccups,1680136440.000,60.000,12.287,HISTFAAAA...
+ *
+ * That's the start time in seconds since the epoch, the interval length,
+ * the largest value in milliseconds, and the histogram itself, encoded as
+ * in HdrHistogram's encodeIntoCompressedByteBuffer(): a 40-byte header
+ * followed by run-length ZigZag LEB128 counts, wrapped in zlib, and then
+ * in Base64. Our histograms already have HdrHistogram's layout, so the
+ * counts go out as they are. We don't have a deflate implementation, so
+ * the zlib stream uses stored (uncompressed) blocks; any inflater reads
+ * them, and the run-length coding already squeezes out the empty buckets.
+ *
+ * The log is written by its own thread, which takes snapshots of the
+ * histograms at the end of each interval and subtracts the previous ones,
+ * so the threads recording values never know it's there.
+ */
+
+#ifndef HDRLOG_H
+#define HDRLOG_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "clockcore.h"
+#include "histogram.h"
+#include "thread.h"
+
+// HdrHistogram V2 encoding cookies, for 64-bit counts
+#define HDRLOG_COOKIE            (0x1c849303UL | 0x10)
+#define HDRLOG_COMPRESSED_COOKIE (0x1c849304UL | 0x10)
+#define HDRLOG_HEADER_SIZE 40
+
+// Largest encoded histogram: the header, then up to 5 bytes per counter
+#define HDRLOG_PAYLOAD_SIZE ((HDRLOG_HEADER_SIZE) + 5 * (HIST_COUNTS_LEN))
+
+// Zlib adds a 2-byte header, 5 bytes per stored block, and a checksum
+#define HDRLOG_ZLIB_SIZE ((HDRLOG_PAYLOAD_SIZE) + 2 + 5 + 4)
+
+// Compressed encoding: a cookie and length, then the zlib stream
+#define HDRLOG_COMPRESSED_SIZE (8 + (HDRLOG_ZLIB_SIZE))
+
+// Longest log line, Base64 encoding included
+#define HDRLOG_LINE_LEN (128 + 4 * (((HDRLOG_COMPRESSED_SIZE) + 2) / 3))
+
+// How often to write a histogram, in seconds
+#define HDRLOG_INTERVAL 60
+
+// How many histograms one log can hold
+#define HDRLOG_MAX_SOURCES 4
+
+// Log file name, in the same directory as the clock itself
+#define HDRLOG_FILE_NAME CTEXT("uclock.hlog")
+
+// A histogram to be logged
+typedef struct tagHDRLOGSOURCE {
+    const char *tag;            // what it measures; no commas or spaces
+    HISTOGRAM *histogram;
+    HISTSNAPSHOT last;          // as of the end of the last interval
+} HDRLOGSOURCE;
+
+typedef struct tagHDRLOG {
+    THREAD thread;
+    atomic_int fStop;
+    unsigned long interval;     // in seconds
+    unsigned long long start;   // wall time the current interval started
+    int cSources;
+    HDRLOGSOURCE sources[HDRLOG_MAX_SOURCES];
+    CCHAR szPath[260];
+    HISTSNAPSHOT snapshot;      // scratch space for the log thread
+    char szLine[HDRLOG_LINE_LEN];
+} HDRLOG;
+
+int AddHdrLogSource(HDRLOG *log, const char *tag, HISTOGRAM *histogram);
+int StartHdrLog(HDRLOG *log, const CCHAR *path, unsigned long interval);
+void StopHdrLog(HDRLOG *log);
+
+size_t EncodeHistogram(unsigned char *buf, const HISTSNAPSHOT *snapshot);
+size_t CompressHistogram(unsigned char *buf, const HISTSNAPSHOT *snapshot);
+size_t FormatHdrLogLine(char *sz, const char *tag,
+                        unsigned long long start, unsigned long long end,
+                        const HISTSNAPSHOT *snapshot);
+
+#endif /* HDRLOG_H */
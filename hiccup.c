@@ -0,0 +1,150 @@
+/*
+ * Hiccup meter for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "hiccup.h"
+#include "timestamp.h"
+
+static void ProbeHiccups(void *arg);
+static CCHAR *AppendString(CCHAR *p, const CCHAR *s);
+static CCHAR *AppendMsec(CCHAR *p, unsigned long long usec);
+
+/*
+ * Start measuring hiccups, sampling every interval microseconds.
+ * The probe is pinned to the specified CPU, unless it's HICCUP_ANY_CPU.
+ * Returns 0 on success, -1 if the probe thread couldn't be started.
+ */
+int
+StartHiccupMeter(HICCUPMETER *meter, unsigned long interval, int cpu)
+{
+    InitHistogram(&meter->histogram);
+    InitEventRing(&meter->events);
+    atomic_init(&meter->fStop, 0);
+    meter->interval = interval;
+    meter->cpu = cpu;
+    return StartThread(&meter->thread, ProbeHiccups, meter);
+}
+
+/*
+ * Stop measuring hiccups.
+ * The histogram remains readable afterward.
+ */
+void
+StopHiccupMeter(HICCUPMETER *meter)
+{
+    atomic_store(&meter->fStop, 1);
+    JoinThread(&meter->thread);
+}
+
+/*
+ * Format a line summarizing a latency histogram, like:
+ *   Hiccups: 99% 0.1 ms, 99.9% 0.4 ms, max 12.3 ms
+ * sz must have room for STATUS_LEN characters.
+ * Returns the length of the formatted string.
+ */
+int
+FormatLatencies(CCHAR *sz, const CCHAR *label, const HISTSNAPSHOT *snapshot)
+{
+    CCHAR *p = sz;
+
+    // Built by hand since swprintf() and snprintf() disagree on %s
+    p = AppendString(p, label);
+    p = AppendString(p, CTEXT(": 99% "));
+    p = AppendMsec(p, GetValueAtPercentile(snapshot, 99.0));
+    p = AppendString(p, CTEXT(", 99.9% "));
+    p = AppendMsec(p, GetValueAtPercentile(snapshot, 99.9));
+    p = AppendString(p, CTEXT(", max "));
+    p = AppendMsec(p, snapshot->maxValue);
+    *p = 0;
+    return (int) (p - sz);
+}
+
+/*
+ * Body of the probe thread.
+ */
+void
+ProbeHiccups(void *arg)
+{
+    HICCUPMETER *meter = arg;
+    EVENTRECORD event;
+    unsigned long long start, end, elapsed, shortest;
+
+    if (meter->cpu != HICCUP_ANY_CPU)
+        PinThreadToCPU(meter->cpu);
+    RaiseThreadPriority();
+
+    // The shortest sleep we've seen is our baseline. This accounts for
+    // timer granularity, which on older Windows is as coarse as 15.6 ms.
+    shortest = ~0ULL;
+    while (!atomic_load_explicit(&meter->fStop, memory_order_relaxed)) {
+        start = GetTimestamp();
+        SleepMicroseconds(meter->interval);
+        end = GetTimestamp();
+
+        // Skip this one if the timestamps went backward, like if they
+        // just switched sources, so we don't lose our baseline
+        if (end < start)
+            continue;
+        elapsed = end - start;
+
+        if (elapsed < shortest)
+            shortest = elapsed;
+        RecordCorrectedValue(&meter->histogram, elapsed - shortest, shortest);
+
+        // Let the user interface know about anything it might show
+        if (elapsed - shortest >= HICCUP_STALL_THRESHOLD) {
+            event.type = EVENT_STALL;
+            event.source = meter->cpu;
+            event.wallTime = GetWallTime();
+            event.amount = (long long) (elapsed - shortest);
+            PostEvent(&meter->events, &event);
+        }
+    }
+}
+
+CCHAR *
+AppendString(CCHAR *p, const CCHAR *s)
+{
+    while (*s)
+        *p++ = *s++;
+    return p;
+}
+
+/*
+ * Append a time in microseconds as milliseconds with one decimal place.
+ */
+CCHAR *
+AppendMsec(CCHAR *p, unsigned long long usec)
+{
+    CCHAR digits[24];
+    unsigned long long tenths;
+    int i = 0;
+
+    // Round to the nearest tenth of a millisecond
+    tenths = (usec + 50) / 100;
+    digits[i++] = CTEXT('0') + tenths % 10;
+    tenths /= 10;
+    do {
+        digits[i++] = CTEXT('0') + tenths % 10;
+        tenths /= 10;
+    } while (tenths > 0);
+
+    while (i > 1)
+        *p++ = digits[--i];
+    *p++ = CTEXT('.');
+    *p++ = digits[0];
+    return AppendString(p, CTEXT(" ms"));
+}
@@ -0,0 +1,65 @@
+/*
+ * Hiccup meter for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A hiccup meter runs a probe thread that does nothing but sleep for a
+ * short fixed interval and check how long it actually slept. Anything
+ * past the shortest sleep it has seen is time the system wasn't running
+ * it -- a hiccup -- and goes into a histogram. The idea comes from
+ * jHiccup: a stall the probe sees is one every other program would have
+ * seen too.
+ */
+
+#ifndef HICCUP_H
+#define HICCUP_H
+
+#include <stdatomic.h>
+
+#include "clockcore.h"
+#include "eventring.h"
+#include "histogram.h"
+#include "thread.h"
+
+// How long the probe sleeps between samples, in microseconds
+#define HICCUP_INTERVAL 1000
+
+// Hiccups at least this long are posted as events, in microseconds
+#define HICCUP_STALL_THRESHOLD 100000
+
+// Let the probe run on any CPU
+#define HICCUP_ANY_CPU (-1)
+
+// Hiccups: 99% 1234.5 ms, 99.9% 1234.5 ms, max 1234.5 ms
+#define HICCUP_LABEL CTEXT("Hiccups")
+
+// Aligned so meters for different CPUs never share a cache line
+typedef struct tagHICCUPMETER {
+    _Alignas(CACHE_LINE_SIZE) HISTOGRAM histogram;
+    THREAD thread;
+    atomic_int fStop;
+    unsigned long interval;     // probe interval in microseconds
+    int cpu;                    // CPU the probe runs on, or HICCUP_ANY_CPU
+    EVENTRING events;           // stalls for the user interface
+} HICCUPMETER;
+
+int StartHiccupMeter(HICCUPMETER *meter, unsigned long interval, int cpu);
+void StopHiccupMeter(HICCUPMETER *meter);
+
+int FormatLatencies(CCHAR *sz, const CCHAR *label,
+                    const HISTSNAPSHOT *snapshot);
+
+#endif /* HICCUP_H */
@@ -0,0 +1,167 @@
+/*
+ * Latency histograms for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "histogram.h"
+
+/*
+ * Initialize an empty histogram.
+ */
+void
+InitHistogram(HISTOGRAM *histogram)
+{
+    int i;
+
+    for (i = 0; i < HIST_COUNTS_LEN; ++i)
+        atomic_init(&histogram->counts[i], 0);
+    atomic_init(&histogram->maxValue, 0);
+}
+
+/*
+ * Record a value in the histogram.
+ * Values above HIST_HIGHEST are recorded as HIST_HIGHEST.
+ */
+void
+RecordValue(HISTOGRAM *histogram, unsigned long long value)
+{
+    atomic_uint *count;
+
+    if (value > HIST_HIGHEST)
+        value = HIST_HIGHEST;
+
+    // We're the only writer, so we don't need an atomic increment
+    count = &histogram->counts[GetCountsIndex(value)];
+    atomic_store_explicit(count,
+                          atomic_load_explicit(count, memory_order_relaxed)
+                          + 1,
+                          memory_order_relaxed);
+
+    if (value > atomic_load_explicit(&histogram->maxValue,
+                                     memory_order_relaxed))
+        atomic_store_explicit(&histogram->maxValue, value,
+                              memory_order_relaxed);
+}
+
+/*
+ * Record a value, correcting for coordinated omission.
+ *
+ * A probe that expects to take a sample every expectedInterval but was
+ * stalled for value missed the samples it would have taken during the
+ * stall. Like HdrHistogram, we fill those in, since otherwise one long
+ * stall counts the same as one short one in the percentiles.
+ */
+void
+RecordCorrectedValue(HISTOGRAM *histogram, unsigned long long value,
+                     unsigned long long expectedInterval)
+{
+    unsigned long long missing;
+
+    // Clamp first, or a wild value would take forever to fill in
+    if (value > HIST_HIGHEST)
+        value = HIST_HIGHEST;
+
+    RecordValue(histogram, value);
+    if (expectedInterval == 0 || value <= expectedInterval)
+        return;
+
+    for (missing = value - expectedInterval;
+         missing >= expectedInterval;
+         missing -= expectedInterval)
+        RecordValue(histogram, missing);
+}
+
+/*
+ * Take a snapshot of the histogram.
+ */
+void
+SnapshotHistogram(HISTOGRAM *histogram, HISTSNAPSHOT *snapshot)
+{
+    int i;
+
+    snapshot->totalCount = 0;
+    for (i = 0; i < HIST_COUNTS_LEN; ++i) {
+        snapshot->counts[i] = atomic_load_explicit(&histogram->counts[i],
+                                                   memory_order_relaxed);
+        snapshot->totalCount += snapshot->counts[i];
+    }
+    snapshot->maxValue = atomic_load_explicit(&histogram->maxValue,
+                                              memory_order_relaxed);
+}
+
+/*
+ * Return the value at the specified percentile (0 to 100).
+ * Like HdrHistogram, this is the highest value that's equivalent to the
+ * recorded ones at the histogram's precision.
+ */
+unsigned long long
+GetValueAtPercentile(const HISTSNAPSHOT *snapshot, double percentile)
+{
+    unsigned long long target, total, value;
+    int i;
+
+    if (snapshot->totalCount == 0)
+        return 0;
+
+    if (percentile > 100.0)
+        percentile = 100.0;
+    target = (unsigned long long)
+        (percentile / 100.0 * snapshot->totalCount + 0.5);
+    if (target < 1)
+        target = 1;
+
+    for (i = 0, total = 0; i < HIST_COUNTS_LEN; ++i) {
+        total += snapshot->counts[i];
+        if (total >= target) {
+            // The next index starts just past this one's range
+            value = GetValueFromIndex(i + 1) - 1;
+            return (value < snapshot->maxValue) ? value : snapshot->maxValue;
+        }
+    }
+
+    return snapshot->maxValue;
+}
+
+/*
+ * Return the index of the counter for the specified value.
+ */
+int
+GetCountsIndex(unsigned long long value)
+{
+    int pow2ceiling, bucket, subBucket;
+
+    pow2ceiling = 64 - __builtin_clzll(value | HIST_SUB_BUCKET_MASK);
+    bucket = pow2ceiling - (HIST_SUB_BUCKET_HALF_MAG + 1);
+    subBucket = (int) (value >> bucket);
+    return ((bucket + 1) << HIST_SUB_BUCKET_HALF_MAG)
+           + (subBucket - HIST_SUB_BUCKET_HALF);
+}
+
+/*
+ * Return the lowest value counted at the specified index.
+ */
+unsigned long long
+GetValueFromIndex(int index)
+{
+    int bucket, subBucket;
+
+    bucket = (index >> HIST_SUB_BUCKET_HALF_MAG) - 1;
+    subBucket = (index & (HIST_SUB_BUCKET_HALF - 1)) + HIST_SUB_BUCKET_HALF;
+    if (bucket < 0) {
+        subBucket -= HIST_SUB_BUCKET_HALF;
+        bucket = 0;
+    }
+    return (unsigned long long) subBucket << bucket;
+}
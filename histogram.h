@@ -0,0 +1,70 @@
+/*
+ * Latency histograms for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Log-bucketed histograms of latencies in microseconds, laid out the same
+ * way as HdrHistogram with two significant digits: values up to 255 us are
+ * counted exactly, and each power of two above that is split into 128
+ * equal sub-buckets.
+ *
+ * Each histogram may have only one writer, which records values with
+ * plain atomic loads and stores -- no locks, no read-modify-write
+ * instructions, and no allocation -- so recording a value never makes the
+ * writer wait. Readers take a snapshot, which may be off by the values
+ * recorded while it's being taken, but is otherwise consistent.
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdatomic.h>
+
+#define HIST_SIGNIFICANT_DIGITS 2
+#define HIST_SUB_BUCKET_HALF_MAG 7
+#define HIST_SUB_BUCKET_HALF    (1 << (HIST_SUB_BUCKET_HALF_MAG))
+#define HIST_SUB_BUCKET_COUNT   (2 * (HIST_SUB_BUCKET_HALF))
+#define HIST_SUB_BUCKET_MASK    ((HIST_SUB_BUCKET_COUNT) - 1)
+#define HIST_LOWEST             1ULL
+#define HIST_HIGHEST            3600000000ULL   // one hour
+#define HIST_BUCKET_COUNT       25              // enough to hold the above
+#define HIST_COUNTS_LEN \
+    (((HIST_BUCKET_COUNT) + 1) * (HIST_SUB_BUCKET_HALF))
+
+typedef struct tagHISTOGRAM {
+    atomic_uint counts[HIST_COUNTS_LEN];
+    atomic_ullong maxValue;
+} HISTOGRAM;
+
+// A reader's copy of a histogram
+typedef struct tagHISTSNAPSHOT {
+    unsigned int counts[HIST_COUNTS_LEN];
+    unsigned long long totalCount;
+    unsigned long long maxValue;
+} HISTSNAPSHOT;
+
+void InitHistogram(HISTOGRAM *histogram);
+void RecordValue(HISTOGRAM *histogram, unsigned long long value);
+void RecordCorrectedValue(HISTOGRAM *histogram, unsigned long long value,
+                          unsigned long long expectedInterval);
+
+void SnapshotHistogram(HISTOGRAM *histogram, HISTSNAPSHOT *snapshot);
+unsigned long long GetValueAtPercentile(const HISTSNAPSHOT *snapshot,
+                                        double percentile);
+int GetCountsIndex(unsigned long long value);
+unsigned long long GetValueFromIndex(int index);
+
+#endif /* HISTOGRAM_H */
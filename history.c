@@ -0,0 +1,568 @@
+/*
+ * Compressed tick history for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef _WIN32
+#  define WINVER 0x400
+#  include <windows.h>
+#else
+#  define _GNU_SOURCE
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+#include <stddef.h> // for offsetof()
+#include <string.h> // for memset()
+
+#include "history.h"
+
+_Static_assert(sizeof(HISTORYBLOCK) == HISTORY_BLOCK_SIZE,
+               "history blocks must be exactly HISTORY_BLOCK_SIZE bytes");
+_Static_assert(offsetof(HISTORYBLOCK, data) == HISTORY_HEADER_SIZE,
+               "history block data must start after HISTORY_HEADER_SIZE");
+
+static int MeasureDod(long long dod);
+static void PutDod(HISTORYBLOCK *block, long long dod);
+static int GetDod(HISTORYCURSOR *cursor, long long *dod);
+static void PutBits(HISTORYBLOCK *block, unsigned long long value, int n);
+static int GetBits(HISTORYCURSOR *cursor, int n, unsigned long long *value);
+
+static int ReadHistoryBlock(HISTORYFILE *history, long iBlock,
+                            HISTORYBLOCK *block);
+static int WriteHistoryBlock(HISTORYFILE *history);
+
+/*
+ * Start a new block with the specified sample.
+ */
+void
+StartHistoryBlock(HISTORYENCODER *encoder, const HISTORYSAMPLE *sample)
+{
+    memset(&encoder->block, 0, sizeof(HISTORYBLOCK));
+    encoder->block.magic = HISTORY_MAGIC;
+    encoder->block.count = 1;
+    encoder->block.first = *sample;
+    encoder->block.last = *sample;
+    encoder->block.minTime = sample->time;
+    encoder->block.maxTime = sample->time;
+
+    encoder->last = *sample;
+    encoder->deltaTime = 1;
+    encoder->deltaUptime = 1;
+}
+
+/*
+ * Prepare to add more samples to the encoder's existing block, such as
+ * one just read from disk.
+ * Returns 0 on success, -1 if the block is damaged.
+ */
+int
+ResumeHistoryBlock(HISTORYENCODER *encoder)
+{
+    HISTORYCURSOR cursor;
+    HISTORYSAMPLE sample;
+
+    if (encoder->block.magic != HISTORY_MAGIC
+        || encoder->block.count == 0
+        || encoder->block.cBits > HISTORY_DATA_BITS)
+        return -1;
+
+    // Decode the whole block to find where we left off
+    StartHistoryCursor(&cursor, &encoder->block);
+    while (NextHistorySample(&cursor, &sample) == 0)
+        ;
+    if (cursor.index != encoder->block.count
+        || cursor.bit != encoder->block.cBits
+        || cursor.last.time != encoder->block.last.time
+        || cursor.last.uptime != encoder->block.last.uptime)
+        return -1;
+
+    encoder->last = cursor.last;
+    encoder->deltaTime = cursor.deltaTime;
+    encoder->deltaUptime = cursor.deltaUptime;
+    return 0;
+}
+
+/*
+ * Add a sample to the encoder's block.
+ * Returns 0 on success, -1 if it doesn't fit and needs a new block.
+ */
+int
+EncodeHistorySample(HISTORYENCODER *encoder, const HISTORYSAMPLE *sample)
+{
+    HISTORYBLOCK *block = &encoder->block;
+    long long deltaTime, deltaUptime, dodTime, dodUptime, gap;
+    int cBitsTime, cBitsUptime;
+
+    deltaTime = sample->time - encoder->last.time;
+    deltaUptime = sample->uptime - encoder->last.uptime;
+    dodTime = deltaTime - encoder->deltaTime;
+    dodUptime = deltaUptime - encoder->deltaUptime;
+
+    if (dodTime == 0 && dodUptime == 0) {
+        // The usual case
+        if (block->cBits + 1 > HISTORY_DATA_BITS)
+            return -1;
+        PutBits(block, 0, 1);
+    } else {
+        cBitsTime = MeasureDod(dodTime);
+        cBitsUptime = MeasureDod(dodUptime);
+        if (cBitsTime < 0 || cBitsUptime < 0
+            || block->cBits + 1 + cBitsTime + cBitsUptime > HISTORY_DATA_BITS)
+            return -1;
+        PutBits(block, 1, 1);
+        PutDod(block, dodTime);
+        PutDod(block, dodUptime);
+    }
+
+    // Keep the index up to date
+    gap = GetHistoryGap(&encoder->last, sample);
+    if (gap > block->maxGap)
+        block->maxGap = (gap < 0xFFFFFFFFLL) ? (unsigned int) gap : 0xFFFFFFFF;
+    if (sample->time < block->minTime)
+        block->minTime = sample->time;
+    if (sample->time > block->maxTime)
+        block->maxTime = sample->time;
+    block->last = *sample;
+
+    ++block->count;
+    encoder->last = *sample;
+    encoder->deltaTime = deltaTime;
+    encoder->deltaUptime = deltaUptime;
+    return 0;
+}
+
+/*
+ * Prepare to read the samples in a block.
+ */
+void
+StartHistoryCursor(HISTORYCURSOR *cursor, const HISTORYBLOCK *block)
+{
+    cursor->block = block;
+    cursor->index = 0;
+    cursor->bit = 0;
+    cursor->deltaTime = 1;
+    cursor->deltaUptime = 1;
+}
+
+/*
+ * Read the next sample from a block.
+ * Returns 0 on success, -1 at the end of the block or if it's damaged.
+ */
+int
+NextHistorySample(HISTORYCURSOR *cursor, HISTORYSAMPLE *sample)
+{
+    unsigned long long control;
+    long long dodTime, dodUptime;
+
+    if (cursor->index >= cursor->block->count)
+        return -1;
+
+    if (cursor->index == 0) {
+        cursor->last = cursor->block->first;
+    } else {
+        if (GetBits(cursor, 1, &control) != 0)
+            return -1;
+        if (control == 0) {
+            dodTime = dodUptime = 0;
+        } else if (GetDod(cursor, &dodTime) != 0
+                   || GetDod(cursor, &dodUptime) != 0) {
+            return -1;
+        }
+
+        cursor->deltaTime += dodTime;
+        cursor->deltaUptime += dodUptime;
+        cursor->last.time += cursor->deltaTime;
+        cursor->last.uptime += cursor->deltaUptime;
+    }
+
+    ++cursor->index;
+    *sample = cursor->last;
+    return 0;
+}
+
+/*
+ * Return how long the clock went without ticking between two samples,
+ * in seconds.
+ */
+long long
+GetHistoryGap(const HISTORYSAMPLE *before, const HISTORYSAMPLE *after)
+{
+    long long gap;
+
+    if (after->uptime >= before->uptime)
+        return after->uptime - before->uptime;
+
+    // The system restarted, so all we have to go on is the wall clock
+    gap = after->time - before->time;
+    return (gap > 0) ? gap : 0;
+}
+
+/*
+ * Return nonzero if the gap between two samples is one a query is
+ * looking for: longer than its threshold, and overlapping its time range.
+ */
+int
+MatchHistoryGap(const HISTORYQUERY *query, const HISTORYSAMPLE *before,
+                const HISTORYSAMPLE *after)
+{
+    return GetHistoryGap(before, after) > query->threshold
+           && after->time >= query->start
+           && before->time <= query->end;
+}
+
+/*
+ * Return nonzero if a block might have gaps a query is looking for,
+ * going only by its header.
+ */
+int
+MayMatchHistoryBlock(const HISTORYQUERY *query, const HISTORYBLOCK *block)
+{
+    return block->magic == HISTORY_MAGIC
+           && block->maxGap > query->threshold
+           && block->maxTime >= query->start
+           && block->minTime <= query->end;
+}
+
+/*
+ * Call proc for each gap in a block a query is looking for.
+ * This doesn't include the gap before the block's first sample.
+ * Returns the number of gaps found, or -1 if the block is damaged.
+ */
+int
+ScanHistoryBlock(const HISTORYQUERY *query, const HISTORYBLOCK *block,
+                 HISTORYGAPPROC proc, void *arg)
+{
+    HISTORYCURSOR cursor;
+    HISTORYSAMPLE before, after;
+    int cFound = 0;
+
+    if (!MayMatchHistoryBlock(query, block))
+        return 0;
+
+    StartHistoryCursor(&cursor, block);
+    if (NextHistorySample(&cursor, &before) != 0)
+        return -1;
+    while (NextHistorySample(&cursor, &after) == 0) {
+        if (MatchHistoryGap(query, &before, &after)) {
+            proc(&before, &after, arg);
+            ++cFound;
+        }
+        before = after;
+    }
+
+    return (cursor.index == block->count) ? cFound : -1;
+}
+
+/*
+ * Open a history file, creating it if it doesn't exist.
+ * New samples are added to the end of an existing file.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+OpenHistory(HISTORYFILE *history, const CCHAR *path)
+{
+    long cBlocks;
+#ifndef _WIN32
+    struct stat st;
+#endif
+
+    memset(history, 0, sizeof(HISTORYFILE));
+    history->phase = -1;
+
+#ifdef _WIN32
+    history->hFile = CreateFile(path, GENERIC_READ | GENERIC_WRITE,
+                                FILE_SHARE_READ, NULL, OPEN_ALWAYS,
+                                FILE_ATTRIBUTE_NORMAL, NULL);
+    if (history->hFile == INVALID_HANDLE_VALUE) {
+        history->hFile = NULL;
+        return -1;
+    }
+    cBlocks = GetFileSize(history->hFile, NULL) / HISTORY_BLOCK_SIZE;
+#else
+    history->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (history->fd == -1)
+        return -1;
+    if (fstat(history->fd, &st) != 0) {
+        CloseHistory(history);
+        return -1;
+    }
+    cBlocks = st.st_size / HISTORY_BLOCK_SIZE;
+#endif
+
+    // Pick up where we left off in the last block, or else overwrite it
+    // if it's damaged; AppendHistory() starts a new one when it's full
+    history->iBlock = cBlocks;
+    if (cBlocks > 0) {
+        history->iBlock = cBlocks - 1;
+        if (ReadHistoryBlock(history, history->iBlock,
+                             &history->encoder.block) != 0
+            || ResumeHistoryBlock(&history->encoder) != 0)
+            history->encoder.block.count = 0;
+    }
+
+    return 0;
+}
+
+/*
+ * Close a history file, writing out anything that's left.
+ * This is safe to call on a history that failed to open.
+ */
+void
+CloseHistory(HISTORYFILE *history)
+{
+    if (history->cUnflushed > 0)
+        WriteHistoryBlock(history);
+
+#ifdef _WIN32
+    if (history->hFile != NULL)
+        CloseHandle(history->hFile);
+#else
+    if (history->fd != -1)
+        close(history->fd);
+#endif
+
+    memset(history, 0, sizeof(HISTORYFILE));
+#ifndef _WIN32
+    history->fd = -1;
+#endif
+}
+
+/*
+ * Add a tick to the history.
+ *
+ * The current block is kept in memory and written out in place every
+ * HISTORY_FLUSH_INTERVAL ticks, and again when it fills up, so this is
+ * normally a single bit's worth of work.
+ *
+ * Ticks land at some fixed number of milliseconds past a second of
+ * uptime, give or take a little jitter. Simply truncating the uptime would
+ * turn that jitter into gaps of zero and two seconds when the phase is
+ * near a second boundary, so instead we round to the nearest second
+ * counting from the phase of the first tick.
+ */
+void
+AppendHistory(HISTORYFILE *history, const CLOCKSTATE *state)
+{
+    HISTORYENCODER *encoder = &history->encoder;
+    HISTORYSAMPLE sample;
+
+#ifdef _WIN32
+    if (history->hFile == NULL)
+        return;
+#else
+    if (history->fd == -1)
+        return;
+#endif
+
+    if (history->phase < 0)
+        history->phase = state->ticks % MSEC_PER_SEC;
+    sample.time = state->now;
+    sample.uptime = ((long long) state->ticks - history->phase
+                     + MSEC_PER_SEC / 2) / MSEC_PER_SEC;
+
+    if (encoder->block.count == 0) {
+        StartHistoryBlock(encoder, &sample);
+    } else if (EncodeHistorySample(encoder, &sample) != 0) {
+        WriteHistoryBlock(history);
+        ++history->iBlock;
+        StartHistoryBlock(encoder, &sample);
+    }
+
+    if (++history->cUnflushed >= HISTORY_FLUSH_INTERVAL)
+        WriteHistoryBlock(history);
+}
+
+/*
+ * Return how many bits it takes to store a delta-of-delta,
+ * or -1 if it's too big.
+ */
+int
+MeasureDod(long long dod)
+{
+    if (dod == 0)
+        return 1;
+    else if (dod >= -64 && dod <= 63)
+        return 2 + 7;
+    else if (dod >= -256 && dod <= 255)
+        return 3 + 9;
+    else if (dod >= -2048 && dod <= 2047)
+        return 4 + 12;
+    else if (dod >= -2147483647LL - 1 && dod <= 2147483647LL)
+        return 4 + 32;
+    else
+        return -1;
+}
+
+/*
+ * Store a delta-of-delta that MeasureDod() says fits.
+ */
+void
+PutDod(HISTORYBLOCK *block, long long dod)
+{
+    switch (MeasureDod(dod)) {
+        case 1:
+            PutBits(block, 0x0, 1);
+            break;
+        case 2 + 7:
+            PutBits(block, 0x2, 2);
+            PutBits(block, dod, 7);
+            break;
+        case 3 + 9:
+            PutBits(block, 0x6, 3);
+            PutBits(block, dod, 9);
+            break;
+        case 4 + 12:
+            PutBits(block, 0xE, 4);
+            PutBits(block, dod, 12);
+            break;
+        default:
+            PutBits(block, 0xF, 4);
+            PutBits(block, dod, 32);
+            break;
+    }
+}
+
+/*
+ * Read a delta-of-delta.
+ * Returns 0 on success, -1 if the block is damaged.
+ */
+int
+GetDod(HISTORYCURSOR *cursor, long long *dod)
+{
+    static const int widths[] = { 0, 7, 9, 12, 32 };
+    unsigned long long bit, value;
+    int cOnes, width;
+
+    // Count the ones in the prefix, up to four
+    for (cOnes = 0; cOnes < 4; ++cOnes) {
+        if (GetBits(cursor, 1, &bit) != 0)
+            return -1;
+        if (bit == 0)
+            break;
+    }
+
+    width = widths[cOnes];
+    if (width == 0) {
+        *dod = 0;
+        return 0;
+    }
+    if (GetBits(cursor, width, &value) != 0)
+        return -1;
+
+    // Sign-extend
+    if (value & (1ULL << (width - 1)))
+        value |= ~0ULL << width;
+    *dod = (long long) value;
+    return 0;
+}
+
+/*
+ * Append the low n bits of value (up to 32) to a block.
+ */
+void
+PutBits(HISTORYBLOCK *block, unsigned long long value, int n)
+{
+    unsigned int offset, cFree, cTake;
+
+    while (n > 0) {
+        offset = block->cBits % 8;
+        cFree = 8 - offset;
+        cTake = ((unsigned) n < cFree) ? (unsigned) n : cFree;
+        block->data[block->cBits / 8] |=
+            ((value >> (n - cTake)) & ((1U << cTake) - 1))
+            << (cFree - cTake);
+        block->cBits += cTake;
+        n -= cTake;
+    }
+}
+
+/*
+ * Read the next n bits (up to 32) from a block.
+ * Returns 0 on success, -1 if that would go past the end of its data.
+ */
+int
+GetBits(HISTORYCURSOR *cursor, int n, unsigned long long *value)
+{
+    const HISTORYBLOCK *block = cursor->block;
+    unsigned int offset, cAvail, cTake;
+
+    if (cursor->bit + n > block->cBits)
+        return -1;
+
+    *value = 0;
+    while (n > 0) {
+        offset = cursor->bit % 8;
+        cAvail = 8 - offset;
+        cTake = ((unsigned) n < cAvail) ? (unsigned) n : cAvail;
+        *value = (*value << cTake)
+                 | ((block->data[cursor->bit / 8] >> (cAvail - cTake))
+                    & ((1U << cTake) - 1));
+        cursor->bit += cTake;
+        n -= cTake;
+    }
+    return 0;
+}
+
+/*
+ * Read a block from a history file.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+ReadHistoryBlock(HISTORYFILE *history, long iBlock, HISTORYBLOCK *block)
+{
+#ifdef _WIN32
+    DWORD cbRead;
+
+    if (SetFilePointer(history->hFile, iBlock * HISTORY_BLOCK_SIZE, NULL,
+                       FILE_BEGIN) == INVALID_SET_FILE_POINTER)
+        return -1;
+    return (ReadFile(history->hFile, block, HISTORY_BLOCK_SIZE, &cbRead, NULL)
+            && cbRead == HISTORY_BLOCK_SIZE) ? 0 : -1;
+#else
+    return (pread(history->fd, block, HISTORY_BLOCK_SIZE,
+                  (off_t) iBlock * HISTORY_BLOCK_SIZE)
+            == HISTORY_BLOCK_SIZE) ? 0 : -1;
+#endif
+}
+
+/*
+ * Write the current block to its place in the history file.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+WriteHistoryBlock(HISTORYFILE *history)
+{
+    const HISTORYBLOCK *block = &history->encoder.block;
+#ifdef _WIN32
+    DWORD cbWritten;
+#endif
+
+    history->cUnflushed = 0;
+
+#ifdef _WIN32
+    if (SetFilePointer(history->hFile, history->iBlock * HISTORY_BLOCK_SIZE,
+                       NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER)
+        return -1;
+    return (WriteFile(history->hFile, block, HISTORY_BLOCK_SIZE, &cbWritten,
+                      NULL)
+            && cbWritten == HISTORY_BLOCK_SIZE) ? 0 : -1;
+#else
+    return (pwrite(history->fd, block, HISTORY_BLOCK_SIZE,
+                   (off_t) history->iBlock * HISTORY_BLOCK_SIZE)
+            == HISTORY_BLOCK_SIZE) ? 0 : -1;
+#endif
+}
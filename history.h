@@ -0,0 +1,147 @@
+/*
+ * Compressed tick history for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The tick journal only holds the last day. For long-term history, we
+ * store the wall clock time and uptime of every tick, to the second, in a
+ * compressed format borrowed from Facebook's Gorilla time series database.
+ *
+ * The file is a series of fixed-size blocks. Each starts with a header
+ * holding its first sample; every sample after that is stored as the
+ * change in the time and uptime deltas from the previous one, which is
+ * almost always zero for both since each tick is one second after the
+ * last. That case costs a single bit, so a year of ticks fits in about
+ * four megabytes. Anything else -- a freeze, a clock change, a reboot --
+ * costs a bit more, as follows:
+ *
+ *   0                      both deltas are unchanged
+ *   1 <dod> <dod>          otherwise, the time then the uptime, each:
+ *     0                    unchanged
+ *     10   + 7-bit value   -64 to 63
+ *     110  + 9-bit value   -256 to 255
+ *     1110 + 12-bit value  -2048 to 2047
+ *     1111 + 32-bit value  anything else that fits
+ *
+ * Values are two's complement, and bits are packed most significant
+ * first. The delta before a block's first sample is taken to be one
+ * second for both, so a normal second costs one bit from the start.
+ *
+ * The header also holds the block's last sample, the range of times in
+ * it, and the longest gap between its samples. That's enough of an index
+ * to answer "when did the clock stop ticking" without decoding the
+ * blocks that can't have the answer, so a query over a year of history
+ * only has to decode the blocks where something actually happened.
+ *
+ * A gap is how long the clock went without ticking: the change in the
+ * uptime between samples, or if it went backward (a reboot), the change
+ * in the wall clock time. A normal second is a gap of one.
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "clockcore.h"
+
+#define HISTORY_MAGIC       0x32484355UL    // "UCH2" in little-endian order
+#define HISTORY_BLOCK_SIZE  4096
+#define HISTORY_HEADER_SIZE 64
+#define HISTORY_DATA_BITS   (((HISTORY_BLOCK_SIZE) - (HISTORY_HEADER_SIZE)) * 8)
+
+// Write the current block to disk this often, in ticks
+#define HISTORY_FLUSH_INTERVAL 60
+
+// History file name, in the same directory as the clock itself
+#define HISTORY_FILE_NAME CTEXT("uclock.hst")
+
+// A single tick's worth of history
+typedef struct tagHISTORYSAMPLE {
+    long long time;             // wall clock time, in seconds
+    long long uptime;           // uptime, in seconds
+} HISTORYSAMPLE;
+
+typedef struct tagHISTORYBLOCK {
+    unsigned int magic;
+    unsigned int count;         // number of samples in the block
+    unsigned int cBits;         // number of data bits used
+    unsigned int maxGap;        // longest gap between samples, in seconds
+    HISTORYSAMPLE first;
+    HISTORYSAMPLE last;
+    long long minTime, maxTime; // range of wall clock times
+    unsigned char data[HISTORY_BLOCK_SIZE - HISTORY_HEADER_SIZE];
+} HISTORYBLOCK;
+
+// Gaps to look for in the history
+typedef struct tagHISTORYQUERY {
+    long long start, end;       // wall clock time range, in seconds
+    long long threshold;        // report gaps longer than this, in seconds
+} HISTORYQUERY;
+
+// Called with the samples on either side of each gap found
+typedef void (*HISTORYGAPPROC)(const HISTORYSAMPLE *before,
+                               const HISTORYSAMPLE *after, void *arg);
+
+// Compresses samples into a block
+typedef struct tagHISTORYENCODER {
+    HISTORYBLOCK block;
+    HISTORYSAMPLE last;
+    long long deltaTime, deltaUptime;
+} HISTORYENCODER;
+
+// Reads samples back out of a block
+typedef struct tagHISTORYCURSOR {
+    const HISTORYBLOCK *block;
+    unsigned int index;         // of the next sample
+    unsigned int bit;           // of the next sample's data
+    HISTORYSAMPLE last;
+    long long deltaTime, deltaUptime;
+} HISTORYCURSOR;
+
+// History file being appended to
+typedef struct tagHISTORYFILE {
+    HISTORYENCODER encoder;
+    long iBlock;                // where the encoder's block goes in the file
+    unsigned int cUnflushed;    // samples not yet written to disk
+    long long phase;            // msec past the second our ticks land on,
+                                // or -1 until the first tick
+#ifdef _WIN32
+    void *hFile;                // HANDLE; avoids including <windows.h>
+#else
+    int fd;
+#endif
+} HISTORYFILE;
+
+void StartHistoryBlock(HISTORYENCODER *encoder, const HISTORYSAMPLE *sample);
+int ResumeHistoryBlock(HISTORYENCODER *encoder);
+int EncodeHistorySample(HISTORYENCODER *encoder, const HISTORYSAMPLE *sample);
+
+void StartHistoryCursor(HISTORYCURSOR *cursor, const HISTORYBLOCK *block);
+int NextHistorySample(HISTORYCURSOR *cursor, HISTORYSAMPLE *sample);
+
+long long GetHistoryGap(const HISTORYSAMPLE *before,
+                        const HISTORYSAMPLE *after);
+int MatchHistoryGap(const HISTORYQUERY *query, const HISTORYSAMPLE *before,
+                    const HISTORYSAMPLE *after);
+int MayMatchHistoryBlock(const HISTORYQUERY *query,
+                         const HISTORYBLOCK *block);
+int ScanHistoryBlock(const HISTORYQUERY *query, const HISTORYBLOCK *block,
+                     HISTORYGAPPROC proc, void *arg);
+
+int OpenHistory(HISTORYFILE *history, const CCHAR *path);
+void CloseHistory(HISTORYFILE *history);
+void AppendHistory(HISTORYFILE *history, const CLOCKSTATE *state);
+
+#endif /* HISTORY_H */
@@ -0,0 +1,254 @@
+/*
+ * Memory-mapped tick journal for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef _WIN32
+#  define WINVER 0x400
+#  include <windows.h>
+#else
+#  define _GNU_SOURCE
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+#include <stdatomic.h>
+#include <string.h> // for memset()
+
+#include "journal.h"
+
+static void FlushTickJournal(TICKJOURNAL *journal);
+static unsigned long long FindLastSequence(const TICKJOURNAL *journal);
+
+/*
+ * Open a tick journal, creating it if it doesn't exist.
+ *
+ * An existing journal is kept, and new ticks are appended after the ones
+ * already in it, unless it's from an incompatible version or has a
+ * different capacity, in which case it's started over.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+OpenTickJournal(TICKJOURNAL *journal, const CCHAR *path,
+                unsigned int capacity)
+{
+    JOURNALHEADER *header;
+    TICKRECORD last;
+    int fValid;
+
+    memset(journal, 0, sizeof(TICKJOURNAL));
+    journal->size = sizeof(JOURNALHEADER) + capacity * sizeof(TICKRECORD);
+
+#ifdef _WIN32
+    journal->hFile = CreateFile(path, GENERIC_READ | GENERIC_WRITE,
+                                FILE_SHARE_READ, NULL, OPEN_ALWAYS,
+                                FILE_ATTRIBUTE_NORMAL, NULL);
+    if (journal->hFile == INVALID_HANDLE_VALUE) {
+        journal->hFile = NULL;
+        return -1;
+    }
+
+    // This also extends the file to the right size
+    journal->hMapping = CreateFileMapping(journal->hFile, NULL,
+                                          PAGE_READWRITE, 0,
+                                          (DWORD) journal->size, NULL);
+    if (journal->hMapping == NULL)
+        goto error;
+
+    header = MapViewOfFile(journal->hMapping, FILE_MAP_WRITE,
+                           0, 0, journal->size);
+    if (header == NULL)
+        goto error;
+#else
+    journal->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (journal->fd == -1)
+        return -1;
+    if (ftruncate(journal->fd, journal->size) != 0)
+        goto error;
+
+    header = mmap(NULL, journal->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  journal->fd, 0);
+    if (header == MAP_FAILED)
+        goto error;
+#endif
+
+    journal->header = header;
+    journal->records = (TICKRECORD *) (header + 1);
+
+    fValid = (header->magic == JOURNAL_MAGIC
+              && header->version == JOURNAL_VERSION
+              && header->recordSize == sizeof(TICKRECORD)
+              && header->capacity == capacity);
+    if (!fValid) {
+        memset(header, 0, journal->size);
+        header->version = JOURNAL_VERSION;
+        header->recordSize = sizeof(TICKRECORD);
+        header->capacity = capacity;
+        atomic_thread_fence(memory_order_release);
+        header->magic = JOURNAL_MAGIC;
+    }
+
+    // The header may not have caught up with the records before a crash
+    if (ReadLastTick(journal, &last) == 0)
+        header->sequence = last.sequence;
+
+    journal->flushed = header->sequence;
+    return 0;
+
+error:
+    CloseTickJournal(journal);
+    return -1;
+}
+
+/*
+ * Close a tick journal.
+ * This is safe to call on a journal that failed to open.
+ */
+void
+CloseTickJournal(TICKJOURNAL *journal)
+{
+    if (journal->header != NULL)
+        FlushTickJournal(journal);
+
+#ifdef _WIN32
+    if (journal->header != NULL)
+        UnmapViewOfFile(journal->header);
+    if (journal->hMapping != NULL)
+        CloseHandle(journal->hMapping);
+    if (journal->hFile != NULL)
+        CloseHandle(journal->hFile);
+#else
+    if (journal->header != NULL)
+        munmap(journal->header, journal->size);
+    if (journal->size != 0 && journal->fd != -1)
+        close(journal->fd);
+#endif
+
+    memset(journal, 0, sizeof(TICKJOURNAL));
+}
+
+/*
+ * Append a tick to the journal.
+ *
+ * This is just a handful of stores into the mapping. The record's
+ * sequence number is stored after the rest of it, and the header's after
+ * that, so a reader never mistakes a half-written record for a complete
+ * one. Once every JOURNAL_FLUSH_INTERVAL ticks, we also ask the OS to
+ * start writing the journal out, so a power cut loses at most that many.
+ */
+void
+AppendTick(TICKJOURNAL *journal, const CLOCKSTATE *state)
+{
+    JOURNALHEADER *header = journal->header;
+    TICKRECORD *record;
+    unsigned long long sequence;
+
+    if (header == NULL)
+        return;
+
+    sequence = header->sequence + 1;
+    record = &journal->records[(sequence - 1) % header->capacity];
+    record->wallTime = state->wallTime;
+    record->ticks = state->ticks;
+    record->lateness = state->lateness;
+    atomic_thread_fence(memory_order_release);
+    record->sequence = sequence;
+    atomic_thread_fence(memory_order_release);
+    header->sequence = sequence;
+
+    if (sequence - journal->flushed >= JOURNAL_FLUSH_INTERVAL)
+        FlushTickJournal(journal);
+}
+
+/*
+ * Find the most recent complete record in a journal.
+ * Returns 0 on success, -1 if the journal is empty.
+ */
+int
+ReadLastTick(const TICKJOURNAL *journal, TICKRECORD *record)
+{
+    const JOURNALHEADER *header = journal->header;
+    const TICKRECORD *newest;
+    unsigned long long sequence;
+    unsigned int i;
+
+    if (header == NULL)
+        return -1;
+
+    // The header usually tells us where it is
+    if ((sequence = FindLastSequence(journal)) == 0)
+        return -1;
+    newest = &journal->records[(sequence - 1) % header->capacity];
+    if (newest->sequence != sequence) {
+        // The header and the record disagree, so we crashed between
+        // writing the two to disk; look for the newest one ourselves
+        newest = NULL;
+        for (i = 0; i < header->capacity; ++i)
+            if (journal->records[i].sequence != 0
+                && (newest == NULL
+                    || journal->records[i].sequence > newest->sequence))
+                newest = &journal->records[i];
+        if (newest == NULL)
+            return -1;
+    }
+
+    *record = *newest;
+    return 0;
+}
+
+/*
+ * Find the sequence number of the newest record, according to the header.
+ *
+ * The header's sequence number is stored after the record's, and is only
+ * flushed every so often, so after a crash it can lag behind the records
+ * that did reach the disk. Any record in the slot after the header's with
+ * the next sequence number was written later, so follow those as far as
+ * they go.
+ */
+unsigned long long
+FindLastSequence(const TICKJOURNAL *journal)
+{
+    const JOURNALHEADER *header = journal->header;
+    unsigned long long sequence;
+    unsigned int i;
+
+    sequence = header->sequence;
+    atomic_thread_fence(memory_order_acquire);
+    for (i = 0; i < header->capacity; ++i) {
+        if (journal->records[sequence % header->capacity].sequence
+            != sequence + 1)
+            break;
+        ++sequence;
+    }
+    return sequence;
+}
+
+/*
+ * Start writing the journal's changes to disk without waiting for them.
+ */
+void
+FlushTickJournal(TICKJOURNAL *journal)
+{
+#ifdef _WIN32
+    FlushViewOfFile(journal->header, 0);
+#elif defined(__linux__)
+    sync_file_range(journal->fd, 0, journal->size, SYNC_FILE_RANGE_WRITE);
+#else
+    msync(journal->header, journal->size, MS_ASYNC);
+#endif
+    journal->flushed = journal->header->sequence;
+}
@@ -0,0 +1,84 @@
+/*
+ * Memory-mapped tick journal for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * When a machine hard-freezes and has to be power-cycled, the last time
+ * the clock displayed is exactly what we want to know. The journal keeps
+ * a record of each tick in a fixed-size ring buffer in a memory-mapped
+ * file, so the operating system writes it back for us from the page cache
+ * without a system call per tick.
+ *
+ * The file is a JOURNALHEADER followed by capacity TICKRECORDs, in native
+ * byte order. Each record carries its own sequence number, stored after
+ * the rest of the record, and the header holds the sequence number of the
+ * newest one. If the two disagree after a crash, a reader can still find
+ * the newest complete record by following the records past the header's,
+ * or failing that, by scanning for the highest sequence number.
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+
+#include "clockcore.h"
+
+#define JOURNAL_MAGIC    0x4A4B4355UL   // "UCKJ" in little-endian order
+#define JOURNAL_VERSION  1
+#define JOURNAL_CAPACITY 86400          // one day of ticks
+
+// Ask the OS to write the journal to disk this often, in ticks
+#define JOURNAL_FLUSH_INTERVAL 60
+
+// Journal file name, in the same directory as the clock itself
+#define JOURNAL_FILE_NAME CTEXT("uclock.jnl")
+
+typedef struct tagJOURNALHEADER {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int recordSize;    // sizeof(TICKRECORD)
+    unsigned int capacity;      // number of records in the ring
+    unsigned long long sequence;    // records ever written
+    unsigned char reserved[40]; // pad to 64 bytes
+} JOURNALHEADER;
+
+typedef struct tagTICKRECORD {
+    unsigned long long sequence;    // 1 for the first record, and so on
+    unsigned long long wallTime;    // microseconds since the Unix epoch
+    unsigned long long ticks;       // milliseconds since boot
+    long long lateness;             // microseconds
+} TICKRECORD;
+
+typedef struct tagTICKJOURNAL {
+    JOURNALHEADER *header;
+    TICKRECORD *records;
+    size_t size;                // size of the mapping in bytes
+    unsigned long long flushed; // sequence number as of the last flush
+#ifdef _WIN32
+    void *hFile, *hMapping;     // HANDLEs; avoids including <windows.h>
+#else
+    int fd;
+#endif
+} TICKJOURNAL;
+
+int OpenTickJournal(TICKJOURNAL *journal, const CCHAR *path,
+                    unsigned int capacity);
+void CloseTickJournal(TICKJOURNAL *journal);
+void AppendTick(TICKJOURNAL *journal, const CLOCKSTATE *state);
+int ReadLastTick(const TICKJOURNAL *journal, TICKRECORD *record);
+
+#endif /* JOURNAL_H */
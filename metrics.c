@@ -0,0 +1,762 @@
+/*
+ * OpenMetrics endpoint for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef _WIN32
+#  define FD_SETSIZE 128    // the default of 64 can't fit every connection
+#  include <winsock2.h> // must come before <windows.h>
+#  include <ws2tcpip.h>
+#else
+#  ifndef _GNU_SOURCE
+#    define _GNU_SOURCE // for pipe2()
+#  endif
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <arpa/inet.h>
+#  include <netinet/in.h>
+#  include <netinet/tcp.h>
+#  include <sys/select.h>
+#  include <sys/socket.h>
+#  ifdef __linux__
+#    include <sys/epoll.h>
+#  endif
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metrics.h"
+
+#if defined(_WIN32) && (FD_SETSIZE) < (METRICS_MAX_CONNECTIONS) + 1
+#  error "FD_SETSIZE is too small for METRICS_MAX_CONNECTIONS"
+#endif
+
+#ifdef _WIN32
+#  define CloseSocket(s) closesocket((SOCKET) (s))
+#  define IsWouldBlock() (WSAGetLastError() == WSAEWOULDBLOCK)
+#  define SEND_FLAGS 0
+typedef SOCKET SOCKETFD;
+#else
+#  define CloseSocket(s) close((int) (s))
+#  define IsWouldBlock() (errno == EAGAIN || errno == EWOULDBLOCK)
+#  define SEND_FLAGS MSG_NOSIGNAL
+typedef int SOCKETFD;
+#endif
+
+// Without a way to wake select(), how often it checks whether to stop
+#define SELECT_TIMEOUT 250000
+
+// epoll keys for things that aren't connections
+#define KEY_LISTENER (METRICS_MAX_CONNECTIONS)
+#define KEY_WAKE     ((METRICS_MAX_CONNECTIONS) + 1)
+
+#define CONTENT_TYPE \
+    "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+#define RESPONSE_404 \
+    "HTTP/1.1 404 Not Found\r\n" \
+    "Content-Type: text/plain\r\n" \
+    "Content-Length: 10\r\n\r\n" \
+    "Not found\n"
+
+#define RESPONSE_503 \
+    "HTTP/1.1 503 Service Unavailable\r\n" \
+    "Content-Length: 0\r\n\r\n"
+
+// Histogram bucket bounds, in microseconds and as written in seconds
+static const struct {
+    unsigned long long value;
+    const char *sz;
+} bucketBounds[] = {
+    { 100, "0.0001" },
+    { 250, "0.00025" },
+    { 500, "0.0005" },
+    { 1000, "0.001" },
+    { 2500, "0.0025" },
+    { 5000, "0.005" },
+    { 10000, "0.01" },
+    { 25000, "0.025" },
+    { 50000, "0.05" },
+    { 100000, "0.1" },
+    { 250000, "0.25" },
+    { 500000, "0.5" },
+    { 1000000, "1" },
+    { 2500000, "2.5" },
+    { 5000000, "5" },
+    { 10000000, "10" },
+};
+#define cBucketBounds (sizeof(bucketBounds) / sizeof(bucketBounds[0]))
+
+static void RunMetricServer(void *arg);
+#ifdef __linux__
+static void RunEpoll(METRICSERVER *server);
+static void WatchConn(METRICSERVER *server, METRICCONN *conn);
+#else
+static void RunSelect(METRICSERVER *server);
+#endif
+static METRICCONN *AcceptClient(METRICSERVER *server);
+static int ServeConn(METRICSERVER *server, METRICCONN *conn,
+                     int fReadable, int fWritable);
+static int Respond(METRICSERVER *server, METRICCONN *conn);
+static int SendResponse(METRICCONN *conn, const char *data, size_t len);
+static int FlushPending(METRICCONN *conn);
+static void CloseConn(METRICCONN *conn);
+static size_t FindRequestEnd(const METRICCONN *conn);
+static int SetNonBlocking(uintptr_t sock);
+static void FormatHistogram(char **p, char *end,
+                            const METRICHISTOGRAM *metric,
+                            const HISTSNAPSHOT *snapshot);
+static void Append(char **p, char *end, const char *fmt, ...);
+
+/*
+ * Add a histogram to publish.
+ * name is the metric name, which should end in _seconds.
+ * Returns 0 on success, -1 if the server already has too many.
+ */
+int
+AddMetricHistogram(METRICSERVER *server, const char *name,
+                   const char *help, HISTOGRAM *histogram)
+{
+    METRICHISTOGRAM *metric;
+
+    if (server->cHistograms >= METRICS_MAX_HISTOGRAMS)
+        return -1;
+
+    metric = &server->histograms[server->cHistograms++];
+    metric->name = name;
+    metric->help = help;
+    metric->histogram = histogram;
+    return 0;
+}
+
+/*
+ * Start serving metrics on the specified port on 127.0.0.1, or any free
+ * one if it's 0; either way, it's left in server->port.
+ * Until the first PublishMetrics(), scrapes are answered with a 503.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+StartMetricServer(METRICSERVER *server, unsigned short port)
+{
+    struct sockaddr_in addr;
+    socklen_t cbAddr = sizeof(addr);
+    SOCKETFD sock;
+    int i;
+#ifdef _WIN32
+    WSADATA wsaData;
+
+    // Winsock 1.1 has all we need, and comes with Windows 95
+    server->fWinsock = 0;
+    if (WSAStartup(MAKEWORD(1, 1), &wsaData) != 0)
+        return -1;
+    server->fWinsock = 1;
+#else
+    int one = 1;
+#endif
+
+    memset(&server->thread, 0, sizeof(server->thread));
+    atomic_init(&server->fStop, 0);
+    atomic_init(&server->published, -1);
+    atomic_init(&server->reading, -1);
+    server->fRunning = 1;
+    server->fHaveOffset = 0;
+    server->hEpoll = server->wakeFds[0] = server->wakeFds[1] = -1;
+    for (i = 0; i < METRICS_MAX_CONNECTIONS; ++i) {
+        server->conns[i].sock = METRICS_NO_SOCKET;
+        server->conns[i].pending = NULL;
+    }
+
+    sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    server->listener = (uintptr_t) sock;
+    if (server->listener == METRICS_NO_SOCKET)
+        goto fail;
+#ifndef _WIN32
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+#endif
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) != 0
+        || getsockname(sock, (struct sockaddr *) &addr, &cbAddr) != 0
+        || listen(sock, SOMAXCONN) != 0
+        || SetNonBlocking(server->listener) != 0)
+        goto fail;
+    server->port = ntohs(addr.sin_port);
+
+#ifdef __linux__
+    // The wake pipe tells the server thread to stop
+    if (pipe2(server->wakeFds, O_CLOEXEC | O_NONBLOCK) != 0)
+        goto fail;
+    server->hEpoll = epoll_create1(EPOLL_CLOEXEC);
+    if (server->hEpoll == -1)
+        goto fail;
+#endif
+
+    if (StartThread(&server->thread, RunMetricServer, server) != 0)
+        goto fail;
+    return 0;
+
+fail:
+    StopMetricServer(server);
+    return -1;
+}
+
+/*
+ * Stop serving metrics and close every connection.
+ * Does nothing if the server isn't running.
+ */
+void
+StopMetricServer(METRICSERVER *server)
+{
+    int i;
+
+    if (!server->fRunning)
+        return;
+
+    atomic_store(&server->fStop, 1);
+#ifdef __linux__
+    if (server->wakeFds[1] != -1 && write(server->wakeFds[1], "", 1) < 0)
+        ;   // the thread will see fStop anyway
+#endif
+    JoinThread(&server->thread);
+
+    for (i = 0; i < METRICS_MAX_CONNECTIONS; ++i)
+        CloseConn(&server->conns[i]);
+    if (server->listener != METRICS_NO_SOCKET)
+        CloseSocket(server->listener);
+    server->listener = METRICS_NO_SOCKET;
+
+#ifdef _WIN32
+    if (server->fWinsock)
+        WSACleanup();
+    server->fWinsock = 0;
+#else
+    for (i = 0; i < 2; ++i)
+        if (server->wakeFds[i] != -1)
+            close(server->wakeFds[i]);
+    if (server->hEpoll != -1)
+        close(server->hEpoll);
+    server->hEpoll = server->wakeFds[0] = server->wakeFds[1] = -1;
+#endif
+    server->fRunning = 0;
+}
+
+/*
+ * Format the response to the next scrape and hand it to the server.
+ * Call this on each tick, after the clock state is updated. Does nothing
+ * if the server isn't running.
+ */
+void
+PublishMetrics(METRICSERVER *server, const CLOCKSTATE *state)
+{
+    METRICBUFFER *buffer;
+    size_t cbBody;
+    int i, published, reading;
+
+    if (!server->fRunning)
+        return;
+
+    if (!server->fHaveOffset) {
+        server->startOffset = (long long) (state->wallTime / USEC_PER_MSEC)
+                              - (long long) state->ticks;
+        server->fHaveOffset = 1;
+    }
+
+    cbBody = FormatMetrics(server->body, sizeof(server->body),
+                           server, state);
+    if (cbBody == 0)
+        return;
+
+    // Use whichever buffer is neither published nor being sent
+    published = atomic_load(&server->published);
+    reading = atomic_load(&server->reading);
+    for (i = 0; i == published || i == reading; ++i)
+        ;
+    buffer = &server->buffers[i];
+
+    buffer->len = snprintf(buffer->data, sizeof(buffer->data),
+                           "HTTP/1.1 200 OK\r\n"
+                           "Content-Type: " CONTENT_TYPE "\r\n"
+                           "Content-Length: %lu\r\n\r\n",
+                           (unsigned long) cbBody);
+    memcpy(buffer->data + buffer->len, server->body, cbBody);
+    buffer->len += cbBody;
+    atomic_store(&server->published, i);
+}
+
+/*
+ * Format the metrics in the OpenMetrics text format.
+ * Returns the length of the formatted text, or 0 if it didn't fit.
+ */
+size_t
+FormatMetrics(char *buf, size_t size, METRICSERVER *server,
+              const CLOCKSTATE *state)
+{
+    char *p = buf, *end = buf + size;
+    long long drift;
+    int i;
+
+    drift = (long long) (state->wallTime / USEC_PER_MSEC)
+            - (long long) state->ticks - server->startOffset;
+
+    Append(&p, end,
+           "# TYPE uclock_uptime_seconds gauge\n"
+           "# UNIT uclock_uptime_seconds seconds\n"
+           "# HELP uclock_uptime_seconds Time since the system started.\n"
+           "uclock_uptime_seconds %llu.%03llu\n",
+           state->ticks / MSEC_PER_SEC, state->ticks % MSEC_PER_SEC);
+    if (state->fAwakeValid)
+        Append(&p, end,
+               "# TYPE uclock_awake_seconds gauge\n"
+               "# UNIT uclock_awake_seconds seconds\n"
+               "# HELP uclock_awake_seconds Uptime not counting time "
+               "suspended.\n"
+               "uclock_awake_seconds %llu.%03llu\n",
+               state->awakeTicks / MSEC_PER_SEC,
+               state->awakeTicks % MSEC_PER_SEC);
+    Append(&p, end,
+           "# TYPE uclock_wall_drift_seconds gauge\n"
+           "# UNIT uclock_wall_drift_seconds seconds\n"
+           "# HELP uclock_wall_drift_seconds How far the wall clock has "
+           "moved relative to the uptime since the clock started.\n"
+           "uclock_wall_drift_seconds %s%lld.%03lld\n"
+           "# TYPE uclock_last_tick_timestamp_seconds gauge\n"
+           "# UNIT uclock_last_tick_timestamp_seconds seconds\n"
+           "# HELP uclock_last_tick_timestamp_seconds When these metrics "
+           "were updated.\n"
+           "uclock_last_tick_timestamp_seconds %llu.%06llu\n",
+           (drift < 0) ? "-" : "",
+           ((drift < 0) ? -drift : drift) / MSEC_PER_SEC,
+           ((drift < 0) ? -drift : drift) % MSEC_PER_SEC,
+           state->wallTime / USEC_PER_SEC, state->wallTime % USEC_PER_SEC);
+
+    for (i = 0; i < server->cHistograms; ++i) {
+        SnapshotHistogram(server->histograms[i].histogram, &server->snapshot);
+        FormatHistogram(&p, end, &server->histograms[i], &server->snapshot);
+    }
+
+    Append(&p, end, "# EOF\n");
+    return (p < end) ? (size_t) (p - buf) : 0;
+}
+
+/*
+ * Serve connections until told to stop.
+ */
+void
+RunMetricServer(void *arg)
+{
+#ifdef __linux__
+    RunEpoll(arg);
+#else
+    RunSelect(arg);
+#endif
+}
+
+#ifdef __linux__
+/*
+ * Serve connections, using epoll to wait for them.
+ */
+void
+RunEpoll(METRICSERVER *server)
+{
+    struct epoll_event ev, events[METRICS_MAX_CONNECTIONS + 2];
+    METRICCONN *conn;
+    int i, cEvents, key;
+
+    ev.events = EPOLLIN;
+    ev.data.u32 = KEY_LISTENER;
+    epoll_ctl(server->hEpoll, EPOLL_CTL_ADD, (int) server->listener, &ev);
+    ev.data.u32 = KEY_WAKE;
+    epoll_ctl(server->hEpoll, EPOLL_CTL_ADD, server->wakeFds[0], &ev);
+
+    while (!atomic_load(&server->fStop)) {
+        cEvents = epoll_wait(server->hEpoll, events,
+                             METRICS_MAX_CONNECTIONS + 2, -1);
+        for (i = 0; i < cEvents; ++i) {
+            key = (int) events[i].data.u32;
+            if (key == KEY_WAKE)
+                return;
+
+            if (key == KEY_LISTENER) {
+                while ((conn = AcceptClient(server)) != NULL) {
+                    ev.events = EPOLLIN;
+                    ev.data.u32 = (unsigned int) (conn - server->conns);
+                    conn->fWantWrite = 0;
+                    epoll_ctl(server->hEpoll, EPOLL_CTL_ADD,
+                              (int) conn->sock, &ev);
+                }
+                continue;
+            }
+
+            conn = &server->conns[key];
+            if (conn->sock == METRICS_NO_SOCKET)
+                continue;
+            if (ServeConn(server, conn,
+                          (events[i].events & (EPOLLIN | EPOLLHUP
+                                               | EPOLLERR)) != 0,
+                          (events[i].events & EPOLLOUT) != 0) != 0)
+                CloseConn(conn);    // which also removes it from epoll
+            else
+                WatchConn(server, conn);
+        }
+    }
+}
+
+/*
+ * Watch for a connection to be writable only while it has output pending.
+ */
+void
+WatchConn(METRICSERVER *server, METRICCONN *conn)
+{
+    struct epoll_event ev;
+    int fWantWrite = (conn->pending != NULL);
+
+    if (fWantWrite == conn->fWantWrite)
+        return;
+
+    ev.events = fWantWrite ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    ev.data.u32 = (unsigned int) (conn - server->conns);
+    epoll_ctl(server->hEpoll, EPOLL_CTL_MOD, (int) conn->sock, &ev);
+    conn->fWantWrite = fWantWrite;
+}
+#else
+/*
+ * Serve connections, using select() to wait for them.
+ */
+void
+RunSelect(METRICSERVER *server)
+{
+    fd_set readFds, writeFds;
+    struct timeval tv;
+    SOCKETFD sock, maxSock;
+    METRICCONN *conn;
+    int i;
+
+    while (!atomic_load(&server->fStop)) {
+        FD_ZERO(&readFds);
+        FD_ZERO(&writeFds);
+        maxSock = (SOCKETFD) server->listener;
+        FD_SET(maxSock, &readFds);
+        for (i = 0; i < METRICS_MAX_CONNECTIONS; ++i) {
+            conn = &server->conns[i];
+            if (conn->sock == METRICS_NO_SOCKET)
+                continue;
+            sock = (SOCKETFD) conn->sock;
+            FD_SET(sock, &readFds);
+            if (conn->pending != NULL)
+                FD_SET(sock, &writeFds);
+            if (sock > maxSock)
+                maxSock = sock;
+        }
+
+        tv.tv_sec = 0;
+        tv.tv_usec = SELECT_TIMEOUT;
+        if (select((int) maxSock + 1, &readFds, &writeFds, NULL, &tv) <= 0)
+            continue;
+
+        if (FD_ISSET((SOCKETFD) server->listener, &readFds))
+            while (AcceptClient(server) != NULL)
+                ;
+        for (i = 0; i < METRICS_MAX_CONNECTIONS; ++i) {
+            conn = &server->conns[i];
+            if (conn->sock == METRICS_NO_SOCKET)
+                continue;
+            sock = (SOCKETFD) conn->sock;
+            if (!FD_ISSET(sock, &readFds) && !FD_ISSET(sock, &writeFds))
+                continue;
+            if (ServeConn(server, conn, FD_ISSET(sock, &readFds),
+                          FD_ISSET(sock, &writeFds)) != 0)
+                CloseConn(conn);
+        }
+    }
+}
+#endif
+
+/*
+ * Accept a waiting client into a free connection slot.
+ * Clients past the limit are turned away.
+ * Returns the connection, or NULL if there are no more clients waiting.
+ */
+METRICCONN *
+AcceptClient(METRICSERVER *server)
+{
+    METRICCONN *conn = NULL;
+    uintptr_t sock;
+    int i, one = 1;
+
+    for (;;) {
+        sock = (uintptr_t) accept((SOCKETFD) server->listener, NULL, NULL);
+        if (sock == METRICS_NO_SOCKET)
+            return NULL;
+
+        for (i = 0; i < METRICS_MAX_CONNECTIONS; ++i) {
+            if (server->conns[i].sock == METRICS_NO_SOCKET) {
+                conn = &server->conns[i];
+                break;
+            }
+        }
+        if (conn != NULL && SetNonBlocking(sock) == 0)
+            break;
+        CloseSocket(sock);
+    }
+
+    // Responses go out in one piece, so there's nothing for Nagle to save
+    setsockopt((SOCKETFD) sock, IPPROTO_TCP, TCP_NODELAY,
+               (const char *) &one, sizeof(one));
+
+    conn->sock = sock;
+    conn->cbRequest = 0;
+    conn->pending = NULL;
+    conn->cbPending = conn->offset = 0;
+    return conn;
+}
+
+/*
+ * Read and answer whatever requests a client has sent.
+ * Returns 0 to keep the connection open, or -1 to close it.
+ */
+int
+ServeConn(METRICSERVER *server, METRICCONN *conn,
+          int fReadable, int fWritable)
+{
+    size_t end;
+    int cb;
+
+    if (fWritable && conn->pending != NULL && FlushPending(conn) != 0)
+        return -1;
+
+    if (fReadable) {
+        cb = recv((SOCKETFD) conn->sock, conn->request + conn->cbRequest,
+                  (int) (sizeof(conn->request) - conn->cbRequest), 0);
+        if (cb == 0)
+            return -1;  // the client closed it
+        if (cb < 0)
+            return IsWouldBlock() ? 0 : -1;
+        conn->cbRequest += cb;
+    }
+
+    // Answer each complete request, unless we're still sending the last
+    while (conn->pending == NULL && (end = FindRequestEnd(conn)) > 0) {
+        if (Respond(server, conn) != 0)
+            return -1;
+        memmove(conn->request, conn->request + end, conn->cbRequest - end);
+        conn->cbRequest -= end;
+    }
+
+    // A request that doesn't fit isn't one we'd answer anyway
+    return (conn->cbRequest < sizeof(conn->request)) ? 0 : -1;
+}
+
+/*
+ * Answer the request at the start of a connection's buffer.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+Respond(METRICSERVER *server, METRICCONN *conn)
+{
+    static const char szGet[] = "GET /metrics";
+    const char *next = conn->request + sizeof(szGet) - 1;
+    int index, result;
+
+    if (memcmp(conn->request, szGet, sizeof(szGet) - 1) != 0
+        || (*next != ' ' && *next != '?'))
+        return SendResponse(conn, RESPONSE_404, sizeof(RESPONSE_404) - 1);
+
+    // Claim the published buffer, making sure it's still the published one
+    // after we've said we're reading it
+    do {
+        index = atomic_load(&server->published);
+        atomic_store(&server->reading, index);
+    } while (atomic_load(&server->published) != index);
+
+    if (index < 0)
+        result = SendResponse(conn, RESPONSE_503, sizeof(RESPONSE_503) - 1);
+    else
+        result = SendResponse(conn, server->buffers[index].data,
+                              server->buffers[index].len);
+
+    atomic_store(&server->reading, -1);
+    return result;
+}
+
+/*
+ * Send a response, keeping a copy of whatever didn't fit in the socket's
+ * buffer to send later. The buffer it came from may be reused by then.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+SendResponse(METRICCONN *conn, const char *data, size_t len)
+{
+    int cb;
+
+    cb = send((SOCKETFD) conn->sock, data, (int) len, SEND_FLAGS);
+    if (cb < 0) {
+        if (!IsWouldBlock())
+            return -1;
+        cb = 0;
+    }
+    if ((size_t) cb == len)
+        return 0;
+
+    conn->pending = malloc(len - cb);
+    if (conn->pending == NULL)
+        return -1;
+    memcpy(conn->pending, data + cb, len - cb);
+    conn->cbPending = len - cb;
+    conn->offset = 0;
+    return 0;
+}
+
+/*
+ * Send more of what a short send() left over.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+FlushPending(METRICCONN *conn)
+{
+    int cb;
+
+    cb = send((SOCKETFD) conn->sock, conn->pending + conn->offset,
+              (int) (conn->cbPending - conn->offset), SEND_FLAGS);
+    if (cb < 0)
+        return IsWouldBlock() ? 0 : -1;
+
+    conn->offset += cb;
+    if (conn->offset == conn->cbPending) {
+        free(conn->pending);
+        conn->pending = NULL;
+    }
+    return 0;
+}
+
+/*
+ * Close a connection and free its slot.
+ */
+void
+CloseConn(METRICCONN *conn)
+{
+    if (conn->sock != METRICS_NO_SOCKET)
+        CloseSocket(conn->sock);
+    conn->sock = METRICS_NO_SOCKET;
+    free(conn->pending);
+    conn->pending = NULL;
+}
+
+/*
+ * Return the length of the first complete request in a connection's
+ * buffer, including the blank line that ends it, or 0 if there isn't one.
+ */
+size_t
+FindRequestEnd(const METRICCONN *conn)
+{
+    size_t i;
+
+    for (i = 3; i < conn->cbRequest; ++i)
+        if (memcmp(conn->request + i - 3, "\r\n\r\n", 4) == 0)
+            return i + 1;
+    return 0;
+}
+
+/*
+ * Make a socket's send() and recv() return rather than wait.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+SetNonBlocking(uintptr_t sock)
+{
+#ifdef _WIN32
+    u_long one = 1;
+
+    return (ioctlsocket((SOCKET) sock, FIONBIO, &one) == 0) ? 0 : -1;
+#else
+    int flags = fcntl((int) sock, F_GETFL);
+
+    if (flags == -1)
+        return -1;
+    return fcntl((int) sock, F_SETFL, flags | O_NONBLOCK);
+#endif
+}
+
+/*
+ * Format a histogram, with cumulative buckets to the histogram's precision.
+ * The sum is estimated from the middle of each of its buckets.
+ */
+void
+FormatHistogram(char **p, char *end, const METRICHISTOGRAM *metric,
+                const HISTSNAPSHOT *snapshot)
+{
+    unsigned long long count = 0, low, high;
+    double sum = 0;
+    size_t bound;
+    int i;
+
+    Append(p, end,
+           "# TYPE %s histogram\n"
+           "# UNIT %s seconds\n"
+           "# HELP %s %s\n",
+           metric->name, metric->name, metric->name, metric->help);
+
+    for (i = 0, bound = 0; i < HIST_COUNTS_LEN; ++i) {
+        if (snapshot->counts[i] == 0)
+            continue;
+
+        // The highest value equivalent to this bucket decides where it goes
+        low = GetValueFromIndex(i);
+        high = GetValueFromIndex(i + 1) - 1;
+        for (; bound < cBucketBounds && high > bucketBounds[bound].value;
+             ++bound)
+            Append(p, end, "%s_bucket{le=\"%s\"} %llu\n",
+                   metric->name, bucketBounds[bound].sz, count);
+
+        count += snapshot->counts[i];
+        sum += snapshot->counts[i] * (low + high) / 2.0;
+    }
+    for (; bound < cBucketBounds; ++bound)
+        Append(p, end, "%s_bucket{le=\"%s\"} %llu\n",
+               metric->name, bucketBounds[bound].sz, count);
+
+    Append(p, end,
+           "%s_bucket{le=\"+Inf\"} %llu\n"
+           "%s_count %llu\n"
+           "%s_sum %.6f\n",
+           metric->name, count, metric->name, count,
+           metric->name, sum / USEC_PER_SEC);
+}
+
+/*
+ * Append formatted text to a buffer.
+ * If it doesn't fit, *p is left at end.
+ */
+void
+Append(char **p, char *end, const char *fmt, ...)
+{
+    va_list ap;
+    int len;
+
+    if (*p >= end)
+        return;
+
+    va_start(ap, fmt);
+    len = vsnprintf(*p, end - *p, fmt, ap);
+    va_end(ap);
+
+    *p = (len < 0 || len >= end - *p) ? end : *p + len;
+}
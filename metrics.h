@@ -0,0 +1,126 @@
+/*
+ * OpenMetrics endpoint for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Serves what the clock measures to Prometheus and the like over HTTP on
+ * the loopback interface, in the OpenMetrics text format: the uptime,
+ * how far the wall clock has drifted from it, and the histograms of tick
+ * lateness, hiccups, and UI dispatch delay.
+ *
+ * The whole HTTP response is formatted once per tick by PublishMetrics()
+ * on the clock's own thread, and handed to the server thread through a
+ * set of three buffers, so neither ever waits for the other. A scrape is
+ * answered with a single send() of the latest response -- no formatting,
+ * no locks, and no allocation unless the client is too slow to take the
+ * whole response at once -- so scrapes cost the same however many of
+ * them there are, and never touch the UI thread at all. The server uses
+ * epoll on Linux and select() elsewhere, and keeps connections open for
+ * Prometheus to reuse.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "clockcore.h"
+#include "histogram.h"
+#include "thread.h"
+
+// Default port, on 127.0.0.1 only
+#define METRICS_PORT 9184
+
+// Names and descriptions of the histograms the clock publishes
+#define METRIC_TICK_LATENESS "uclock_tick_lateness_seconds"
+#define METRIC_TICK_LATENESS_HELP "How late each tick of the clock was."
+#define METRIC_HICCUPS "uclock_hiccup_seconds"
+#define METRIC_HICCUPS_HELP "Stalls seen by the hiccup meter."
+#define METRIC_UI_DISPATCH "uclock_ui_dispatch_seconds"
+#define METRIC_UI_DISPATCH_HELP "How long UI probe pings waited to be handled."
+
+// How many histograms one server can publish
+#define METRICS_MAX_HISTOGRAMS 4
+
+// Largest response, and the part of it left for the body
+#define METRICS_RESPONSE_SIZE 8192
+#define METRICS_BODY_SIZE ((METRICS_RESPONSE_SIZE) - 256)
+
+// Most connections served at once; any more are closed right away
+#define METRICS_MAX_CONNECTIONS 64
+
+// Longest request we'll wait for the end of
+#define METRICS_REQUEST_SIZE 1024
+
+// Marks a connection slot not in use; the same as Windows' INVALID_SOCKET
+#define METRICS_NO_SOCKET (~(uintptr_t) 0)
+
+// A histogram to publish, with values in microseconds
+typedef struct tagMETRICHISTOGRAM {
+    const char *name;           // metric name, in seconds
+    const char *help;
+    HISTOGRAM *histogram;
+} METRICHISTOGRAM;
+
+// A response ready to send
+typedef struct tagMETRICBUFFER {
+    size_t len;
+    char data[METRICS_RESPONSE_SIZE];
+} METRICBUFFER;
+
+// A client connected to the server
+typedef struct tagMETRICCONN {
+    uintptr_t sock;             // or METRICS_NO_SOCKET if not in use
+    size_t cbRequest;           // bytes of the current request so far
+    char request[METRICS_REQUEST_SIZE];
+    char *pending;              // what a short send() left over
+    size_t cbPending, offset;
+    int fWantWrite;             // nonzero if epoll is watching EPOLLOUT
+} METRICCONN;
+
+typedef struct tagMETRICSERVER {
+    THREAD thread;
+    atomic_int fStop;
+    unsigned short port;        // the port actually listened on
+    uintptr_t listener;
+    int hEpoll, wakeFds[2];     // used only on Linux
+    int fWinsock;               // nonzero if WSAStartup() succeeded
+    int cHistograms;
+    METRICHISTOGRAM histograms[METRICS_MAX_HISTOGRAMS];
+    int fRunning;               // nonzero between start and stop
+    long long startOffset;      // wall time minus uptime at first, in ms
+    int fHaveOffset;            // nonzero once startOffset is set
+    // Written by PublishMetrics(), read by the server thread
+    METRICBUFFER buffers[3];
+    _Alignas(CACHE_LINE_SIZE) atomic_int published;
+    _Alignas(CACHE_LINE_SIZE) atomic_int reading;
+    METRICCONN conns[METRICS_MAX_CONNECTIONS];
+    HISTSNAPSHOT snapshot;      // scratch space for PublishMetrics()
+    char body[METRICS_BODY_SIZE];
+} METRICSERVER;
+
+int AddMetricHistogram(METRICSERVER *server, const char *name,
+                       const char *help, HISTOGRAM *histogram);
+int StartMetricServer(METRICSERVER *server, unsigned short port);
+void StopMetricServer(METRICSERVER *server);
+void PublishMetrics(METRICSERVER *server, const CLOCKSTATE *state);
+
+size_t FormatMetrics(char *buf, size_t size, METRICSERVER *server,
+                     const CLOCKSTATE *state);
+
+#endif /* METRICS_H */
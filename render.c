@@ -0,0 +1,394 @@
+/*
+ * Software renderer for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h> // for malloc() and free()
+#include <string.h> // for memset()
+
+#include "render.h"
+
+/*
+ * 5x7 bitmap font covering every character the clock displays.
+ * Each byte is one row, top first, with the leftmost pixel in bit 4.
+ */
+static const unsigned char font[128][7] = {
+    ['0'] = { 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E },
+    ['1'] = { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E },
+    ['2'] = { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F },
+    ['3'] = { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E },
+    ['4'] = { 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 },
+    ['5'] = { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E },
+    ['6'] = { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E },
+    ['7'] = { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },
+    ['8'] = { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E },
+    ['9'] = { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C },
+    ['/'] = { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 },
+    [':'] = { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 },
+    [','] = { 0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08 },
+    ['.'] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C },
+    ['-'] = { 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 },
+    ['+'] = { 0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00 },
+    ['%'] = { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 },
+    ['A'] = { 0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11 },
+    ['C'] = { 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E },
+    ['H'] = { 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 },
+    ['I'] = { 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E },
+    ['M'] = { 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 },
+    ['P'] = { 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 },
+    ['S'] = { 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E },
+    ['U'] = { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E },
+    ['a'] = { 0x00, 0x00, 0x0E, 0x01, 0x0F, 0x11, 0x0F },
+    ['b'] = { 0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x1E },
+    ['c'] = { 0x00, 0x00, 0x0E, 0x10, 0x10, 0x11, 0x0E },
+    ['d'] = { 0x01, 0x01, 0x0D, 0x13, 0x11, 0x11, 0x0F },
+    ['e'] = { 0x00, 0x00, 0x0E, 0x11, 0x1F, 0x10, 0x0E },
+    ['f'] = { 0x06, 0x09, 0x08, 0x1C, 0x08, 0x08, 0x08 },
+    ['g'] = { 0x00, 0x00, 0x0F, 0x11, 0x0F, 0x01, 0x0E },
+    ['h'] = { 0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x11 },
+    ['i'] = { 0x04, 0x00, 0x0C, 0x04, 0x04, 0x04, 0x0E },
+    ['j'] = { 0x02, 0x00, 0x06, 0x02, 0x02, 0x12, 0x0C },
+    ['k'] = { 0x10, 0x10, 0x12, 0x14, 0x18, 0x14, 0x12 },
+    ['l'] = { 0x0C, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E },
+    ['m'] = { 0x00, 0x00, 0x1A, 0x15, 0x15, 0x11, 0x11 },
+    ['n'] = { 0x00, 0x00, 0x16, 0x19, 0x11, 0x11, 0x11 },
+    ['o'] = { 0x00, 0x00, 0x0E, 0x11, 0x11, 0x11, 0x0E },
+    ['p'] = { 0x00, 0x00, 0x1E, 0x11, 0x1E, 0x10, 0x10 },
+    ['q'] = { 0x00, 0x00, 0x0D, 0x13, 0x0F, 0x01, 0x01 },
+    ['r'] = { 0x00, 0x00, 0x16, 0x19, 0x10, 0x10, 0x10 },
+    ['s'] = { 0x00, 0x00, 0x0E, 0x10, 0x0E, 0x01, 0x1E },
+    ['t'] = { 0x08, 0x08, 0x1C, 0x08, 0x08, 0x09, 0x06 },
+    ['u'] = { 0x00, 0x00, 0x11, 0x11, 0x11, 0x13, 0x0D },
+    ['v'] = { 0x00, 0x00, 0x11, 0x11, 0x11, 0x0A, 0x04 },
+    ['w'] = { 0x00, 0x00, 0x11, 0x11, 0x15, 0x15, 0x0A },
+    ['x'] = { 0x00, 0x00, 0x11, 0x0A, 0x04, 0x0A, 0x11 },
+    ['y'] = { 0x00, 0x00, 0x11, 0x11, 0x0F, 0x01, 0x0E },
+    ['z'] = { 0x00, 0x00, 0x1F, 0x02, 0x04, 0x08, 0x1F },
+};
+
+static int FontScale(int cHeight);
+static void GetTextRect(const CLOCKLAYOUT *layout, long y, int cHeight,
+                        int cch, FBRECT *rect);
+static void FillBlock(FRAMEBUFFER *fb, const FBRECT *clip,
+                      int left, int top, int right, int bottom, PIXEL color);
+static void DrawText(FRAMEBUFFER *fb, const FBRECT *clip,
+                     const CLOCKLAYOUT *layout, long y, int cHeight,
+                     const CCHAR *sz, int cch);
+static int GetLineChange(const CLOCKLAYOUT *layout, long y, int cHeight,
+                         const CCHAR *sz, const CHANGE *change,
+                         FBRECT *rcLine, FBRECT *rcChange);
+static int CountChars(const CCHAR *sz);
+
+/*
+ * Create a clock face of the specified size.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+CreateClockFace(CLOCKFACE *face, int width, int height)
+{
+    PIXEL *pixels;
+
+    pixels = malloc((size_t) width * height * sizeof(PIXEL));
+    if (pixels == NULL)
+        return -1;
+
+    CreateClockFaceIn(face, width, height, pixels);
+    face->fb.fOwnPixels = 1;
+    return 0;
+}
+
+/*
+ * Create a clock face that draws into pixels the caller provides, such
+ * as a window system's shared image, rather than its own.
+ * They must stay valid until the face is freed.
+ */
+void
+CreateClockFaceIn(CLOCKFACE *face, int width, int height, PIXEL *pixels)
+{
+    memset(face, 0, sizeof(CLOCKFACE));
+    face->fb.pixels = pixels;
+    face->fb.width = width;
+    face->fb.height = height;
+
+    LayOutClock(&face->layout, width, height);
+}
+
+/*
+ * Free a clock face.
+ */
+void
+FreeClockFace(CLOCKFACE *face)
+{
+    if (face->fb.fOwnPixels)
+        free(face->fb.pixels);
+    memset(face, 0, sizeof(CLOCKFACE));
+}
+
+/*
+ * Render the clock display.
+ * If clip is not NULL, only the pixels inside it are drawn.
+ */
+void
+RenderClockFace(CLOCKFACE *face, const CLOCKSTATE *state, const FBRECT *clip)
+{
+    FBRECT rcClip;
+    CLOCKLAYOUT *layout;
+    int i;
+
+    rcClip.left = 0;
+    rcClip.top = 0;
+    rcClip.right = face->fb.width;
+    rcClip.bottom = face->fb.height;
+    if (clip != NULL) {
+        if (clip->left > rcClip.left)
+            rcClip.left = clip->left;
+        if (clip->top > rcClip.top)
+            rcClip.top = clip->top;
+        if (clip->right < rcClip.right)
+            rcClip.right = clip->right;
+        if (clip->bottom < rcClip.bottom)
+            rcClip.bottom = clip->bottom;
+    }
+
+    layout = &face->layout;
+    FillBlock(&face->fb, &rcClip, rcClip.left, rcClip.top,
+              rcClip.right, rcClip.bottom, RENDER_BACKGROUND);
+    DrawText(&face->fb, &rcClip, layout, layout->yClock,
+             layout->cHeightClock, state->szClock, CountChars(state->szClock));
+    DrawText(&face->fb, &rcClip, layout, layout->yLabel,
+             layout->cHeightUptime, UPTIME_LABEL, UPTIME_LABEL_LEN);
+    DrawText(&face->fb, &rcClip, layout, layout->yUptime,
+             layout->cHeightUptime, state->szUptime,
+             CountChars(state->szUptime));
+    for (i = 0; i < MAX_STATUS_LINES; ++i)
+        DrawText(&face->fb, &rcClip, layout,
+                 layout->yStatus + i * layout->cHeightStatus,
+                 layout->cHeightStatus, state->szStatus[i],
+                 CountChars(state->szStatus[i]));
+}
+
+/*
+ * Find the areas that need redrawing after the clock state changed.
+ *
+ * Like InvalidateChange() in uclock.c, this is just the changed characters
+ * unless the width of a line changed, in which case it's everywhere the
+ * line was or is now.
+ * Returns the number of rectangles stored in rects.
+ */
+int
+GetClockFaceChanges(CLOCKFACE *face, const CLOCKSTATE *state,
+                    FBRECT rects[MAX_FACE_CHANGES])
+{
+    int cRects = 0;
+    int i;
+
+    if (GetLineChange(&face->layout, face->layout.yClock,
+                      face->layout.cHeightClock,
+                      state->szClock, &state->clockChange,
+                      &face->rcClock, &rects[cRects]) == 0)
+        ++cRects;
+    if (GetLineChange(&face->layout, face->layout.yUptime,
+                      face->layout.cHeightUptime,
+                      state->szUptime, &state->uptimeChange,
+                      &face->rcUptime, &rects[cRects]) == 0)
+        ++cRects;
+    for (i = 0; i < MAX_STATUS_LINES; ++i)
+        if (GetLineChange(&face->layout,
+                          face->layout.yStatus + i * face->layout.cHeightStatus,
+                          face->layout.cHeightStatus,
+                          state->szStatus[i], &state->statusChange[i],
+                          &face->rcStatus[i], &rects[cRects]) == 0)
+            ++cRects;
+
+    return cRects;
+}
+
+/*
+ * Write the framebuffer to a file in binary PPM format.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+WriteFramebufferPPM(const FRAMEBUFFER *fb, FILE *fp)
+{
+    unsigned char rgb[3];
+    PIXEL pixel;
+    long i, count;
+
+    if (fprintf(fp, "P6\n%d %d\n255\n", fb->width, fb->height) < 0)
+        return -1;
+
+    count = (long) fb->width * fb->height;
+    for (i = 0; i < count; ++i) {
+        pixel = fb->pixels[i];
+        rgb[0] = (pixel >> 16) & 0xFF;
+        rgb[1] = (pixel >> 8) & 0xFF;
+        rgb[2] = pixel & 0xFF;
+        if (fwrite(rgb, 1, 3, fp) != 3)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Return how much to scale the built-in font to fit a line height.
+ */
+int
+FontScale(int cHeight)
+{
+    int scale = cHeight / FONT_CELL_HEIGHT;
+    return (scale < 1) ? 1 : scale;
+}
+
+/*
+ * Find where a line of text is drawn.
+ */
+void
+GetTextRect(const CLOCKLAYOUT *layout, long y, int cHeight, int cch,
+            FBRECT *rect)
+{
+    int scale, width;
+
+    scale = FontScale(cHeight);
+    width = cch * FONT_CELL_WIDTH * scale;
+    rect->left = layout->x - width / 2;
+    rect->top = y;
+    rect->right = rect->left + width;
+    rect->bottom = y + FONT_CELL_HEIGHT * scale;
+}
+
+/*
+ * Fill the part of a rectangle that's inside the clipping area.
+ */
+void
+FillBlock(FRAMEBUFFER *fb, const FBRECT *clip,
+          int left, int top, int right, int bottom, PIXEL color)
+{
+    PIXEL *row;
+    int x, y;
+
+    if (left < clip->left)
+        left = clip->left;
+    if (top < clip->top)
+        top = clip->top;
+    if (right > clip->right)
+        right = clip->right;
+    if (bottom > clip->bottom)
+        bottom = clip->bottom;
+
+    if (left >= right || top >= bottom)
+        return;
+
+    // Fill the first row, then copy it to the rest
+    row = fb->pixels + (long) top * fb->width;
+    for (x = left; x < right; ++x)
+        row[x] = color;
+    for (y = top + 1; y < bottom; ++y)
+        memcpy(fb->pixels + (long) y * fb->width + left, row + left,
+               (right - left) * sizeof(PIXEL));
+}
+
+/*
+ * Draw a line of text centered in the layout.
+ * The background must already be filled.
+ */
+void
+DrawText(FRAMEBUFFER *fb, const FBRECT *clip, const CLOCKLAYOUT *layout,
+         long y, int cHeight, const CCHAR *sz, int cch)
+{
+    const unsigned char *glyph;
+    FBRECT rect;
+    int scale, i, row, col, left, top;
+
+    GetTextRect(layout, y, cHeight, cch, &rect);
+    if (rect.bottom <= clip->top || rect.top >= clip->bottom
+        || rect.right <= clip->left || rect.left >= clip->right)
+        return;
+
+    scale = FontScale(cHeight);
+    for (i = 0; i < cch; ++i) {
+        if ((unsigned) sz[i] >= 128)
+            continue;
+        glyph = font[(unsigned) sz[i]];
+        left = rect.left + i * FONT_CELL_WIDTH * scale;
+        if (left >= clip->right || left + FONT_CELL_WIDTH * scale <= clip->left)
+            continue;
+
+        // Leave a blank row above the glyph
+        for (row = 0; row < 7; ++row) {
+            top = rect.top + (row + 1) * scale;
+            for (col = 0; col < 5; ++col) {
+                if (glyph[row] & (0x10 >> col))
+                    FillBlock(fb, clip,
+                              left + col * scale, top,
+                              left + (col + 1) * scale, top + scale,
+                              RENDER_FOREGROUND);
+            }
+        }
+    }
+}
+
+/*
+ * Find the area that needs redrawing after a line of text changed,
+ * and update where the line is.
+ * Returns 0 if something changed, -1 if not.
+ */
+int
+GetLineChange(const CLOCKLAYOUT *layout, long y, int cHeight,
+              const CCHAR *sz, const CHANGE *change,
+              FBRECT *rcLine, FBRECT *rcChange)
+{
+    FBRECT rcOld;
+    int cch, cx;
+
+    if (change->first == change->end)
+        return -1;
+
+    cch = CountChars(sz);
+    rcOld = *rcLine;
+    GetTextRect(layout, y, cHeight, cch, rcLine);
+
+    *rcChange = *rcLine;
+    if (rcLine->left != rcOld.left || rcLine->right != rcOld.right) {
+        // The line moved, so include where it was before
+        if (rcOld.left < rcOld.right) {
+            if (rcOld.left < rcChange->left)
+                rcChange->left = rcOld.left;
+            if (rcOld.right > rcChange->right)
+                rcChange->right = rcOld.right;
+        }
+    } else {
+        cx = FONT_CELL_WIDTH * FontScale(cHeight);
+        rcChange->left = rcLine->left + change->first * cx;
+        rcChange->right = rcLine->left
+                          + ((change->end < cch) ? change->end : cch) * cx;
+    }
+
+    return 0;
+}
+
+/*
+ * Return the length of a string.
+ */
+int
+CountChars(const CCHAR *sz)
+{
+    int cch;
+
+    for (cch = 0; sz[cch] != '\0'; ++cch)
+        ;
+    return cch;
+}
@@ -0,0 +1,75 @@
+/*
+ * Software renderer for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Draws the clock display into an in-memory framebuffer, using the same
+ * layout as PaintClockWindow() and a built-in bitmap font. This lets us
+ * exercise and benchmark the drawing path without a window system.
+ */
+
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdio.h>
+
+#include "clockcore.h"
+
+// Colors, as 0x00RRGGBB
+#define RENDER_BACKGROUND   0x00F0F0F0
+#define RENDER_FOREGROUND   0x00000000
+
+// The built-in font is 5x7 pixels in a 6x9 cell, scaled to fit
+#define FONT_CELL_WIDTH  6
+#define FONT_CELL_HEIGHT 9
+
+// Most rectangles GetClockFaceChanges() can return
+#define MAX_FACE_CHANGES (2 + (MAX_STATUS_LINES))
+
+typedef unsigned int PIXEL;
+
+typedef struct tagFRAMEBUFFER {
+    int width, height;
+    PIXEL *pixels;              // width * height pixels, top row first
+    int fOwnPixels;             // nonzero if we allocated them
+} FRAMEBUFFER;
+
+// Rectangle, excluding the right and bottom edges like a Win32 RECT
+typedef struct tagFBRECT {
+    int left, top, right, bottom;
+} FBRECT;
+
+// Clock display rendered into a framebuffer
+typedef struct tagCLOCKFACE {
+    FRAMEBUFFER fb;
+    CLOCKLAYOUT layout;
+    FBRECT rcClock, rcUptime;   // where each line was last drawn
+    FBRECT rcStatus[MAX_STATUS_LINES];
+} CLOCKFACE;
+
+int CreateClockFace(CLOCKFACE *face, int width, int height);
+void CreateClockFaceIn(CLOCKFACE *face, int width, int height,
+                       PIXEL *pixels);
+void FreeClockFace(CLOCKFACE *face);
+
+void RenderClockFace(CLOCKFACE *face, const CLOCKSTATE *state,
+                     const FBRECT *clip);
+int GetClockFaceChanges(CLOCKFACE *face, const CLOCKSTATE *state,
+                        FBRECT rects[MAX_FACE_CHANGES]);
+
+int WriteFramebufferPPM(const FRAMEBUFFER *fb, FILE *fp);
+
+#endif /* RENDER_H */
@@ -0,0 +1,103 @@
+/*
+ * Simulated tick source for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h> // for memset()
+
+#include "simclock.h"
+
+static unsigned long long GetSimWallTime(void *arg);
+static unsigned long long GetSimUptimeTicks(void *arg);
+static int GetSimAwakeTicks(void *arg, unsigned long long *ticks);
+
+/*
+ * Start a simulated clock at the specified wall time (in microseconds)
+ * and uptime (in milliseconds).
+ * If fLegacy is nonzero, the uptime is read as a 32-bit count that wraps
+ * around every 49.7 days, like GetTickCount() on older Windows versions.
+ */
+void
+StartSimClock(SIMCLOCK *clock, unsigned long long wallTime,
+              unsigned long long ticks, int fLegacy)
+{
+    memset(clock, 0, sizeof(SIMCLOCK));
+    clock->source.getWallTime = GetSimWallTime;
+    clock->source.getUptimeTicks = GetSimUptimeTicks;
+    clock->source.getAwakeTicks = GetSimAwakeTicks;
+    clock->source.arg = clock;
+    clock->wallTime = wallTime;
+    clock->uptime = ticks * USEC_PER_MSEC;
+    clock->awake = clock->uptime;
+    clock->fLegacy = fLegacy;
+}
+
+/*
+ * Let time pass normally.
+ */
+void
+AdvanceSimClock(SIMCLOCK *clock, unsigned long long usec)
+{
+    clock->wallTime += usec;
+    clock->uptime += usec;
+    clock->awake += usec;
+}
+
+/*
+ * Let time pass with the system suspended.
+ */
+void
+SuspendSimClock(SIMCLOCK *clock, unsigned long long usec)
+{
+    clock->wallTime += usec;
+    clock->uptime += usec;
+}
+
+/*
+ * Step the wall clock without any time passing.
+ */
+void
+StepSimClock(SIMCLOCK *clock, long long usec)
+{
+    clock->wallTime += usec;
+}
+
+unsigned long long
+GetSimWallTime(void *arg)
+{
+    SIMCLOCK *clock = arg;
+
+    return clock->wallTime;
+}
+
+unsigned long long
+GetSimUptimeTicks(void *arg)
+{
+    SIMCLOCK *clock = arg;
+    unsigned long long ticks = clock->uptime / USEC_PER_MSEC;
+
+    return clock->fLegacy
+           ? WidenTickCount(&clock->widener, (unsigned int) ticks)
+           : ticks;
+}
+
+int
+GetSimAwakeTicks(void *arg, unsigned long long *ticks)
+{
+    SIMCLOCK *clock = arg;
+
+    *ticks = clock->awake / USEC_PER_MSEC;
+    return 0;
+}
@@ -0,0 +1,45 @@
+/*
+ * Simulated tick source for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A simulated clock stands in for the system's tick source, so the whole
+ * per-tick path can be run through a year, a 49.7-day tick count wrap, or
+ * a leap day in a fraction of a second instead of waiting for them. Time
+ * only moves when we say so.
+ */
+
+#ifndef SIMCLOCK_H
+#define SIMCLOCK_H
+
+#include "clockcore.h"
+
+typedef struct tagSIMCLOCK {
+    TICKSOURCE source;          // give this to the clock state
+    unsigned long long wallTime;    // in microseconds since the epoch
+    unsigned long long uptime;  // in microseconds since "boot"
+    unsigned long long awake;   // same, not counting time suspended
+    int fLegacy;                // count ticks like GetTickCount()
+    TICKWIDENER widener;        // and extend them like we do for it
+} SIMCLOCK;
+
+void StartSimClock(SIMCLOCK *clock, unsigned long long wallTime,
+                   unsigned long long ticks, int fLegacy);
+void AdvanceSimClock(SIMCLOCK *clock, unsigned long long usec);
+void SuspendSimClock(SIMCLOCK *clock, unsigned long long usec);
+void StepSimClock(SIMCLOCK *clock, long long usec);
+
+#endif /* SIMCLOCK_H */
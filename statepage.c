@@ -0,0 +1,239 @@
+/*
+ * Shared state page for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef _WIN32
+#  define WINVER 0x400
+#  include <windows.h>
+#else
+#  define _GNU_SOURCE
+#  include <fcntl.h>
+#  include <sys/file.h>
+#  include <sys/mman.h>
+#  include <unistd.h>
+#endif
+
+#include <stdatomic.h>
+#include <string.h> // for memset()
+
+#include "statepage.h"
+
+static void BeginWrite(CLOCKSTATEPAGE *page);
+static void EndWrite(CLOCKSTATEPAGE *page);
+
+/*
+ * Create the shared state page, or take over one left by a clock that
+ * exited without cleaning up.
+ * Returns 0 on success, -1 on failure, including if another clock is
+ * already publishing under the same name.
+ */
+int
+OpenStatePage(STATEPAGE *statePage, const char *name)
+{
+    CLOCKSTATEPAGE *page;
+
+    memset(statePage, 0, sizeof(STATEPAGE));
+
+#ifdef _WIN32
+    // The mapping goes away with the last handle to it, so an existing
+    // one always belongs to a clock that's still running
+    statePage->hMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL,
+                                             PAGE_READWRITE, 0,
+                                             sizeof(CLOCKSTATEPAGE), name);
+    if (statePage->hMapping == NULL)
+        return -1;
+    if (GetLastError() == ERROR_ALREADY_EXISTS)
+        goto error;
+
+    page = MapViewOfFile(statePage->hMapping, FILE_MAP_WRITE,
+                         0, 0, sizeof(CLOCKSTATEPAGE));
+    if (page == NULL)
+        goto error;
+#else
+    if (strlen(name) >= sizeof(statePage->name))
+        return -1;
+
+    // The lock tells us whether the clock that made the page still exists
+    statePage->fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (statePage->fd == -1)
+        return -1;
+    if (flock(statePage->fd, LOCK_EX | LOCK_NB) != 0) {
+        close(statePage->fd);   // someone else's; don't unlink it
+        return -1;
+    }
+    strcpy(statePage->name, name);
+    if (ftruncate(statePage->fd, sizeof(CLOCKSTATEPAGE)) != 0)
+        goto error;
+
+    page = mmap(NULL, sizeof(CLOCKSTATEPAGE), PROT_READ | PROT_WRITE,
+                MAP_SHARED, statePage->fd, 0);
+    if (page == MAP_FAILED)
+        goto error;
+#endif
+
+    statePage->page = page;
+
+    // Readers may still have an old page mapped, so keep its sequence
+    // number going rather than starting over; if its clock died in the
+    // middle of a write, it's odd, so bump it past that
+    if (atomic_load_explicit(&page->magic, memory_order_relaxed)
+            != UCLOCK_STATE_MAGIC
+        || page->version != UCLOCK_STATE_VERSION
+        || page->size != sizeof(CLOCKSTATEPAGE)) {
+        memset(page, 0, sizeof(CLOCKSTATEPAGE));
+    } else if (atomic_load_explicit(&page->sequence,
+                                    memory_order_relaxed) & 1) {
+        atomic_fetch_add_explicit(&page->sequence, 1, memory_order_relaxed);
+    }
+
+    BeginWrite(page);
+    page->version = UCLOCK_STATE_VERSION;
+    page->size = sizeof(CLOCKSTATEPAGE);
+#ifdef _WIN32
+    page->pid = GetCurrentProcessId();
+#else
+    page->pid = getpid();
+#endif
+    atomic_store_explicit(&page->tickCount, 0, memory_order_relaxed);
+    atomic_store_explicit(&page->fStopped, 0, memory_order_relaxed);
+    EndWrite(page);
+    atomic_store_explicit(&page->magic, UCLOCK_STATE_MAGIC,
+                          memory_order_release);
+    return 0;
+
+error:
+    CloseStatePage(statePage);
+    return -1;
+}
+
+/*
+ * Mark the shared state page stopped, and remove it.
+ * Readers that already have it open still see the last state published.
+ * This is safe to call on a page that failed to open.
+ */
+void
+CloseStatePage(STATEPAGE *statePage)
+{
+    CLOCKSTATEPAGE *page = statePage->page;
+
+    if (page != NULL) {
+        BeginWrite(page);
+        atomic_store_explicit(&page->fStopped, 1, memory_order_relaxed);
+        EndWrite(page);
+    }
+
+#ifdef _WIN32
+    if (page != NULL)
+        UnmapViewOfFile(page);
+    if (statePage->hMapping != NULL)
+        CloseHandle(statePage->hMapping);
+#else
+    if (page != NULL)
+        munmap(page, sizeof(CLOCKSTATEPAGE));
+    if (statePage->name[0] != '\0') {
+        shm_unlink(statePage->name);
+        close(statePage->fd);
+    }
+#endif
+
+    memset(statePage, 0, sizeof(STATEPAGE));
+}
+
+/*
+ * Count a stall reported by the hiccup meters.
+ * It's published along with the next tick.
+ */
+void
+CountStall(STATEPAGE *statePage, unsigned long long wallTime,
+           long long amount)
+{
+    ++statePage->stalls;
+    statePage->stallTime += amount;
+    if (amount > statePage->longestStall)
+        statePage->longestStall = amount;
+    if (wallTime > statePage->lastStall)
+        statePage->lastStall = wallTime;
+}
+
+/*
+ * Count events the probes dropped because their rings were full.
+ */
+void
+CountDroppedEvents(STATEPAGE *statePage, unsigned int count)
+{
+    statePage->dropped += count;
+}
+
+/*
+ * Publish the state computed on this tick.
+ * Call this on each tick after UpdateClockState(). It does nothing if the
+ * page isn't open.
+ */
+void
+PublishState(STATEPAGE *statePage, const CLOCKSTATE *state)
+{
+#define STORE(field, value) \
+    atomic_store_explicit(&page->field, (value), memory_order_relaxed)
+
+    CLOCKSTATEPAGE *page = statePage->page;
+
+    if (page == NULL)
+        return;
+
+    ++statePage->tickCount;
+    BeginWrite(page);
+    STORE(wallTime, state->wallTime);
+    STORE(ticks, state->ticks);
+    STORE(awakeTicks, state->fAwakeValid ? state->awakeTicks : 0);
+    STORE(lateness, state->lateness);
+    STORE(tickCount, statePage->tickCount);
+    STORE(stalls, statePage->stalls);
+    STORE(stallTime, statePage->stallTime);
+    STORE(longestStall, statePage->longestStall);
+    STORE(lastStall, statePage->lastStall);
+    STORE(dropped, statePage->dropped);
+    STORE(fAwakeValid, state->fAwakeValid != 0);
+    EndWrite(page);
+
+#undef STORE
+}
+
+/*
+ * Make the sequence number odd, so readers know to wait.
+ * We're the only writer, so we don't need an atomic increment.
+ */
+void
+BeginWrite(CLOCKSTATEPAGE *page)
+{
+    atomic_store_explicit(&page->sequence,
+                          atomic_load_explicit(&page->sequence,
+                                               memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    // Keep the stores that follow from moving ahead of this one
+    atomic_thread_fence(memory_order_release);
+}
+
+/*
+ * Make the sequence number even again, publishing what was written.
+ */
+void
+EndWrite(CLOCKSTATEPAGE *page)
+{
+    atomic_store_explicit(&page->sequence,
+                          atomic_load_explicit(&page->sequence,
+                                               memory_order_relaxed) + 1,
+                          memory_order_release);
+}
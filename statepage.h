@@ -0,0 +1,51 @@
+/*
+ * Shared state page for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Publishes the clock's state on each tick to the shared memory page
+ * described in uclockstate.h, for other programs to read without asking
+ * the clock anything. Only one clock on a machine can publish under a
+ * given name; any others run without a page.
+ */
+
+#ifndef STATEPAGE_H
+#define STATEPAGE_H
+
+#include "clockcore.h"
+#include "uclockstate.h"
+
+typedef struct tagSTATEPAGE {
+    CLOCKSTATEPAGE *page;       // or NULL if not open
+    unsigned long long tickCount;
+    unsigned long long stalls, stallTime, lastStall, dropped;
+    long long longestStall;
+#ifdef _WIN32
+    void *hMapping;             // HANDLE; avoids including <windows.h>
+#else
+    int fd;
+    char name[64];              // to unlink when closed
+#endif
+} STATEPAGE;
+
+int OpenStatePage(STATEPAGE *statePage, const char *name);
+void CloseStatePage(STATEPAGE *statePage);
+void CountStall(STATEPAGE *statePage, unsigned long long wallTime,
+                long long amount);
+void CountDroppedEvents(STATEPAGE *statePage, unsigned int count);
+void PublishState(STATEPAGE *statePage, const CLOCKSTATE *state);
+
+#endif /* STATEPAGE_H */
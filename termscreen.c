@@ -0,0 +1,320 @@
+/*
+ * Terminal screen for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h> // for malloc() and free()
+#include <string.h> // for memset() and strlen()
+
+#include "termscreen.h"
+
+// Longest cursor movement: ESC [ row ; col H
+#define MAX_MOVE_LEN 16
+
+// Clear the screen and home the cursor
+#define CLEAR_SCREEN "\033[H\033[2J"
+
+// Large digits and colon, top row first, with '#' for each block
+static const char *const bigGlyphs[][TERM_DIGIT_HEIGHT] = {
+    { "####", "#  #", "#  #", "#  #", "####" },
+    { " ## ", "  # ", "  # ", "  # ", " ###" },
+    { "####", "   #", "####", "#   ", "####" },
+    { "####", "   #", " ###", "   #", "####" },
+    { "#  #", "#  #", "####", "   #", "   #" },
+    { "####", "#   ", "####", "   #", "####" },
+    { "####", "#   ", "####", "#  #", "####" },
+    { "####", "   #", "   #", "   #", "   #" },
+    { "####", "#  #", "####", "#  #", "####" },
+    { "####", "#  #", "####", "   #", "####" },
+    { " ", "#", " ", "#", " " },
+};
+#define BIG_COLON 10
+
+static void PutText(TERMSCREEN *screen, int row, int col,
+                    const CCHAR *sz, int len);
+static int MeasureBigText(const CCHAR *sz, int len);
+static void PutBigText(TERMSCREEN *screen, int row, int col,
+                       const CCHAR *sz, int len);
+static int GetBigGlyph(CCHAR c);
+static char *MoveCursor(TERMSCREEN *screen, char *p, int row, int col,
+                        int *curRow, int *curCol);
+static char *PutCell(TERMSCREEN *screen, char *p, char cell);
+static size_t GetCellLength(const TERMSCREEN *screen, char cell);
+
+/*
+ * Create a screen of the specified size.
+ * szBlock is how to show blocks in large digits, like TERM_ASCII_BLOCK.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+CreateTermScreen(TERMSCREEN *screen, int cols, int rows,
+                 const char *szBlock)
+{
+    size_t cCells = (size_t) cols * rows;
+
+    memset(screen, 0, sizeof(TERMSCREEN));
+    screen->cols = cols;
+    screen->rows = rows;
+    screen->szBlock = szBlock;
+
+    // The worst case is moving the cursor to every cell
+    screen->cbOutMax = sizeof(CLEAR_SCREEN)
+                       + cCells * (MAX_MOVE_LEN + strlen(szBlock));
+    screen->cells = malloc(cCells);
+    screen->shown = malloc(cCells);
+    screen->out = malloc(screen->cbOutMax);
+    if (screen->cells == NULL || screen->shown == NULL
+        || screen->out == NULL) {
+        FreeTermScreen(screen);
+        return -1;
+    }
+
+    memset(screen->cells, ' ', cCells);
+    return 0;
+}
+
+/*
+ * Free the memory used by a screen.
+ */
+void
+FreeTermScreen(TERMSCREEN *screen)
+{
+    free(screen->cells);
+    free(screen->shown);
+    free(screen->out);
+    memset(screen, 0, sizeof(TERMSCREEN));
+}
+
+/*
+ * Draw the clock display on the screen, laid out like PaintClockWindow():
+ * the date and time, then the uptime after a blank line, centered, and
+ * the status lines below that. The time is shown in large digits if
+ * there's room.
+ */
+void
+DrawTermClock(TERMSCREEN *screen, const CLOCKSTATE *state)
+{
+    const CCHAR *szTime = state->szClock + 11;      // past the date
+    int i, cTime, cRows, row, col, width;
+
+    memset(screen->cells, ' ', (size_t) screen->cols * screen->rows);
+
+    // The time is 12:34:56 AM, and goes below the date if it's large
+    cTime = CLOCK_LEN - 11;
+    width = MeasureBigText(szTime, cTime - 3) + 3;
+    if (screen->cols >= width && screen->rows >= TERM_DIGIT_HEIGHT + 4) {
+        cRows = 1 + TERM_DIGIT_HEIGHT + 3;
+        row = (screen->rows - cRows) / 2;
+        PutText(screen, row, (screen->cols - 10) / 2, state->szClock, 10);
+
+        col = (screen->cols - width) / 2;
+        PutBigText(screen, row + 1, col, szTime, cTime - 3);
+        PutText(screen, row + TERM_DIGIT_HEIGHT, col + width - 2,
+                szTime + cTime - 2, 2);
+        row += 1 + TERM_DIGIT_HEIGHT;
+    } else {
+        cRows = 4;
+        row = (screen->rows - cRows) / 2;
+        PutText(screen, row, (screen->cols - CLOCK_LEN) / 2,
+                state->szClock, CLOCK_LEN);
+        row += 1;
+    }
+
+    // Then a blank line, and the uptime
+    PutText(screen, row + 1, (screen->cols - UPTIME_LABEL_LEN) / 2,
+            UPTIME_LABEL, UPTIME_LABEL_LEN);
+    i = (int) strlen(state->szUptime);
+    PutText(screen, row + 2, (screen->cols - i) / 2, state->szUptime, i);
+
+    // Status lines go below, after another blank line, as far as they fit
+    for (i = 0; i < MAX_STATUS_LINES; ++i) {
+        width = (int) strlen(state->szStatus[i]);
+        PutText(screen, row + 4 + i, (screen->cols - width) / 2,
+                state->szStatus[i], width);
+    }
+}
+
+/*
+ * Work out what to send the terminal to make it match the screen.
+ * The output is left in screen->out.
+ * Returns its length, which is zero if nothing changed.
+ */
+size_t
+UpdateTermScreen(TERMSCREEN *screen)
+{
+    char *p = screen->out;
+    int row, col, curRow, curCol, i;
+
+    // Start over from a blank screen if we don't know what's on it
+    if (screen->fShownValid) {
+        curRow = curCol = -1;   // unknown until we move it
+    } else {
+        memcpy(p, CLEAR_SCREEN, sizeof(CLEAR_SCREEN) - 1);
+        p += sizeof(CLEAR_SCREEN) - 1;
+        memset(screen->shown, ' ', (size_t) screen->cols * screen->rows);
+        screen->fShownValid = 1;
+        curRow = curCol = 0;
+    }
+
+    for (row = 0; row < screen->rows; ++row) {
+        for (col = 0; col < screen->cols; ++col) {
+            i = row * screen->cols + col;
+            if (screen->cells[i] == screen->shown[i])
+                continue;
+
+            p = MoveCursor(screen, p, row, col, &curRow, &curCol);
+            p = PutCell(screen, p, screen->cells[i]);
+            screen->shown[i] = screen->cells[i];
+
+            // The cursor doesn't move past the last column
+            if (++curCol >= screen->cols)
+                curRow = curCol = -1;
+        }
+    }
+
+    return p - screen->out;
+}
+
+/*
+ * Put text on the screen, clipped to its edges.
+ */
+void
+PutText(TERMSCREEN *screen, int row, int col, const CCHAR *sz, int len)
+{
+    int i;
+
+    if (row < 0 || row >= screen->rows)
+        return;
+    for (i = 0; i < len && sz[i] != 0; ++i)
+        if (col + i >= 0 && col + i < screen->cols)
+            screen->cells[row * screen->cols + col + i] = (char) sz[i];
+}
+
+/*
+ * Return the width of text in large digits.
+ */
+int
+MeasureBigText(const CCHAR *sz, int len)
+{
+    int i, width = 0;
+
+    for (i = 0; i < len; ++i)
+        width += (int) strlen(bigGlyphs[GetBigGlyph(sz[i])][0]) + 1;
+    return width - 1;
+}
+
+/*
+ * Put text in large digits on the screen, with its top left corner at
+ * the specified row and column.
+ */
+void
+PutBigText(TERMSCREEN *screen, int row, int col, const CCHAR *sz, int len)
+{
+    const char *const *glyph;
+    int i, y, x, width;
+
+    for (i = 0; i < len; ++i) {
+        glyph = bigGlyphs[GetBigGlyph(sz[i])];
+        width = (int) strlen(glyph[0]);
+        for (y = 0; y < TERM_DIGIT_HEIGHT; ++y) {
+            if (row + y < 0 || row + y >= screen->rows)
+                continue;
+            for (x = 0; x < width; ++x)
+                if (col + x >= 0 && col + x < screen->cols
+                    && glyph[y][x] == '#')
+                    screen->cells[(row + y) * screen->cols + col + x] =
+                        TERM_BLOCK;
+        }
+        col += width + 1;
+    }
+}
+
+/*
+ * Return the index of a character's large glyph.
+ * Anything that isn't a digit is shown as a colon.
+ */
+int
+GetBigGlyph(CCHAR c)
+{
+    return (c >= CTEXT('0') && c <= CTEXT('9')) ? c - CTEXT('0') : BIG_COLON;
+}
+
+/*
+ * Move the cursor to the specified cell, the cheapest way we can:
+ * not at all, by rewriting what's already on the screen on the way
+ * there, or by a relative or absolute cursor movement.
+ */
+char *
+MoveCursor(TERMSCREEN *screen, char *p, int row, int col,
+           int *curRow, int *curCol)
+{
+    char szMove[MAX_MOVE_LEN];
+    size_t cbMove, cbRewrite;
+    int i;
+
+    if (row == *curRow && col == *curCol)
+        return p;
+
+    if (row == *curRow && col > *curCol) {
+        cbMove = snprintf(szMove, sizeof(szMove), "\033[%dC", col - *curCol);
+        for (i = *curCol, cbRewrite = 0;
+             i < col && cbRewrite <= cbMove;
+             ++i)
+            cbRewrite += GetCellLength(screen,
+                                       screen->shown[row * screen->cols + i]);
+        if (cbRewrite <= cbMove) {
+            for (i = *curCol; i < col; ++i)
+                p = PutCell(screen, p, screen->shown[row * screen->cols + i]);
+            *curCol = col;
+            return p;
+        }
+    } else {
+        cbMove = snprintf(szMove, sizeof(szMove), "\033[%d;%dH",
+                          row + 1, col + 1);
+    }
+
+    memcpy(p, szMove, cbMove);
+    *curRow = row;
+    *curCol = col;
+    return p + cbMove;
+}
+
+/*
+ * Add a cell's contents to the output.
+ */
+char *
+PutCell(TERMSCREEN *screen, char *p, char cell)
+{
+    size_t len;
+
+    if (cell != TERM_BLOCK) {
+        *p++ = cell;
+        return p;
+    }
+
+    len = strlen(screen->szBlock);
+    memcpy(p, screen->szBlock, len);
+    return p + len;
+}
+
+/*
+ * Return how many bytes it takes to show a cell.
+ */
+size_t
+GetCellLength(const TERMSCREEN *screen, char cell)
+{
+    return (cell == TERM_BLOCK) ? strlen(screen->szBlock) : 1;
+}
@@ -0,0 +1,68 @@
+/*
+ * Terminal screen for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Draws the clock display as text, with the time in large block digits,
+ * and works out the least output that brings a terminal up to date.
+ *
+ * We keep two copies of the screen: what we want on it, and what we last
+ * sent. Each tick we redraw the first, then compare them and send only
+ * the characters that changed, with the shortest cursor movement to get
+ * to each one. A normal tick changes a digit or two of the time and the
+ * uptime, which comes to well under a hundred bytes -- affordable even on
+ * a 9600-baud serial console, where redrawing a full screen would take
+ * two seconds.
+ */
+
+#ifndef TERMSCREEN_H
+#define TERMSCREEN_H
+
+#include <stddef.h>
+
+#include "clockcore.h"
+
+// Cell value for a block in a large digit, sent as TERMSCREEN.szBlock
+#define TERM_BLOCK '\001'
+
+// Large digits are 4x5 blocks, with a column between them
+#define TERM_DIGIT_WIDTH  4
+#define TERM_DIGIT_HEIGHT 5
+
+// Default block, for terminals that can't show anything better
+#define TERM_ASCII_BLOCK "#"
+
+// Block for terminals that understand UTF-8: U+2588 FULL BLOCK
+#define TERM_UTF8_BLOCK "\342\226\210"
+
+typedef struct tagTERMSCREEN {
+    int cols, rows;
+    char *cells;                // what we want on screen, row by row
+    char *shown;                // what we last sent
+    int fShownValid;            // zero if the terminal needs a full redraw
+    const char *szBlock;        // how to show TERM_BLOCK
+    char *out;                  // output for the terminal
+    size_t cbOutMax;
+} TERMSCREEN;
+
+int CreateTermScreen(TERMSCREEN *screen, int cols, int rows,
+                     const char *szBlock);
+void FreeTermScreen(TERMSCREEN *screen);
+
+void DrawTermClock(TERMSCREEN *screen, const CLOCKSTATE *state);
+size_t UpdateTermScreen(TERMSCREEN *screen);
+
+#endif /* TERMSCREEN_H */
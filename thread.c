@@ -0,0 +1,262 @@
+/*
+ * Portable threads for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef _WIN32
+#  define WINVER 0x400
+#  include <windows.h>
+#else
+#  define _GNU_SOURCE
+#  include <errno.h>
+#  include <pthread.h>
+#  include <sched.h>
+#  include <time.h>
+#endif
+
+#include <string.h> // for memset()
+
+#include "thread.h"
+
+#ifdef _WIN32
+/*
+ * Processor groups (Windows 7 and newer) are needed to use more than 64
+ * CPUs. We declare our own GROUP_AFFINITY so we don't need a newer WINVER.
+ */
+typedef struct tagCPUGROUPAFFINITY {
+    ULONG_PTR Mask;
+    WORD Group;
+    WORD Reserved[3];
+} CPUGROUPAFFINITY;
+
+typedef WORD (WINAPI *PROC_GAPGC)(void);
+typedef DWORD (WINAPI *PROC_GAPC)(WORD);
+typedef BOOL (WINAPI *PROC_STGA)(HANDLE, const CPUGROUPAFFINITY *,
+                                 CPUGROUPAFFINITY *);
+
+#define ALL_CPU_GROUPS 0xFFFF
+#endif
+
+#ifdef _WIN32
+static DWORD WINAPI ThreadStart(LPVOID lpParameter);
+#else
+static void *ThreadStart(void *arg);
+#endif
+
+/*
+ * Start a thread running proc(arg).
+ * Returns 0 on success, -1 on failure.
+ */
+int
+StartThread(THREAD *thread, THREADPROC proc, void *arg)
+{
+#ifdef _WIN32
+    DWORD dwThreadId;
+#endif
+
+    thread->proc = proc;
+    thread->arg = arg;
+
+#ifdef _WIN32
+    // Windows 95, 98, and Me fail if there's nowhere to put the thread ID
+    thread->hThread = CreateThread(NULL, 0, ThreadStart, thread, 0,
+                                   &dwThreadId);
+    return (thread->hThread == NULL) ? -1 : 0;
+#else
+    thread->fJoinable =
+        (pthread_create(&thread->thread, NULL, ThreadStart, thread) == 0);
+    return thread->fJoinable ? 0 : -1;
+#endif
+}
+
+/*
+ * Wait for a thread to finish.
+ * Does nothing if the thread was never started or was already joined.
+ */
+void
+JoinThread(THREAD *thread)
+{
+#ifdef _WIN32
+    if (thread->hThread == NULL)
+        return;
+    WaitForSingleObject(thread->hThread, INFINITE);
+    CloseHandle(thread->hThread);
+    thread->hThread = NULL;
+#else
+    if (!thread->fJoinable)
+        return;
+    pthread_join(thread->thread, NULL);
+    thread->fJoinable = 0;
+#endif
+}
+
+/*
+ * Run the calling thread at a higher priority, if we're allowed to.
+ * Probe threads use this so they measure the system, not the scheduler's
+ * opinion of us.
+ */
+void
+RaiseThreadPriority(void)
+{
+#ifdef _WIN32
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+#else
+    struct sched_param param;
+
+    // This usually needs privileges; carry on at normal priority if not
+    param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+#endif
+}
+
+/*
+ * Return the number of CPUs we can run on.
+ */
+int
+GetCPUCount(void)
+{
+#ifdef _WIN32
+    HMODULE hmodKernel32;
+    PROC_GAPC pGetActiveProcessorCount;
+    SYSTEM_INFO si;
+
+    hmodKernel32 = GetModuleHandle(TEXT("kernel32.dll"));
+    pGetActiveProcessorCount = (hmodKernel32 == NULL) ? NULL : (PROC_GAPC)
+        GetProcAddress(hmodKernel32, "GetActiveProcessorCount");
+    if (pGetActiveProcessorCount != NULL)
+        return pGetActiveProcessorCount(ALL_CPU_GROUPS);
+
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors;
+#else
+    cpu_set_t set;
+
+    if (sched_getaffinity(0, sizeof(set), &set) != 0)
+        return 1;
+    return CPU_COUNT(&set);
+#endif
+}
+
+/*
+ * Run the calling thread only on the specified CPU, counting from 0 up
+ * to one less than GetCPUCount().
+ * Returns 0 on success, -1 on failure.
+ */
+int
+PinThreadToCPU(int index)
+{
+#ifdef _WIN32
+    HMODULE hmodKernel32;
+    PROC_GAPGC pGetActiveProcessorGroupCount;
+    PROC_GAPC pGetActiveProcessorCount;
+    PROC_STGA pSetThreadGroupAffinity;
+    CPUGROUPAFFINITY affinity;
+    WORD group, cGroups;
+    DWORD cCPUs;
+
+    hmodKernel32 = GetModuleHandle(TEXT("kernel32.dll"));
+    if (hmodKernel32 == NULL)
+        return -1;
+    pGetActiveProcessorGroupCount = (PROC_GAPGC)
+        GetProcAddress(hmodKernel32, "GetActiveProcessorGroupCount");
+    pGetActiveProcessorCount = (PROC_GAPC)
+        GetProcAddress(hmodKernel32, "GetActiveProcessorCount");
+    pSetThreadGroupAffinity = (PROC_STGA)
+        GetProcAddress(hmodKernel32, "SetThreadGroupAffinity");
+
+    if (pGetActiveProcessorGroupCount == NULL
+        || pGetActiveProcessorCount == NULL
+        || pSetThreadGroupAffinity == NULL) {
+        // Before processor groups, there were at most 32 or 64 CPUs
+        if ((unsigned) index >= sizeof(DWORD_PTR) * 8)
+            return -1;
+        return SetThreadAffinityMask(GetCurrentThread(),
+                                     (DWORD_PTR) 1 << index) ? 0 : -1;
+    }
+
+    // Find which group the CPU is in
+    cGroups = pGetActiveProcessorGroupCount();
+    for (group = 0; group < cGroups; ++group) {
+        cCPUs = pGetActiveProcessorCount(group);
+        if ((DWORD) index < cCPUs)
+            break;
+        index -= cCPUs;
+    }
+    if (group == cGroups)
+        return -1;
+
+    memset(&affinity, 0, sizeof(affinity));
+    affinity.Mask = (ULONG_PTR) 1 << index;
+    affinity.Group = group;
+    return pSetThreadGroupAffinity(GetCurrentThread(), &affinity, NULL)
+           ? 0 : -1;
+#else
+    cpu_set_t set;
+    int cpu;
+
+    // CPU numbers may have gaps, so find the index-th one we can use
+    if (sched_getaffinity(0, sizeof(set), &set) != 0)
+        return -1;
+    for (cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        if (CPU_ISSET(cpu, &set) && index-- == 0)
+            break;
+    if (cpu == CPU_SETSIZE)
+        return -1;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+           ? 0 : -1;
+#endif
+}
+
+/*
+ * Sleep for at least the specified number of microseconds.
+ * On Windows, this is rounded up to whole milliseconds.
+ */
+void
+SleepMicroseconds(unsigned long usec)
+{
+#ifdef _WIN32
+    Sleep((usec + 999) / 1000);
+#else
+    struct timespec ts;
+
+    ts.tv_sec = usec / 1000000;
+    ts.tv_nsec = (usec % 1000000) * 1000;
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+        ;
+#endif
+}
+
+#ifdef _WIN32
+DWORD WINAPI
+ThreadStart(LPVOID lpParameter)
+{
+    THREAD *thread = lpParameter;
+
+    thread->proc(thread->arg);
+    return 0;
+}
+#else
+void *
+ThreadStart(void *arg)
+{
+    THREAD *thread = arg;
+
+    thread->proc(thread->arg);
+    return NULL;
+}
+#endif
@@ -0,0 +1,55 @@
+/*
+ * Portable threads for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Just enough of a thread API to run background probes on both Windows
+ * and POSIX systems.
+ */
+
+#ifndef THREAD_H
+#define THREAD_H
+
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <pthread.h>
+#endif
+
+// Size of a cache line, for keeping data written by different threads apart
+#define CACHE_LINE_SIZE 64
+
+typedef void (*THREADPROC)(void *arg);
+
+typedef struct tagTHREAD {
+    THREADPROC proc;
+    void *arg;
+#ifdef _WIN32
+    HANDLE hThread;
+#else
+    pthread_t thread;
+    int fJoinable;              // nonzero if started and not yet joined
+#endif
+} THREAD;
+
+int StartThread(THREAD *thread, THREADPROC proc, void *arg);
+void JoinThread(THREAD *thread);
+void RaiseThreadPriority(void);
+int GetCPUCount(void);
+int PinThreadToCPU(int index);
+void SleepMicroseconds(unsigned long usec);
+
+#endif /* THREAD_H */
@@ -0,0 +1,354 @@
+/*
+ * Fast timestamps for the Uptime Clock's probes.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#if defined(__i386__) || defined(__x86_64__)
+#  include <cpuid.h>
+#  include <x86intrin.h>    // for __rdtsc()
+#  define HAVE_TSC
+#endif
+
+#include <stdatomic.h>
+#include <stdio.h>  // for fopen() and fgets()
+#include <string.h> // for strstr()
+
+#include "thread.h"
+#include "timestamp.h"
+
+/*
+ * How to turn a TSC reading into microseconds: baseUsec plus the ticks
+ * since baseTsc times scale, which is microseconds per tick times 2^32.
+ */
+typedef struct tagTSCSCALE {
+    atomic_ullong baseTsc;
+    atomic_ullong baseUsec;
+    atomic_ullong scale;
+} TSCSCALE;
+
+/*
+ * The scale is kept in two slots. Recalibrating fills in the one not in
+ * use and then bumps generation to switch to it, so readers never wait
+ * on it; a reader that sees generation change under it just tries again.
+ * Unlike a sequence lock, that can't leave a probe thread spinning while
+ * the thread recalibrating is preempted.
+ */
+typedef struct tagTSCCLOCK {
+    atomic_int source;          // TIMESTAMP_OS or TIMESTAMP_TSC
+    atomic_uint generation;     // slot in use is generation & 1
+    TSCSCALE slots[2];
+    atomic_llong offset;        // added to the OS clock after falling back
+    atomic_int fFallingBack;    // nonzero once we've started falling back
+    // Only used by the thread that calibrates
+    unsigned long long startTsc, startUsec; // the first measurement
+    unsigned long long lastUsec;            // the last
+    unsigned long long interval;            // until the next one, in usec
+    double rate;                // ticks per microsecond at startup
+} TSCCLOCK;
+
+static TSCCLOCK tscClock;
+
+#ifdef HAVE_TSC
+static int IsTSCReliable(void);
+static void ReadClockPair(unsigned long long *tsc, unsigned long long *usec);
+static unsigned long long ScaleTSC(unsigned long long tsc);
+static unsigned long long TicksToUsec(unsigned long long ticks,
+                                      unsigned long long scale);
+static void SetTSCScale(unsigned long long tsc, unsigned long long usec,
+                        double usecPerTick);
+static void FallBack(unsigned long long ours, unsigned long long usec);
+#endif
+
+/*
+ * Decide where timestamps come from, calibrating the TSC if we can.
+ * Call this once at startup, before starting any probes; it takes about
+ * 2 * TSC_CALIBRATE_TIME. Until then, timestamps come from the OS clock.
+ */
+void
+InitTimestamps(void)
+{
+#ifdef HAVE_TSC
+    unsigned long long tsc[3], usec[3];
+    double rate1, rate2;
+
+    if (!IsTSCReliable())
+        return;
+
+    // Measure the rate twice, to make sure it's steady
+    ReadClockPair(&tsc[0], &usec[0]);
+    SleepMicroseconds(TSC_CALIBRATE_TIME);
+    ReadClockPair(&tsc[1], &usec[1]);
+    SleepMicroseconds(TSC_CALIBRATE_TIME);
+    ReadClockPair(&tsc[2], &usec[2]);
+    if (usec[1] <= usec[0] || usec[2] <= usec[1]
+        || tsc[1] <= tsc[0] || tsc[2] <= tsc[1])
+        return;
+
+    rate1 = (double) (tsc[1] - tsc[0]) / (usec[1] - usec[0]);
+    rate2 = (double) (tsc[2] - tsc[1]) / (usec[2] - usec[1]);
+    if (rate1 < TSC_MIN_RATE || rate1 > TSC_MAX_RATE
+        || (rate2 > rate1 ? rate2 - rate1 : rate1 - rate2)
+           > rate1 * TSC_MAX_SKEW / 1e6)
+        return;
+
+    tscClock.startTsc = tsc[0];
+    tscClock.startUsec = usec[0];
+    tscClock.lastUsec = usec[2];
+    tscClock.interval = TSC_FIRST_RECALIBRATE;
+    tscClock.rate = (double) (tsc[2] - tsc[0]) / (usec[2] - usec[0]);
+    SetTSCScale(tsc[2], usec[2], 1.0 / tscClock.rate);
+    atomic_store_explicit(&tscClock.source, TIMESTAMP_TSC,
+                          memory_order_release);
+#endif
+}
+
+/*
+ * Return a monotonic timestamp in microseconds.
+ * This is safe to call from any thread.
+ */
+unsigned long long
+GetTimestamp(void)
+{
+#ifdef HAVE_TSC
+    if (atomic_load_explicit(&tscClock.source, memory_order_acquire)
+        == TIMESTAMP_TSC)
+        return ScaleTSC(__rdtsc());
+#endif
+    return GetMonotonicTime()
+           + atomic_load_explicit(&tscClock.offset, memory_order_relaxed);
+}
+
+/*
+ * Re-measure the TSC against the OS clock if it's been long enough, and
+ * adjust the scale so the two meet by the next time, or fall back to the
+ * OS clock if the TSC can't be trusted after all.
+ * Call this regularly, like on each tick, from one thread only.
+ */
+void
+RecalibrateTimestamps(void)
+{
+#ifdef HAVE_TSC
+    unsigned long long tsc, usec, ours;
+    long long error;
+    double rate;
+
+    if (atomic_load_explicit(&tscClock.source, memory_order_relaxed)
+        != TIMESTAMP_TSC)
+        return;
+    if (GetMonotonicTime() - tscClock.lastUsec < tscClock.interval)
+        return;
+
+    ReadClockPair(&tsc, &usec);
+    ours = ScaleTSC(tsc);
+    error = (long long) (ours - usec);
+    if (usec <= tscClock.startUsec || tsc <= tscClock.startTsc
+        || error > TSC_MAX_ERROR || error < -TSC_MAX_ERROR) {
+        FallBack(ours, usec);
+        return;
+    }
+
+    // Over this long, the rate should be measured very precisely
+    rate = (double) (tsc - tscClock.startTsc) / (usec - tscClock.startUsec);
+    if ((rate > tscClock.rate ? rate - tscClock.rate : tscClock.rate - rate)
+        > tscClock.rate * TSC_MAX_SKEW / 1e6) {
+        FallBack(ours, usec);
+        return;
+    }
+
+    // The rate only gets more precise, so we can wait longer next time
+    if (tscClock.interval < TSC_RECALIBRATE_INTERVAL)
+        tscClock.interval *= 2;
+    if (tscClock.interval > TSC_RECALIBRATE_INTERVAL)
+        tscClock.interval = TSC_RECALIBRATE_INTERVAL;
+
+    // Carry on from where we are, so time never jumps
+    SetTSCScale(tsc, ours,
+                (double) ((long long) tscClock.interval - error)
+                / (tscClock.interval * rate));
+    tscClock.lastUsec = usec;
+#endif
+}
+
+/*
+ * Return where timestamps are coming from, TIMESTAMP_OS or TIMESTAMP_TSC.
+ */
+int
+GetTimestampSource(void)
+{
+    return atomic_load_explicit(&tscClock.source, memory_order_relaxed);
+}
+
+/*
+ * Return the TSC rate measured at startup in ticks per microsecond, or
+ * 0 if we're not using it.
+ */
+double
+GetTSCRate(void)
+{
+    return (GetTimestampSource() == TIMESTAMP_TSC) ? tscClock.rate : 0;
+}
+
+#ifdef HAVE_TSC
+/*
+ * Return nonzero if the CPU has an invariant TSC, and the OS doesn't
+ * know of any reason not to use it.
+ */
+int
+IsTSCReliable(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+#ifdef __linux__
+    char sz[256];
+    FILE *fp;
+#endif
+
+    // CPUID.80000007H:EDX[8] is the invariant TSC flag
+    if (__get_cpuid_max(0x80000000, NULL) < 0x80000007
+        || !__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)
+        || !(edx & (1 << 8)))
+        return 0;
+
+#ifdef __linux__
+    // The kernel checks that the TSC is in sync across CPUs and stays
+    // that way, and takes it off this list if not
+    fp = fopen("/sys/devices/system/clocksource/clocksource0/"
+               "available_clocksource", "r");
+    if (fp != NULL) {
+        if (fgets(sz, sizeof(sz), fp) == NULL || strstr(sz, "tsc") == NULL) {
+            fclose(fp);
+            return 0;
+        }
+        fclose(fp);
+    }
+#endif
+    return 1;
+}
+
+/*
+ * Read the TSC and the OS clock at as nearly the same time as we can,
+ * by reading the TSC on either side of the OS clock and keeping the
+ * closest of a few tries.
+ */
+void
+ReadClockPair(unsigned long long *tsc, unsigned long long *usec)
+{
+    unsigned long long before, after, now, best = ~0ULL;
+    int i;
+
+    *tsc = *usec = 0;
+    for (i = 0; i < 5; ++i) {
+        before = __rdtsc();
+        now = GetMonotonicTime();
+        after = __rdtsc();
+        if (after - before < best) {
+            best = after - before;
+            *tsc = before + (after - before) / 2;
+            *usec = now;
+        }
+    }
+}
+
+/*
+ * Convert a TSC reading to microseconds.
+ */
+unsigned long long
+ScaleTSC(unsigned long long tsc)
+{
+    const TSCSCALE *slot;
+    unsigned long long baseTsc, baseUsec, scale;
+    unsigned int generation;
+    int fRetried = 0;
+
+    for (;;) {
+        generation = atomic_load_explicit(&tscClock.generation,
+                                          memory_order_acquire);
+        slot = &tscClock.slots[generation & 1];
+        baseTsc = atomic_load_explicit(&slot->baseTsc, memory_order_relaxed);
+        baseUsec = atomic_load_explicit(&slot->baseUsec,
+                                        memory_order_relaxed);
+        scale = atomic_load_explicit(&slot->scale, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&tscClock.generation, memory_order_relaxed)
+            != generation)
+            continue;
+        if (tsc >= baseTsc)
+            return baseUsec + TicksToUsec(tsc - baseTsc, scale);
+
+        // Another CPU's TSC may be a hair behind the one that set the
+        // base, or we may have read ours just before a recalibration
+        // moved the base past it, so read it again to be sure
+        if (TicksToUsec(baseTsc - tsc, scale) <= TSC_MAX_BEHIND)
+            return baseUsec;
+        if (fRetried) {
+            // The TSC was reset, like on resume from suspend; rather than
+            // stand still until the next recalibration, stop using it
+            FallBack(baseUsec, GetMonotonicTime());
+            return baseUsec;
+        }
+        tsc = __rdtsc();
+        fRetried = 1;
+    }
+}
+
+/*
+ * Convert a number of TSC ticks to microseconds at the specified scale.
+ */
+unsigned long long
+TicksToUsec(unsigned long long ticks, unsigned long long scale)
+{
+    // Split the multiplication so it can't overflow
+    return (ticks >> 32) * scale + (((ticks & 0xFFFFFFFFULL) * scale) >> 32);
+}
+
+/*
+ * Switch to a new scale, starting from usec at the TSC reading tsc.
+ */
+void
+SetTSCScale(unsigned long long tsc, unsigned long long usec,
+            double usecPerTick)
+{
+    unsigned int generation;
+    TSCSCALE *slot;
+
+    generation = atomic_load_explicit(&tscClock.generation,
+                                      memory_order_relaxed) + 1;
+    slot = &tscClock.slots[generation & 1];
+    atomic_store_explicit(&slot->baseTsc, tsc, memory_order_relaxed);
+    atomic_store_explicit(&slot->baseUsec, usec, memory_order_relaxed);
+    atomic_store_explicit(&slot->scale,
+                          (unsigned long long) (usecPerTick * 4294967296.0
+                                                + 0.5),
+                          memory_order_relaxed);
+    atomic_store_explicit(&tscClock.generation, generation,
+                          memory_order_release);
+}
+
+/*
+ * Stop using the TSC, carrying on from ours, the last timestamp it gave,
+ * at usec on the OS clock. Only the first thread to get here does this.
+ */
+void
+FallBack(unsigned long long ours, unsigned long long usec)
+{
+    if (atomic_exchange_explicit(&tscClock.fFallingBack, 1,
+                                 memory_order_relaxed))
+        return;
+
+    atomic_store_explicit(&tscClock.offset, (long long) (ours - usec),
+                          memory_order_relaxed);
+    atomic_store_explicit(&tscClock.source, TIMESTAMP_OS,
+                          memory_order_release);
+}
+#endif
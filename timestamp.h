@@ -0,0 +1,77 @@
+/*
+ * Fast timestamps for the Uptime Clock's probes.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The probes take a timestamp or two every millisecond, so what that
+ * costs adds up. On x86 CPUs with an invariant time stamp counter (one
+ * that runs at a constant rate in every power state), GetTimestamp()
+ * reads the TSC directly and scales it to microseconds, which is a few
+ * times cheaper than even a vDSO clock_gettime(), and much cheaper than
+ * QueryPerformanceCounter() on systems where that isn't TSC-based.
+ *
+ * The TSC's rate is measured against GetMonotonicTime() at startup, and
+ * RecalibrateTimestamps() re-measures it every so often, steering the
+ * scale so the two stay together. If the CPU doesn't advertise an
+ * invariant TSC, Linux has marked it unstable, the measurements disagree,
+ * or it strays too far from the OS clock or jumps backward later on, we
+ * use the OS clock instead. Falling back later keeps the timestamps
+ * continuous, so probes that straddle it never see time go backward.
+ *
+ * Like GetMonotonicTime(), timestamps are only meaningful relative to
+ * each other, but they come from the same clock on every thread.
+ */
+
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
+#include "clockcore.h"
+
+// Where GetTimestamp() gets the time
+#define TIMESTAMP_OS  0         // GetMonotonicTime()
+#define TIMESTAMP_TSC 1         // the calibrated TSC
+
+// How long each of the two calibration passes at startup takes, in usec
+#define TSC_CALIBRATE_TIME 10000
+
+// How often RecalibrateTimestamps() re-measures the TSC, in usec. The
+// first time is soon, while the startup rate is still rough, and the
+// interval doubles each time after that.
+#define TSC_FIRST_RECALIBRATE    (1ULL * (USEC_PER_SEC))
+#define TSC_RECALIBRATE_INTERVAL (60ULL * (USEC_PER_SEC))
+
+// Most the TSC's measured rate may change before we stop trusting it,
+// in parts per million
+#define TSC_MAX_SKEW 1000
+
+// Most the TSC may stray from the OS clock between calibrations, in usec
+#define TSC_MAX_ERROR 2000
+
+// Most a TSC reading may be behind the last calibration, in usec, before
+// we decide the TSC was reset
+#define TSC_MAX_BEHIND 100
+
+// Range of TSC rates we believe, in ticks per microsecond (MHz)
+#define TSC_MIN_RATE 100
+#define TSC_MAX_RATE 10000
+
+void InitTimestamps(void);
+unsigned long long GetTimestamp(void);
+void RecalibrateTimestamps(void);
+int GetTimestampSource(void);
+double GetTSCRate(void);
+
+#endif /* TIMESTAMP_H */
@@ -17,54 +17,77 @@
 
 /*
  * To compile:
- * gcc -Os -Wall -Werror -mwindows -o uclock.exe uclock.c
+ * gcc -Os -Wall -Werror -mwindows -o uclock.exe uclock.c glyphs.c clockcore.c \
+ *     histogram.c hiccup.c thread.c uiprobe.c journal.c history.c drift.c \
+ *     cpuprobe.c eventring.c hdrlog.c metrics.c statepage.c timestamp.c \
+ *     -lwsock32
+ *
+ * Or use the Makefile, which also builds the portable clock core natively
+ * for testing and benchmarking.
  */
 
 #define WINVER 0x400        // Windows 95 features
 #define _WIN32_WINNT 0x501  // Windows XP features (for EXECUTION_STATE)
 #include <windows.h>
 
+#include <stdio.h>  // for snprintf()
 #include <stdlib.h> // for malloc() and free()
 #include <string.h> // for memset()
-#include <time.h>   // for time() and localtime()
+
+#include "clockcore.h"
+#include "cpuprobe.h"
+#include "drift.h"
+#include "eventring.h"
+#include "glyphs.h"
+#include "hdrlog.h"
+#include "hiccup.h"
+#include "history.h"
+#include "journal.h"
+#include "metrics.h"
+#include "statepage.h"
+#include "timestamp.h"
+#include "uiprobe.h"
 
 #ifdef UNICODE
 #  include <wchar.h>
-#  define SNPRINTF swprintf
-#  define STRFTIME wcsftime
 #  define STRLEN   wcslen
 #else
-#  include <stdio.h>
-#  define SNPRINTF snprintf
-#  define STRFTIME strftime
 #  define STRLEN   strlen
 #endif
 
-// Window class name
+// Window class names
 #define CLASS_NAME TEXT("Uptime Clock")
+#define ENGINE_CLASS_NAME TEXT("Uptime Clock Engine")
+
+// Most clock windows one process shows
+#define MAX_CLOCK_WINDOWS 16
 
-// Clock format: 03/30/2023 12:34:56 AM (22 chars)
-#define CLOCK_FMT TEXT("%m/%d/%Y %I:%M:%S %p")
-#define CLOCK_LEN 22
+// Command-line option to show a clock on each monitor
+#define OPT_MONITORS "/monitors"
 
-// Uptime format: 365 d, 23 hr, 59 min, 59 sec (28 chars)
-// We're unlikely to see more than a three-digit day count. If Windows has
-// really been running that long without rebooting, we've got other problems.
-#define UPTIME_FMT TEXT("%lld d, %lld hr, %lld min, %lld sec")
-#define UPTIME_LEN 28
+// Command-line option to measure latency on each CPU separately
+#define OPT_PER_CPU "/percpu"
 
-// Label for the uptime display
-#define UPTIME_LABEL     TEXT("System Uptime")
-#define UPTIME_LABEL_LEN 13
+// Command-line option to log latency histograms for monitoring
+#define OPT_HDRLOG "/hdrlog"
+
+// Command-line option to serve metrics for Prometheus
+#define OPT_METRICS "/metrics"
+
+// Tags for the logged histograms
+#define TAG_TICKS   "tick-lateness"
+#define TAG_UI      "ui-dispatch"
+#define TAG_HICCUPS "hiccups"
 
 // Timer numbers
 #define IDT_REFRESH 1
 
-// Unit conversions
-#define MSEC_PER_SEC 1000
-#define MSEC_PER_MIN ((MSEC_PER_SEC) * 60)
-#define MSEC_PER_HR  ((MSEC_PER_MIN) * 60)
-#define MSEC_PER_DAY ((MSEC_PER_HR)  * 24)
+// Private window messages
+#define WM_APP_TICK (WM_APP + 0)
+#define WM_APP_PING (WM_APP + 1)   // wParam is the time it was sent
+
+// Extra delay for WM_TIMER ticks, which may arrive a little early
+#define TIMER_SLOP_MSEC 10
 
 // Keyboard accelerators
 #define cAccel 2
@@ -76,31 +99,69 @@ ACCEL accel[] = {
 // Structure to keep track of window elements
 typedef struct tagCLOCKWINDOW {
     HWND hwnd;
-    TCHAR szClock[CLOCK_LEN + 1];
-    TCHAR szUptime[UPTIME_LEN + 1];
+    BOOL fVisible;
+
+    // Drawing resources and layout, cached between paints and rebuilt
+    // by LayOutClockWindow() when the size or display settings change;
+    // the atlases are shared with other windows of the same size
+    BOOL fLayoutValid;
+    RECT rect;
+    HDC memDC;
+    HBITMAP memBM, oldBM;
+    GLYPHATLAS *atlasClock, *atlasUptime, *atlasStatus;
+    CLOCKLAYOUT layout;
+
+    // Where each line of text was last drawn
+    RECT rcClock, rcUptime;
+    RECT rcStatus[MAX_STATUS_LINES];
 } CLOCKWINDOW, *HCLOCKWINDOW;
 
+// Monitor information; our own MONITORINFO, which needs WINVER 0x500
+typedef struct tagCLOCKMONITORINFO {
+    DWORD cbSize;
+    RECT rcMonitor;
+    RECT rcWork;
+    DWORD dwFlags;
+} CLOCKMONITORINFO;
+
+// Where FindMonitors() puts what it finds
+typedef struct tagMONITORLIST {
+    RECT *rects;
+    int cMax, count;
+} MONITORLIST;
+
 static LRESULT CALLBACK ClockWindowProc(HWND hwnd, UINT uMsg,
                                         WPARAM wParam, LPARAM lParam);
+static LRESULT CALLBACK EngineWindowProc(HWND hwnd, UINT uMsg,
+                                         WPARAM wParam, LPARAM lParam);
+static HWND OpenClockWindow(HINSTANCE hInstance, const RECT *rect);
 static int CreateClockWindow(HWND hwnd);
 static void DestroyClockWindow(HCLOCKWINDOW window);
+static int LayOutClockWindow(HCLOCKWINDOW window, HDC hdc);
+static void FreeClockWindowLayout(HCLOCKWINDOW window);
 static void PaintClockWindow(HCLOCKWINDOW window);
+static HFONT CreateClockFont(int cHeight);
 
 static void StartClock(HCLOCKWINDOW window);
 static void StopClock(HCLOCKWINDOW window);
-static void UpdateClock(HCLOCKWINDOW window);
-
-/*
- * GetTickCount64() (available on Windows Vista and newer) is preferred
- * because GetTickCount() overflows around 49.7 days, but we will fall back
- * for compatiblity with older Windows versions. Plenty of legacy systems
- * still run these obsolete OSes, and someone may find this tool useful for
- * troubleshooting such a system.
- */
-typedef unsigned long long (__cdecl *PROC_GTC64)(void);
-PROC_GTC64 pGetTickCount64;
-#define GetTickCount64OrOtherwise() \
-    ((pGetTickCount64 == NULL) ? GetTickCount() : pGetTickCount64())
+static void ScheduleClock(void);
+static void SetModalLoop(BOOL fModal);
+static void TickClock(void);
+static void UpdateClock(void);
+static void UpdateStatus(void);
+static void InvalidateClockWindow(HCLOCKWINDOW window);
+static void CollectEvents(void);
+static unsigned int CollectStalls(EVENTRING *ring, DRIFTEVENT *stall);
+static void ReportEvent(const DRIFTEVENT *event);
+static int PostPing(void *arg, unsigned long timestamp);
+static int GetDataPath(TCHAR *szPath, DWORD cchPath, const TCHAR *szName);
+static BOOL HasOption(LPCSTR lpCmdLine, LPCSTR szOption);
+static int FindMonitors(RECT *rects, int cMax);
+static BOOL CALLBACK AddMonitor(HANDLE hMonitor, HDC hdc, LPRECT lprc,
+                                LPARAM lParam);
+static void InvalidateChange(HCLOCKWINDOW window, GLYPHATLAS *atlas,
+                             const TCHAR *sz, const CHANGE *change,
+                             RECT *rcText, long y, int cHeight);
 
 /*
  * SetThreadExecutionState() (available on Windows XP and newer) is
@@ -109,6 +170,95 @@ PROC_GTC64 pGetTickCount64;
 typedef EXECUTION_STATE (__cdecl *PROC_STES)(EXECUTION_STATE);
 PROC_STES pSetThreadExecutionState;
 
+/*
+ * Waitable timers (available on Windows 98, NT 4.0, and newer) let us
+ * wake up on an absolute second boundary, which WM_TIMER can't do. On
+ * Windows 95 we fall back to re-arming a WM_TIMER on every tick.
+ */
+typedef HANDLE (WINAPI *PROC_CWT)(LPVOID, BOOL, LPCSTR);
+typedef BOOL (WINAPI *PROC_SWT)(HANDLE, const LARGE_INTEGER *, LONG,
+                                LPVOID, LPVOID, BOOL);
+typedef BOOL (WINAPI *PROC_CANWT)(HANDLE);
+PROC_CWT pCreateWaitableTimer;
+PROC_SWT pSetWaitableTimer;
+PROC_CANWT pCancelWaitableTimer;
+HANDLE hTickTimer;
+
+/*
+ * EnumDisplayMonitors() and GetMonitorInfo() (available on Windows 98,
+ * 2000, and newer) find where to put a clock on each monitor.
+ */
+typedef BOOL (CALLBACK *PROC_MONITORENUM)(HANDLE, HDC, LPRECT, LPARAM);
+typedef BOOL (WINAPI *PROC_EDM)(HDC, const RECT *, PROC_MONITORENUM,
+                                LPARAM);
+typedef BOOL (WINAPI *PROC_GMI)(HANDLE, CLOCKMONITORINFO *);
+PROC_EDM pEnumDisplayMonitors;
+PROC_GMI pGetMonitorInfo;
+
+/*
+ * Every clock window shows the same thing, so they share one tick, one
+ * set of display strings, and one glyph cache. The tick timer and UI
+ * probe pings go to a hidden engine window, which lives as long as any
+ * clock window does; each clock window just repaints what changed.
+ */
+static HWND hwndEngine;
+static HCLOCKWINDOW clockWindows[MAX_CLOCK_WINDOWS];
+static int cClockWindows;
+static int cVisibleWindows;
+static BOOL fClockRunning;
+static BOOL fModalLoop;         // moving, sizing, or in a menu
+static TICKSCHEDULE tickSchedule;
+static CLOCKSTATE clockState;
+static GLYPHCACHE glyphCache = { CreateClockFont };
+
+/*
+ * Measures stalls on a separate thread so we can show them on the clock.
+ */
+static HICCUPMETER hiccupMeter;
+
+/*
+ * Optionally, does the same on each CPU.
+ */
+static CPUPROBES cpuProbes;
+
+/*
+ * Measures how long our own messages wait to be dispatched.
+ */
+static UIPROBE uiProbe;
+
+/*
+ * Keeps a record of recent ticks that survives a freeze and reboot.
+ */
+static TICKJOURNAL tickJournal;
+
+/*
+ * Keeps a compressed record of every tick for the long term.
+ */
+static HISTORYFILE tickHistory;
+
+/*
+ * Watches for changes to the wall clock, and where to log them.
+ */
+static DRIFTDETECTOR driftDetector;
+static TCHAR szDriftLog[MAX_PATH];
+
+/*
+ * How late each tick was, and optionally a log of that and the other
+ * latency histograms in HdrHistogram's format.
+ */
+static HISTOGRAM tickLateness;
+static HDRLOG hdrLog;
+
+/*
+ * Optionally, serves the same along with the uptime over HTTP.
+ */
+static METRICSERVER metricServer;
+
+/*
+ * Publishes the same for other programs to read from shared memory.
+ */
+static STATEPAGE statePage;
+
 /*
  * Process clock window messages.
  */
@@ -140,13 +290,17 @@ ClockWindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
             PaintClockWindow(window);
             return 0;
 
-        case WM_TIMER:
-            switch (wParam) {
-                case IDT_REFRESH:
-                    UpdateClock(window);
-                    break;
-            }
-            return 0;
+        case WM_SETTINGCHANGE:
+        case WM_SYSCOLORCHANGE:
+        case WM_DISPLAYCHANGE:
+            // The glyphs are rendered in the system colors and font
+            FlushGlyphCache(&glyphCache);
+            // fall through
+        case WM_SIZE:
+            // Rebuild our drawing resources on the next paint
+            if (window != NULL)
+                window->fLayoutValid = FALSE;
+            break;
 
         case WM_SHOWWINDOW:
             if (wParam)
@@ -155,8 +309,49 @@ ClockWindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
                 StopClock(window);
             return 0;
 
+        case WM_ENTERSIZEMOVE:
+        case WM_ENTERMENULOOP:
+            SetModalLoop(TRUE);
+            break;
+
+        case WM_EXITSIZEMOVE:
+        case WM_EXITMENULOOP:
+            SetModalLoop(FALSE);
+            break;
+
         case WM_DESTROY:
             DestroyClockWindow(window);
+            return 0;
+    }
+
+    return DefWindowProc(hwnd, uMsg, wParam, lParam);
+}
+
+/*
+ * Process engine window messages.
+ */
+LRESULT CALLBACK
+EngineWindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+{
+    switch (uMsg) {
+        case WM_TIMER:
+            switch (wParam) {
+                case IDT_REFRESH:
+                    TickClock();
+                    break;
+            }
+            return 0;
+
+        case WM_APP_TICK:
+            TickClock();
+            return 0;
+
+        case WM_APP_PING:
+            RecordDispatch(&uiProbe, (unsigned long) wParam);
+            return 0;
+
+        case WM_DESTROY:
+            hwndEngine = NULL;
             PostQuitMessage(0);
             return 0;
     }
@@ -164,6 +359,31 @@ ClockWindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
     return DefWindowProc(hwnd, uMsg, wParam, lParam);
 }
 
+/*
+ * Open a clock window, optionally at a specified position and size.
+ * Returns the window, or NULL on failure.
+ */
+HWND
+OpenClockWindow(HINSTANCE hInstance, const RECT *rect)
+{
+    return CreateWindowEx(
+        /* dwExStyle */     0,
+        /* lpClassName */   CLASS_NAME,
+        /* lpWindowName */  TEXT("Uptime Clock"),
+        /* dwStyle */       WS_OVERLAPPEDWINDOW,
+        /* X */             (rect == NULL) ? CW_USEDEFAULT : rect->left,
+        /* Y */             (rect == NULL) ? CW_USEDEFAULT : rect->top,
+        /* nWidth */        (rect == NULL) ? CW_USEDEFAULT
+                                           : rect->right - rect->left,
+        /* nHeight */       (rect == NULL) ? CW_USEDEFAULT
+                                           : rect->bottom - rect->top,
+        /* hwndParent */    NULL,
+        /* hMenu */         NULL,
+        /* hInstance */     hInstance,
+        /* lpParam */       NULL
+    );
+}
+
 /*
  * Create the clock window.
  * Returns 0 on success, -1 on failure.
@@ -173,6 +393,8 @@ CreateClockWindow(HWND hwnd)
 {
     HCLOCKWINDOW window;
 
+    if (cClockWindows == MAX_CLOCK_WINDOWS)
+        return -1;
     window = malloc(sizeof(CLOCKWINDOW));
     if (window == NULL)
         return -1;
@@ -180,21 +402,131 @@ CreateClockWindow(HWND hwnd)
 
     window->hwnd = hwnd;
     SetWindowLongPtr(window->hwnd, GWLP_USERDATA, (LONG_PTR) window);
+    clockWindows[cClockWindows++] = window;
 
     return 0;
 }
 
 /*
  * Destroy the clock window.
+ * Closing the last one shuts down the engine, and with it the clock.
  */
 void
 DestroyClockWindow(HCLOCKWINDOW window)
 {
+    int i;
+
     if (window == NULL)
         return;
 
     StopClock(window);
+    FreeClockWindowLayout(window);
+    for (i = 0; i < cClockWindows; ++i) {
+        if (clockWindows[i] == window) {
+            clockWindows[i] = clockWindows[--cClockWindows];
+            break;
+        }
+    }
     free(window);
+
+    if (cClockWindows == 0 && hwndEngine != NULL)
+        DestroyWindow(hwndEngine);
+}
+
+/*
+ * Lay out the clock window and create the resources to draw it.
+ *
+ * Creating a full-window bitmap, a pair of fonts, and their glyph atlases
+ * is relatively expensive, especially on large screens, so we only do it
+ * when the window size or display settings change rather than on every
+ * paint.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+LayOutClockWindow(HCLOCKWINDOW window, HDC hdc)
+{
+    int i;
+
+    FreeClockWindowLayout(window);
+
+    // Get the window area
+    // Bottom and right coordinates are our height and width, respectively
+    GetClientRect(window->hwnd, &window->rect);
+
+    // Create a compatible memory context to work in
+    window->memDC = CreateCompatibleDC(hdc);
+    if (window->memDC == NULL)
+        goto error;
+
+    // Create a bitmap to hold the display content
+    window->memBM = CreateCompatibleBitmap(hdc,
+                                           window->rect.right,
+                                           window->rect.bottom);
+    if (window->memBM == NULL)
+        goto error;
+    window->oldBM = SelectObject(window->memDC, window->memBM);
+
+    // Set the background mode for text the atlas can't draw
+    SetBkMode(window->memDC, TRANSPARENT);
+
+    // Decide where everything goes
+    LayOutClock(&window->layout, window->rect.right, window->rect.bottom);
+
+    // Use a larger font for the date and time, and a smaller one for
+    // the uptime, and pre-render the glyphs we need in each, unless
+    // another window of the same size already has
+    window->atlasClock = AcquireGlyphAtlas(&glyphCache, hdc,
+                                           window->layout.cHeightClock,
+                                           NULL, 0);
+    window->atlasUptime = AcquireGlyphAtlas(&glyphCache, hdc,
+                                            window->layout.cHeightUptime,
+                                            UPTIME_LABEL, UPTIME_LABEL_LEN);
+    window->atlasStatus = AcquireGlyphAtlas(&glyphCache, hdc,
+                                            window->layout.cHeightStatus,
+                                            NULL, 0);
+    if (window->atlasClock == NULL
+        || window->atlasUptime == NULL
+        || window->atlasStatus == NULL)
+        goto error;
+
+    // We don't know where the text is yet
+    SetRectEmpty(&window->rcClock);
+    SetRectEmpty(&window->rcUptime);
+    for (i = 0; i < MAX_STATUS_LINES; ++i)
+        SetRectEmpty(&window->rcStatus[i]);
+
+    window->fLayoutValid = TRUE;
+    return 0;
+
+error:
+    FreeClockWindowLayout(window);
+    return -1;
+}
+
+/*
+ * Free the resources created by LayOutClockWindow().
+ */
+void
+FreeClockWindowLayout(HCLOCKWINDOW window)
+{
+    window->fLayoutValid = FALSE;
+
+    if (window->memDC != NULL) {
+        SelectObject(window->memDC, window->oldBM);
+        DeleteDC(window->memDC);
+    }
+    if (window->memBM != NULL)
+        DeleteObject(window->memBM);
+    ReleaseGlyphAtlas(&glyphCache, window->atlasClock);
+    ReleaseGlyphAtlas(&glyphCache, window->atlasUptime);
+    ReleaseGlyphAtlas(&glyphCache, window->atlasStatus);
+
+    window->memDC = NULL;
+    window->memBM = NULL;
+    window->oldBM = NULL;
+    window->atlasClock = NULL;
+    window->atlasUptime = NULL;
+    window->atlasStatus = NULL;
 }
 
 /*
@@ -205,95 +537,76 @@ DestroyClockWindow(HCLOCKWINDOW window)
  * latter. (This is especially noticeable on larger screens.) This is a
  * textbook application of double-buffering: We make all our changes in a
  * second, offscreen buffer, then blit them back all at once to display.
+ *
+ * Only the invalidated part of the window is redrawn and blitted, which
+ * on most ticks is just the few characters UpdateClock() saw change. The
+ * text itself is copied from pre-rendered glyphs (see glyphs.c).
  */
 void
 PaintClockWindow(HCLOCKWINDOW window)
 {
-    RECT rect;
     PAINTSTRUCT ps;
     HDC hdc, memDC;
-    HBITMAP memBM, oldBM;
-    HGDIOBJ hOldObj;
-    HFONT hFont;
-    int cHeightClock, cHeightUptime;
-    long x, y, displayHeight;
-
-    // Initialize handles to NULL for safety
-    hdc = NULL;
-    memDC = NULL;
-    memBM = NULL;
-    oldBM = NULL;
-    hOldObj = NULL;
-    hFont = NULL;
-
-    // Get the window area
-    // Bottom and right coordinates are our height and width, respectively
-    GetClientRect(window->hwnd, &rect);
+    RECT *rcPaint;
+    CLOCKLAYOUT *layout;
+    int i;
 
     // Get our window's device context
     hdc = BeginPaint(window->hwnd, &ps);
 
-    // Create a compatible memory context to work in
-    memDC = CreateCompatibleDC(hdc);
-    if (memDC == NULL)
+    // Rebuild our drawing resources if needed
+    if (!window->fLayoutValid && LayOutClockWindow(window, hdc) != 0)
         goto cleanup;
+    memDC = window->memDC;
+    rcPaint = &ps.rcPaint;
+    layout = &window->layout;
 
-    // Create a bitmap to hold the display content
-    memBM = CreateCompatibleBitmap(hdc, rect.right, rect.bottom);
-    if (memBM == NULL)
-        goto cleanup;
-    oldBM = SelectObject(memDC, memBM);
+    // Don't draw outside the invalidated area; any antialiased text
+    // drawn transparently over itself would get darker each time
+    IntersectClipRect(memDC, rcPaint->left, rcPaint->top,
+                      rcPaint->right, rcPaint->bottom);
 
-    // Fill the window with the background color
-    FillRect(memDC, &rect, GetSysColorBrush(COLOR_BTNFACE));
+    // Fill the invalidated area with the background color
+    FillRect(memDC, rcPaint, GetSysColorBrush(COLOR_BTNFACE));
 
-    // Set text alignment and colors
-    SetTextAlign(memDC, TA_TOP | TA_CENTER | TA_NOUPDATECP);
+    // Set text colors
     SetTextColor(memDC, GetSysColor(COLOR_BTNTEXT));
     SetBkColor(memDC, GetSysColor(COLOR_BTNFACE));
-    SetBkMode(memDC, TRANSPARENT);
-
-    // Scale the font size with the window height
-    cHeightClock = rect.bottom / 8;
-    cHeightUptime = rect.bottom / 12;
 
-    // Center the display in the window
-    displayHeight = cHeightClock + 3 * cHeightUptime;
-    x = rect.right / 2;
-    y = (rect.bottom - displayHeight) / 2;
+    // Display the date and time
+    DrawGlyphs(window->atlasClock, memDC, layout->x, layout->yClock,
+               clockState.szClock, STRLEN(clockState.szClock));
 
-    // Use a larger font for the date and time
-    hFont = CreateFont(
-        /* cHeight */           cHeightClock,
-        /* cWidth */            0,
-        /* cEscapement */       0,
-        /* cOrientation */      0,
-        /* cWeight */           FW_REGULAR,
-        /* bItalic */           FALSE,
-        /* bUnderline */        FALSE,
-        /* bStrikeOut */        FALSE,
-        /* iCharSet */          DEFAULT_CHARSET,
-        /* iOutPrecision */     OUT_DEFAULT_PRECIS,
-        /* iClipPrecision */    CLIP_DEFAULT_PRECIS,
-        /* iQuality */          DEFAULT_QUALITY,
-        /* iPitchAndFamily */   FF_DONTCARE,
-        /* pszFaceName */       TEXT("MS Shell Dlg")
-    );
-    if (hFont == NULL)
-        goto cleanup;
+    // Display the system uptime
+    DrawGlyphLabel(window->atlasUptime, memDC, layout->x, layout->yLabel);
+    DrawGlyphs(window->atlasUptime, memDC, layout->x, layout->yUptime,
+               clockState.szUptime, STRLEN(clockState.szUptime));
+
+    // Display the status lines, if any
+    for (i = 0; i < MAX_STATUS_LINES; ++i)
+        DrawGlyphs(window->atlasStatus, memDC, layout->x,
+                   layout->yStatus + i * layout->cHeightStatus,
+                   clockState.szStatus[i],
+                   STRLEN(clockState.szStatus[i]));
+    SelectClipRgn(memDC, NULL);
 
-    // Display the date and time
-    hOldObj = SelectObject(memDC, hFont);
-    TextOut(memDC, x, y, window->szClock, STRLEN(window->szClock));
-    SelectObject(memDC, hOldObj);
-    DeleteObject(hFont);
+    // Blit our changes back into the window's device context
+    BitBlt(hdc, rcPaint->left, rcPaint->top,
+           rcPaint->right - rcPaint->left, rcPaint->bottom - rcPaint->top,
+           memDC, rcPaint->left, rcPaint->top, SRCCOPY);
 
-    // Leave a blank line after the date and time
-    y += cHeightClock + cHeightUptime;
+cleanup:
+    EndPaint(window->hwnd, &ps);
+}
 
-    // Use a smaller font for the uptime
-    hFont = CreateFont(
-        /* cHeight */           cHeightUptime,
+/*
+ * Create a font for the clock window.
+ */
+HFONT
+CreateClockFont(int cHeight)
+{
+    return CreateFont(
+        /* cHeight */           cHeight,
         /* cWidth */            0,
         /* cEscapement */       0,
         /* cOrientation */      0,
@@ -308,96 +621,447 @@ PaintClockWindow(HCLOCKWINDOW window)
         /* iPitchAndFamily */   FF_DONTCARE,
         /* pszFaceName */       TEXT("MS Shell Dlg")
     );
-    if (hFont == NULL)
-        goto cleanup;
+}
 
-    // Display the system uptime
-    hOldObj = SelectObject(memDC, hFont);
-    TextOut(memDC, x, y, UPTIME_LABEL, UPTIME_LABEL_LEN);
-    y += cHeightUptime;
-    TextOut(memDC, x, y, window->szUptime, STRLEN(window->szUptime));
-    SelectObject(memDC, hOldObj);
-    DeleteObject(hFont);
+/*
+ * Start the clock if it isn't running already.
+ * Called when a clock window is about to be shown.
+ */
+void
+StartClock(HCLOCKWINDOW window)
+{
+    if (window->fVisible)
+        return;
+    window->fVisible = TRUE;
+    ++cVisibleWindows;
 
-    // Blit our changes back into the window's device context
-    BitBlt(hdc, 0, 0, rect.right, rect.bottom, memDC, 0, 0, SRCCOPY);
+    // If another window is already showing the clock, just catch up
+    if (fClockRunning) {
+        InvalidateRect(window->hwnd, NULL, FALSE);
+        return;
+    }
 
-cleanup:
-    SelectObject(memDC, oldBM);
-    DeleteDC(memDC);
-    DeleteObject(memBM);
-    EndPaint(window->hwnd, &ps);
+    // Display the clock right away, then keep it updated on each second
+    fClockRunning = TRUE;
+    ScheduleNextTick(&tickSchedule, GetWallTime(), GetMonotonicTime());
+    UpdateClock();
+    ScheduleClock();
 }
 
 /*
- * Start the clock.
- * Called when the clock window is about to be shown.
+ * Stop the clock if no other window is showing it.
+ * Called when a clock window is about to be hidden or destroyed.
  */
 void
-StartClock(HCLOCKWINDOW window)
+StopClock(HCLOCKWINDOW window)
 {
-    SYSTEMTIME lt;
+    if (!window->fVisible)
+        return;
+    window->fVisible = FALSE;
+    if (--cVisibleWindows > 0)
+        return;
 
-    // Synchronize the display within 10ms
-    do {
-        GetLocalTime(&lt);
-        Sleep(2);
-    } while (lt.wMilliseconds % 1000 > 10);
+    fClockRunning = FALSE;
+    if (hTickTimer != NULL)
+        pCancelWaitableTimer(hTickTimer);
+    if (hwndEngine != NULL)
+        KillTimer(hwndEngine, IDT_REFRESH);
+}
 
-    // Display the clock and set a timer to keep it updated
-    UpdateClock(window);
-    SetTimer(window->hwnd, IDT_REFRESH, 1000, (TIMERPROC) NULL);
+/*
+ * Set a timer for the next scheduled clock tick.
+ */
+void
+ScheduleClock(void)
+{
+    LARGE_INTEGER dueTime;
+    unsigned long long now, wait;
+    UINT uElapse;
+
+    now = GetWallTime();
+    wait = (tickSchedule.due > now) ? tickSchedule.due - now : 0;
+
+    // Negative due times are relative, in FILETIME units. An absolute one
+    // would follow the wall clock, and stall if it were set back.
+    if (hTickTimer != NULL && !fModalLoop) {
+        dueTime.QuadPart = -(LONGLONG) (wait * 10);
+        if (pSetWaitableTimer(hTickTimer, &dueTime, 0, NULL, NULL, FALSE))
+            return;
+    }
+
+    // Otherwise, recompute the delay each time so it doesn't drift
+    uElapse = TIMER_SLOP_MSEC + (UINT) (wait / USEC_PER_MSEC);
+    SetTimer(hwndEngine, IDT_REFRESH, uElapse, (TIMERPROC) NULL);
 }
 
 /*
- * Stop the clock.
- * Called when the clock window is about to be hidden or destroyed.
+ * Switch between the waitable timer and WM_TIMER around a modal loop.
+ *
+ * While DefWindowProc() is moving or sizing a window or tracking a menu,
+ * it runs its own message loop, which never waits on the waitable timer
+ * but does dispatch WM_TIMER, so we tick from that until it's done.
  */
 void
-StopClock(HCLOCKWINDOW window)
+SetModalLoop(BOOL fModal)
 {
-    if (window->hwnd != NULL)
-        KillTimer(window->hwnd, IDT_REFRESH);
+    if (fModal == fModalLoop)
+        return;
+    fModalLoop = fModal;
+    if (!fClockRunning || hTickTimer == NULL)
+        return;
+
+    if (fModal)
+        pCancelWaitableTimer(hTickTimer);
+    else
+        KillTimer(hwndEngine, IDT_REFRESH);
+    ScheduleClock();
+}
+
+/*
+ * Process a scheduled clock tick.
+ */
+void
+TickClock(void)
+{
+    long long lateness;
+
+    if (!fClockRunning)
+        return;
+
+    // If we woke up early, just wait out the rest of the second
+    if ((lateness = CompleteTick(&tickSchedule, GetWallTime(),
+                                 GetMonotonicTime())) >= 0) {
+        clockState.lateness = lateness;
+        RecordValue(&tickLateness, lateness);
+        UpdateClock();
+    }
+    ScheduleClock();
 }
 
 /*
  * Update the clock display.
+ *
+ * Everything but the repainting is done once no matter how many windows
+ * there are, and each window repaints only what changed.
  */
 void
-UpdateClock(HCLOCKWINDOW window)
+UpdateClock(void)
 {
-    time_t now;
-    struct tm *timeinfo;
-    unsigned long long ticks, days, hours, minutes, seconds;
-    RECT rect;
+    DRIFTEVENT event;
+    int i;
 
-    // Update the date and time
-    // Don't free timeinfo -- it's a pointer to static memory
-    time(&now);
-    timeinfo = localtime(&now);
+    // Update the date, time, and uptime display strings
+    if (UpdateClockState(&clockState) != 0)
+        return;
+    AppendTick(&tickJournal, &clockState);
+    AppendHistory(&tickHistory, &clockState);
+    if (CheckDrift(&driftDetector, &clockState, &event))
+        ReportEvent(&event);
+    CollectEvents();
+    UpdateStatus();
+    PublishMetrics(&metricServer, &clockState);
+    PublishState(&statePage, &clockState);
+    RecalibrateTimestamps();
+
+    for (i = 0; i < cClockWindows; ++i)
+        if (clockWindows[i]->fVisible)
+            InvalidateClockWindow(clockWindows[i]);
+}
 
-    memset(window->szClock, 0, (CLOCK_LEN + 1) * sizeof(TCHAR));
-    if (STRFTIME(window->szClock, CLOCK_LEN + 1, CLOCK_FMT, timeinfo) == 0)
+/*
+ * Invalidate what changed on this tick in a clock window.
+ */
+void
+InvalidateClockWindow(HCLOCKWINDOW window)
+{
+    int i;
+
+    // If we haven't laid out the window yet, we'll paint all of it anyway
+    if (!window->fLayoutValid) {
+        InvalidateRect(window->hwnd, NULL, FALSE);
         return;
+    }
+
+    // Otherwise, just repaint what changed
+    InvalidateChange(window, window->atlasClock,
+                     clockState.szClock, &clockState.clockChange,
+                     &window->rcClock, window->layout.yClock,
+                     window->layout.cHeightClock);
+    InvalidateChange(window, window->atlasUptime,
+                     clockState.szUptime, &clockState.uptimeChange,
+                     &window->rcUptime, window->layout.yUptime,
+                     window->layout.cHeightUptime);
+    for (i = 0; i < MAX_STATUS_LINES; ++i)
+        InvalidateChange(window, window->atlasStatus,
+                         clockState.szStatus[i],
+                         &clockState.statusChange[i],
+                         &window->rcStatus[i],
+                         window->layout.yStatus
+                         + i * window->layout.cHeightStatus,
+                         window->layout.cHeightStatus);
+}
+
+/*
+ * Update the status lines.
+ */
+void
+UpdateStatus(void)
+{
+    static HISTSNAPSHOT snapshot;   // too big for the stack
+    TCHAR sz[STATUS_LEN + 2];
+    int i, len;
+
+    if (clockState.fAwakeValid)
+        FormatAwakeTime(sz, clockState.awakeTicks);
+    else
+        sz[0] = TEXT('\0');
+    SetStatusLine(&clockState, STATUS_AWAKE, sz);
+
+    SnapshotHistogram(&hiccupMeter.histogram, &snapshot);
+    FormatLatencies(sz, HICCUP_LABEL, &snapshot);
+    SetStatusLine(&clockState, STATUS_HICCUPS, sz);
+
+    SnapshotHistogram(&uiProbe.histogram, &snapshot);
+    FormatLatencies(sz, UIPROBE_LABEL, &snapshot);
+    SetStatusLine(&clockState, STATUS_UI, sz);
+
+    FormatDriftStatus(sz, &driftDetector.last, clockState.now);
+    SetStatusLine(&clockState, STATUS_DRIFT, sz);
+
+    if (cpuProbes.cCPUs > 0) {
+        FormatCPUSummary(sz, &cpuProbes);
+        SetStatusLine(&clockState, STATUS_CPUS, sz);
+        FormatCPUMap(sz, &cpuProbes);
+        SetStatusLine(&clockState, STATUS_CPU_MAP, sz);
+    }
+
+    // Log the status once a minute for DebugView and the like
+    if (clockState.uptime.seconds == 0) {
+        for (i = 0; i < MAX_STATUS_LINES; ++i) {
+            len = STRLEN(clockState.szStatus[i]);
+            if (len == 0)
+                continue;
+            memcpy(sz, clockState.szStatus[i], len * sizeof(TCHAR));
+            sz[len] = TEXT('\n');
+            sz[len + 1] = TEXT('\0');
+            OutputDebugString(sz);
+        }
+    }
+}
+
+/*
+ * Collect the events the probes posted since the last tick.
+ */
+void
+CollectEvents(void)
+{
+    DRIFTEVENT stall;
+    unsigned int lost;
+    char sz[64];
+    int i;
+
+    stall.type = DRIFT_NONE;
+    lost = CollectStalls(&hiccupMeter.events, &stall);
+    for (i = 0; i < cpuProbes.cCPUs; ++i)
+        lost += CollectStalls(&cpuProbes.meters[i].events, &stall);
+    if (stall.type != DRIFT_NONE)
+        ReportEvent(&stall);
+
+    if (lost > 0) {
+        CountDroppedEvents(&statePage, lost);
+        snprintf(sz, sizeof(sz), "Uptime Clock: %u events dropped\n", lost);
+        OutputDebugStringA(sz);
+    }
+}
+
+/*
+ * Read the stalls posted to an event ring.
+ *
+ * A stall usually hits every probe at once, so we merge ones that overlap
+ * into the longest of them rather than reporting it once per CPU. The
+ * merged stall so far is kept in stall; anything that doesn't overlap it
+ * is reported right away.
+ *
+ * Returns the number of events dropped because the ring was full.
+ */
+unsigned int
+CollectStalls(EVENTRING *ring, DRIFTEVENT *stall)
+{
+    EVENTRECORD event;
+
+    while (ReadEvent(ring, &event)) {
+        if (event.type != EVENT_STALL)
+            continue;
 
-    // Now do the uptime display
-    ticks = GetTickCount64OrOtherwise();
-    days = ticks / MSEC_PER_DAY;
-    ticks %= MSEC_PER_DAY;
-    hours = ticks / MSEC_PER_HR;
-    ticks %= MSEC_PER_HR;
-    minutes = ticks / MSEC_PER_MIN;
-    ticks %= MSEC_PER_MIN;
-    seconds = ticks / MSEC_PER_SEC;
-
-    memset(window->szUptime, 0, (UPTIME_LEN + 1) * sizeof(TCHAR));
-    if (SNPRINTF(window->szUptime, UPTIME_LEN + 1,
-                 UPTIME_FMT, days, hours, minutes, seconds) == 0)
+        if (stall->type != DRIFT_NONE
+            && (event.wallTime - event.amount > stall->wallTime
+                || stall->wallTime - stall->amount > event.wallTime)) {
+            ReportEvent(stall);
+            stall->type = DRIFT_NONE;
+        }
+        if (stall->type == DRIFT_NONE || event.amount > stall->amount) {
+            stall->type = DRIFT_STALL;
+            stall->wallTime = event.wallTime;
+            stall->amount = event.amount;
+        }
+    }
+
+    return TakeEventOverflow(ring);
+}
+
+/*
+ * Log an event and show it on screen if it's the most recent.
+ */
+void
+ReportEvent(const DRIFTEVENT *event)
+{
+    if (event->wallTime >= driftDetector.last.wallTime)
+        driftDetector.last = *event;
+    if (event->type == DRIFT_STALL)
+        CountStall(&statePage, event->wallTime, event->amount);
+    if (szDriftLog[0] != TEXT('\0'))
+        LogDriftEvent(szDriftLog, event);
+}
+
+/*
+ * Send a UI responsiveness ping to the engine window.
+ * Called on the probe thread.
+ */
+int
+PostPing(void *arg, unsigned long timestamp)
+{
+    return PostMessage((HWND) arg, WM_APP_PING, (WPARAM) timestamp, 0)
+           ? 0 : -1;
+}
+
+/*
+ * Invalidate the part of a line of text that changed.
+ *
+ * The text is centered, so if its width changed, the whole line moved and
+ * we invalidate everywhere it was or is now. Otherwise we just invalidate
+ * the changed characters.
+ */
+void
+InvalidateChange(HCLOCKWINDOW window, GLYPHATLAS *atlas,
+                 const TCHAR *sz, const CHANGE *change,
+                 RECT *rcText, long y, int cHeight)
+{
+    RECT rcOld, rcChange;
+    long left, cx;
+    int cch;
+
+    if (change->first == change->end)
         return;
 
-    // Force repainting the window
-    GetClientRect(window->hwnd, &rect);
-    RedrawWindow(window->hwnd, &rect, NULL, RDW_INVALIDATE);
+    cch = STRLEN(sz);
+
+    // Find where the whole line is now
+    rcOld = *rcText;
+    cx = MeasureGlyphs(atlas, sz, cch);
+    left = window->layout.x - cx / 2;
+    SetRect(rcText, left, y, left + cx, y + atlas->cy);
+
+    if (rcText->left != rcOld.left || rcText->right != rcOld.right) {
+        UnionRect(&rcChange, rcText, &rcOld);
+    } else {
+        rcChange = *rcText;
+        rcChange.left = left + MeasureGlyphs(atlas, sz, change->first);
+        rcChange.right = left + MeasureGlyphs(atlas, sz,
+                                              (change->end < cch)
+                                              ? change->end : cch);
+    }
+
+    // Allow for glyphs that overhang their neighbors
+    InflateRect(&rcChange, cHeight / 4, 0);
+    InvalidateRect(window->hwnd, &rcChange, FALSE);
+}
+
+/*
+ * Find where to keep one of our data files.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+GetDataPath(TCHAR *szPath, DWORD cchPath, const TCHAR *szName)
+{
+    size_t cchName;
+    DWORD cch;
+    TCHAR *pch;
+
+    // Put it in the same directory as the clock
+    cch = GetModuleFileName(NULL, szPath, cchPath);
+    if (cch == 0 || cch >= cchPath)
+        return -1;
+    for (pch = szPath + cch; pch > szPath && pch[-1] != TEXT('\\'); --pch)
+        ;
+
+    cchName = STRLEN(szName);
+    if ((DWORD) (pch - szPath) + cchName >= cchPath)
+        return -1;
+    memcpy(pch, szName, (cchName + 1) * sizeof(TCHAR));
+    return 0;
+}
+
+/*
+ * Check whether an option was given on the command line.
+ */
+BOOL
+HasOption(LPCSTR lpCmdLine, LPCSTR szOption)
+{
+    char szArg[32];
+    int cch;
+
+    while (*lpCmdLine != '\0') {
+        // Copy out the next whitespace-separated argument
+        while (*lpCmdLine == ' ' || *lpCmdLine == '\t')
+            ++lpCmdLine;
+        for (cch = 0;
+             *lpCmdLine != '\0' && *lpCmdLine != ' ' && *lpCmdLine != '\t';
+             ++lpCmdLine)
+            if (cch < (int) sizeof(szArg) - 1)
+                szArg[cch++] = *lpCmdLine;
+        szArg[cch] = '\0';
+
+        if (cch > 0 && lstrcmpiA(szArg, szOption) == 0)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*
+ * Find the work area of each monitor.
+ * Returns how many were found, or 0 if this version of Windows can't
+ * tell us.
+ */
+int
+FindMonitors(RECT *rects, int cMax)
+{
+    MONITORLIST found;
+
+    if (pEnumDisplayMonitors == NULL || pGetMonitorInfo == NULL)
+        return 0;
+
+    found.rects = rects;
+    found.cMax = cMax;
+    found.count = 0;
+    if (!pEnumDisplayMonitors(NULL, NULL, AddMonitor, (LPARAM) &found))
+        return 0;
+    return found.count;
+}
+
+/*
+ * Add a monitor's work area to those found by FindMonitors().
+ */
+BOOL CALLBACK
+AddMonitor(HANDLE hMonitor, HDC hdc, LPRECT lprc, LPARAM lParam)
+{
+    MONITORLIST *found = (MONITORLIST *) lParam;
+    CLOCKMONITORINFO info;
+
+    info.cbSize = sizeof(info);
+    if (pGetMonitorInfo(hMonitor, &info))
+        found->rects[found->count++] = info.rcWork;
+    return found->count < found->cMax;
 }
 
 int WINAPI
@@ -406,28 +1070,75 @@ WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
 {
     int retval = 0;
     HINSTANCE hinstKernel32;
+    HMODULE hmodUser32;
     HACCEL hAccTable;
     WNDCLASS wc = { };
     MSG msg = { };
-    HWND hwndClock;
+    HWND hwndClocks[MAX_CLOCK_WINDOWS];
+    RECT monitors[MAX_CLOCK_WINDOWS];
+    int i, cMonitors, cWindows;
+    DWORD dwWait;
+    TCHAR szPath[MAX_PATH];
 
     // Initialize handles to NULL for safety
     hinstKernel32 = NULL;
     hAccTable = NULL;
-    hwndClock = NULL;
 
     // Dynamically load functions added in newer Windows versions
     hinstKernel32 = LoadLibrary(TEXT("kernel32.dll"));
     if (hinstKernel32 == NULL) {
-        pGetTickCount64 = NULL;
         pSetThreadExecutionState = NULL;
+        pCreateWaitableTimer = NULL;
+        pSetWaitableTimer = NULL;
+        pCancelWaitableTimer = NULL;
     } else {
-        pGetTickCount64 = (PROC_GTC64)
-            GetProcAddress(hinstKernel32, "GetTickCount64");
         pSetThreadExecutionState = (PROC_STES)
             GetProcAddress(hinstKernel32, "SetThreadExecutionState");
+        pCreateWaitableTimer = (PROC_CWT)
+            GetProcAddress(hinstKernel32, "CreateWaitableTimerA");
+        pSetWaitableTimer = (PROC_SWT)
+            GetProcAddress(hinstKernel32, "SetWaitableTimer");
+        pCancelWaitableTimer = (PROC_CANWT)
+            GetProcAddress(hinstKernel32, "CancelWaitableTimer");
     }
 
+    // user32.dll is always loaded, so we don't need to LoadLibrary() it
+    hmodUser32 = GetModuleHandle(TEXT("user32.dll"));
+    if (hmodUser32 == NULL) {
+        pEnumDisplayMonitors = NULL;
+        pGetMonitorInfo = NULL;
+    } else {
+        pEnumDisplayMonitors = (PROC_EDM)
+            GetProcAddress(hmodUser32, "EnumDisplayMonitors");
+        pGetMonitorInfo = (PROC_GMI)
+            GetProcAddress(hmodUser32, "GetMonitorInfoA");
+    }
+
+    // Create the clock tick timer if we can
+    hTickTimer = NULL;
+    if (pCreateWaitableTimer != NULL
+        && pSetWaitableTimer != NULL
+        && pCancelWaitableTimer != NULL)
+        hTickTimer = pCreateWaitableTimer(NULL, FALSE, NULL);
+
+    InitTickSource();
+    InitTimestamps();
+
+    // Start watching for stalls; the clock still works if we can't
+    InitHistogram(&tickLateness);
+    StartHiccupMeter(&hiccupMeter, HICCUP_INTERVAL, HICCUP_ANY_CPU);
+    if (HasOption(lpCmdLine, OPT_PER_CPU))
+        StartCPUProbes(&cpuProbes, HICCUP_INTERVAL);
+
+    // Likewise, keep a journal and history of ticks if we can
+    if (GetDataPath(szPath, MAX_PATH, JOURNAL_FILE_NAME) == 0)
+        OpenTickJournal(&tickJournal, szPath, JOURNAL_CAPACITY);
+    if (GetDataPath(szPath, MAX_PATH, HISTORY_FILE_NAME) == 0)
+        OpenHistory(&tickHistory, szPath);
+    OpenStatePage(&statePage, UCLOCK_STATE_NAME);
+    if (GetDataPath(szDriftLog, MAX_PATH, DRIFT_LOG_FILE_NAME) != 0)
+        szDriftLog[0] = TEXT('\0');
+
     // Create the accelerator table
     hAccTable = CreateAcceleratorTable(accel, cAccel);
     if (hAccTable == NULL) {
@@ -435,61 +1146,130 @@ WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
         goto cleanup;
     }
 
+    // Register the engine window class, which is never shown
+    wc.lpfnWndProc = EngineWindowProc;
+    wc.hInstance = hInstance;
+    wc.lpszClassName = ENGINE_CLASS_NAME;
+    RegisterClass(&wc);
+
     // Register the Uptime Clock window class
     wc.style |= CS_HREDRAW | CS_VREDRAW; // redraw everything when resized
     wc.lpfnWndProc = ClockWindowProc;
-    wc.hInstance = hInstance;
     wc.hCursor = LoadCursor(NULL, IDC_ARROW);
     wc.hbrBackground = (HBRUSH)(COLOR_BTNFACE + 1);
     wc.lpszClassName = CLASS_NAME;
     RegisterClass(&wc);
 
-    // Create the clock window
-    hwndClock = CreateWindowEx(
-        /* dwExStyle */     0,
-        /* lpClassName */   CLASS_NAME,
-        /* lpWindowName */  TEXT("Uptime Clock"),
-        /* dwStyle */       WS_OVERLAPPEDWINDOW,
-        /* X */             CW_USEDEFAULT,
-        /* Y */             CW_USEDEFAULT,
-        /* nWidth */        CW_USEDEFAULT,
-        /* nHeight */       CW_USEDEFAULT,
-        /* hwndParent */    NULL,
-        /* hMenu */         NULL,
-        /* hInstance */     hInstance,
-        /* lpParam */       NULL
-    );
+    // Create the engine window, which receives the ticks for all clocks
+    hwndEngine = CreateWindowEx(0, ENGINE_CLASS_NAME, TEXT("Uptime Clock"),
+                                WS_OVERLAPPED, 0, 0, 0, 0,
+                                NULL, NULL, hInstance, NULL);
+    if (hwndEngine == NULL) {
+        retval = 1;
+        goto cleanup;
+    }
 
-    if (hwndClock == NULL) {
+    // Create a clock window on each monitor if asked, or else just one
+    cMonitors = 0;
+    if (HasOption(lpCmdLine, OPT_MONITORS))
+        cMonitors = FindMonitors(monitors, MAX_CLOCK_WINDOWS);
+    cWindows = 0;
+    if (cMonitors == 0) {
+        hwndClocks[0] = OpenClockWindow(hInstance, NULL);
+        if (hwndClocks[0] != NULL)
+            cWindows = 1;
+    } else {
+        for (i = 0; i < cMonitors; ++i) {
+            hwndClocks[cWindows] = OpenClockWindow(hInstance, &monitors[i]);
+            if (hwndClocks[cWindows] != NULL)
+                ++cWindows;
+        }
+    }
+
+    if (cWindows == 0) {
         retval = 1;
         goto cleanup;
     }
 
+    // Start measuring how responsive our message loop is
+    StartUIProbe(&uiProbe, UIPROBE_INTERVAL, PostPing, hwndEngine);
+
+    // Log all of the above if asked
+    if (HasOption(lpCmdLine, OPT_HDRLOG)
+        && GetDataPath(szPath, MAX_PATH, HDRLOG_FILE_NAME) == 0) {
+        AddHdrLogSource(&hdrLog, TAG_TICKS, &tickLateness);
+        AddHdrLogSource(&hdrLog, TAG_UI, &uiProbe.histogram);
+        AddHdrLogSource(&hdrLog, TAG_HICCUPS, &hiccupMeter.histogram);
+        StartHdrLog(&hdrLog, szPath, HDRLOG_INTERVAL);
+    }
+    if (HasOption(lpCmdLine, OPT_METRICS)) {
+        AddMetricHistogram(&metricServer, METRIC_TICK_LATENESS,
+                           METRIC_TICK_LATENESS_HELP, &tickLateness);
+        AddMetricHistogram(&metricServer, METRIC_HICCUPS,
+                           METRIC_HICCUPS_HELP, &hiccupMeter.histogram);
+        AddMetricHistogram(&metricServer, METRIC_UI_DISPATCH,
+                           METRIC_UI_DISPATCH_HELP, &uiProbe.histogram);
+        StartMetricServer(&metricServer, METRICS_PORT);
+    }
+
     // Block screen blanking and sleep timeouts
     if (pSetThreadExecutionState != NULL)
         pSetThreadExecutionState(ES_DISPLAY_REQUIRED
                                  | ES_SYSTEM_REQUIRED
                                  | ES_CONTINUOUS);
 
-    // Show the clock window
-    ShowWindow(hwndClock, nCmdShow);
-    SetForegroundWindow(hwndClock);
-
-    // Run the message loop
-    while (GetMessage(&msg, NULL, 0, 0) > 0) {
-        if (!TranslateAccelerator(hwndClock, hAccTable, &msg)) {
-            TranslateMessage(&msg);
-            DispatchMessage(&msg);
+    // Show the clock windows, filling each monitor if there's one for each
+    for (i = 0; i < cWindows; ++i)
+        ShowWindow(hwndClocks[i],
+                   (cMonitors == 0) ? nCmdShow : SW_SHOWMAXIMIZED);
+    SetForegroundWindow(hwndClocks[0]);
+
+    // Run the message loop, also waking up when the tick timer fires
+    for (;;) {
+        dwWait = MsgWaitForMultipleObjects(
+            /* nCount */        (hTickTimer == NULL) ? 0 : 1,
+            /* pHandles */      &hTickTimer,
+            /* fWaitAll */      FALSE,
+            /* dwMilliseconds */ INFINITE,
+            /* dwWakeMask */    QS_ALLINPUT
+        );
+        if (dwWait == WAIT_FAILED)
+            break;
+        if (hTickTimer != NULL && dwWait == WAIT_OBJECT_0)
+            SendMessage(hwndEngine, WM_APP_TICK, 0, 0);
+
+        while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+            if (msg.message == WM_QUIT)
+                goto done;
+            if (msg.hwnd == NULL
+                || !TranslateAccelerator(msg.hwnd, hAccTable, &msg)) {
+                TranslateMessage(&msg);
+                DispatchMessage(&msg);
+            }
         }
     }
 
+done:
+
     // Allow screen blanking and sleep timeouts
     if (pSetThreadExecutionState != NULL)
         pSetThreadExecutionState(ES_CONTINUOUS);
 
 cleanup:
     // Clean up and exit
+    if (hwndEngine != NULL)
+        DestroyWindow(hwndEngine);
     DestroyAcceleratorTable(hAccTable);
+    StopHdrLog(&hdrLog);
+    StopMetricServer(&metricServer);
+    StopUIProbe(&uiProbe);
+    StopHiccupMeter(&hiccupMeter);
+    StopCPUProbes(&cpuProbes);
+    CloseTickJournal(&tickJournal);
+    CloseHistory(&tickHistory);
+    CloseStatePage(&statePage);
+    if (hTickTimer != NULL)
+        CloseHandle(hTickTimer);
     if (hinstKernel32 != NULL)
         FreeLibrary(hinstKernel32);
     return retval;
@@ -0,0 +1,267 @@
+/*
+ * Post-mortem history query tool for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Usage: uclockq [-g seconds] [-s start] [-e end] [-p] [file]
+ *
+ * Lists every gap in the clock's history (uclock.hst by default) longer
+ * than the -g threshold, one second if not given -- that is, every time
+ * the clock missed a tick. With -s and -e, only gaps overlapping that
+ * time range are listed; times are local, as YYYY-MM-DD [HH:MM[:SS]].
+ * With -p, also prints percentiles of the time between ticks over the
+ * range. For example, every gap over 2 seconds between 02:00 and 04:00:
+ *
+ *   uclockq -g 2 -s "2024-05-07 02:00" -e "2024-05-07 04:00"
+ *
+ * Each block's header says what times it covers and its longest gap, so
+ * blocks that can't have a match are skipped without being decoded.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "histogram.h"
+#include "history.h"
+
+// Default history file
+#define DEFAULT_FILE "uclock.hst"
+
+// Percentiles printed with -p
+static const double percentiles[] = { 50.0, 99.0, 99.9, 99.99 };
+#define cPercentiles (sizeof(percentiles) / sizeof(percentiles[0]))
+
+// What we've found so far
+typedef struct tagQUERYRESULT {
+    long cBlocks;               // blocks in the file
+    long cDecoded;              // blocks we had to decode
+    long cGaps;                 // gaps found
+} QUERYRESULT;
+
+static int ParseTime(const char *sz, long long *t);
+static void FormatTime(char *sz, size_t size, long long t);
+static void PrintGap(const HISTORYSAMPLE *before,
+                     const HISTORYSAMPLE *after, void *arg);
+static void RecordGaps(HISTOGRAM *histogram, const HISTORYQUERY *query,
+                       const HISTORYBLOCK *block);
+static void PrintPercentiles(HISTOGRAM *histogram);
+static void Usage(void);
+
+/*
+ * Parse a local time as YYYY-MM-DD [HH:MM[:SS]].
+ * Returns 0 on success, -1 if it isn't one.
+ */
+int
+ParseTime(const char *sz, long long *t)
+{
+    struct tm tm;
+    int n;
+
+    memset(&tm, 0, sizeof(tm));
+    n = sscanf(sz, "%d-%d-%d%*[ T]%d:%d:%d", &tm.tm_year, &tm.tm_mon,
+               &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+    if (n != 3 && n != 5 && n != 6)
+        return -1;
+
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    *t = (long long) mktime(&tm);
+    return (*t == -1) ? -1 : 0;
+}
+
+/*
+ * Format a wall clock time in seconds as a local time.
+ */
+void
+FormatTime(char *sz, size_t size, long long t)
+{
+    time_t tt = (time_t) t;
+    struct tm *tm = localtime(&tt);
+
+    if (tm == NULL || strftime(sz, size, "%Y-%m-%d %H:%M:%S", tm) == 0)
+        snprintf(sz, size, "@%lld", t);
+}
+
+/*
+ * Print a gap in the history.
+ */
+void
+PrintGap(const HISTORYSAMPLE *before, const HISTORYSAMPLE *after, void *arg)
+{
+    QUERYRESULT *result = arg;
+    char szBefore[32], szAfter[32];
+
+    FormatTime(szBefore, sizeof(szBefore), before->time);
+    FormatTime(szAfter, sizeof(szAfter), after->time);
+    printf("%s  %s  %8lld s%s\n", szBefore, szAfter,
+           GetHistoryGap(before, after),
+           (after->uptime < before->uptime) ? "  restarted" : "");
+    ++result->cGaps;
+}
+
+/*
+ * Record every gap in a block that falls in the query's time range.
+ */
+void
+RecordGaps(HISTOGRAM *histogram, const HISTORYQUERY *query,
+           const HISTORYBLOCK *block)
+{
+    HISTORYCURSOR cursor;
+    HISTORYSAMPLE before, after;
+
+    StartHistoryCursor(&cursor, block);
+    if (NextHistorySample(&cursor, &before) != 0)
+        return;
+    while (NextHistorySample(&cursor, &after) == 0) {
+        if (after.time >= query->start && before.time <= query->end)
+            RecordValue(histogram, GetHistoryGap(&before, &after));
+        before = after;
+    }
+}
+
+/*
+ * Print percentiles of the time between ticks.
+ */
+void
+PrintPercentiles(HISTOGRAM *histogram)
+{
+    static HISTSNAPSHOT snapshot;   // too big for the stack
+    unsigned int i;
+
+    SnapshotHistogram(histogram, &snapshot);
+    printf("%llu ticks:", snapshot.totalCount);
+    for (i = 0; i < cPercentiles; ++i)
+        printf(" %g%% %llu s,", percentiles[i],
+               GetValueAtPercentile(&snapshot, percentiles[i]));
+    printf(" max %llu s\n", snapshot.maxValue);
+}
+
+/*
+ * Print a usage message and exit.
+ */
+void
+Usage(void)
+{
+    fprintf(stderr,
+            "Usage: uclockq [-g seconds] [-s start] [-e end] [-p] [file]\n");
+    exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static HISTORYBLOCK block;
+    static HISTOGRAM histogram;
+    HISTORYQUERY query;
+    QUERYRESULT result;
+    HISTORYSAMPLE last;
+    const char *path = DEFAULT_FILE;
+    char *end;
+    int fPercentiles = 0, fHaveLast = 0;
+    FILE *fp;
+
+    query.start = -0x7FFFFFFFFFFFFFFFLL;
+    query.end = 0x7FFFFFFFFFFFFFFFLL;
+    query.threshold = 1;
+
+    --argc;
+    ++argv;
+    while (argc > 0 && argv[0][0] == '-') {
+        if (strcmp(argv[0], "-p") == 0) {
+            fPercentiles = 1;
+        } else if (argc < 2) {
+            Usage();
+        } else if (strcmp(argv[0], "-g") == 0) {
+            query.threshold = strtoll(argv[1], &end, 10);
+            if (*end != '\0' || query.threshold < 0)
+                Usage();
+            --argc;
+            ++argv;
+        } else if (strcmp(argv[0], "-s") == 0
+                   || strcmp(argv[0], "-e") == 0) {
+            if (ParseTime(argv[1], (argv[0][1] == 's')
+                                   ? &query.start : &query.end) != 0)
+                Usage();
+            --argc;
+            ++argv;
+        } else {
+            Usage();
+        }
+        --argc;
+        ++argv;
+    }
+    if (argc > 1)
+        Usage();
+    else if (argc == 1)
+        path = argv[0];
+
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        perror(path);
+        return 1;
+    }
+
+    memset(&result, 0, sizeof(result));
+    InitHistogram(&histogram);
+
+    // Read each block's header, and the rest of it only if we need it
+    while (fread(&block, HISTORY_HEADER_SIZE, 1, fp) == 1) {
+        ++result.cBlocks;
+        if (block.magic != HISTORY_MAGIC || block.count == 0) {
+            fHaveLast = 0;
+            fseek(fp, HISTORY_BLOCK_SIZE - HISTORY_HEADER_SIZE, SEEK_CUR);
+            continue;
+        }
+
+        // The gap between blocks is between their headers
+        if (fHaveLast) {
+            if (MatchHistoryGap(&query, &last, &block.first))
+                PrintGap(&last, &block.first, &result);
+            if (fPercentiles
+                && block.first.time >= query.start && last.time <= query.end)
+                RecordValue(&histogram, GetHistoryGap(&last, &block.first));
+        }
+        last = block.last;
+        fHaveLast = 1;
+
+        if (MayMatchHistoryBlock(&query, &block)
+            || (fPercentiles
+                && block.maxTime >= query.start
+                && block.minTime <= query.end)) {
+            if (fread(block.data, sizeof(block.data), 1, fp) != 1)
+                break;
+            ++result.cDecoded;
+            if (ScanHistoryBlock(&query, &block, PrintGap, &result) < 0)
+                fprintf(stderr, "%s: block %ld is damaged\n",
+                        path, result.cBlocks - 1);
+            if (fPercentiles)
+                RecordGaps(&histogram, &query, &block);
+        } else {
+            fseek(fp, HISTORY_BLOCK_SIZE - HISTORY_HEADER_SIZE, SEEK_CUR);
+        }
+    }
+    fclose(fp);
+
+    printf("%ld gaps over %lld s; decoded %ld of %ld blocks\n",
+           result.cGaps, query.threshold, result.cDecoded, result.cBlocks);
+    if (fPercentiles)
+        PrintPercentiles(&histogram);
+
+    return 0;
+}
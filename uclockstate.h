@@ -0,0 +1,244 @@
+/*
+ * Header-only reader for the Uptime Clock's shared state page.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The clock publishes what it computes on each tick to a small named
+ * shared memory page, so other programs on the same machine can find out
+ * the uptime and when the clock last ticked without asking it anything.
+ * This header is all a reader needs; copy it into your own program.
+ *
+ *     CLOCKSTATEREADER reader;
+ *     CLOCKSNAPSHOT snapshot;
+ *
+ *     if (OpenClockStateReader(&reader, UCLOCK_STATE_NAME) == 0) {
+ *         if (ReadClockSnapshot(&reader, &snapshot) == 0)
+ *             printf("up %llu ms\n", snapshot.ticks);
+ *         CloseClockStateReader(&reader);
+ *     }
+ *
+ * The page is guarded by a sequence lock: the clock makes the sequence
+ * number odd while it writes and even again when it's done, and a reader
+ * retries if the number was odd or changed while it was reading. Readers
+ * map the page read-only and never write to it, so reading costs the
+ * clock nothing, and a read is a dozen or so loads with no system calls.
+ * Opening the page does need a few; keep the reader open.
+ *
+ * On Unix the page is a POSIX shared memory object (which needs -lrt
+ * with glibc older than 2.34), and on Windows a named file mapping.
+ */
+
+#ifndef UCLOCKSTATE_H
+#define UCLOCKSTATE_H
+
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <sched.h>
+#  include <sys/mman.h>
+#  include <unistd.h>
+#endif
+
+#include <stdatomic.h>
+#include <string.h> // for memset()
+
+#define UCLOCK_STATE_MAGIC   0x53534355UL   // "UCSS" in little-endian order
+#define UCLOCK_STATE_VERSION 1
+
+// Name of the page the clock publishes
+#ifdef _WIN32
+#  define UCLOCK_STATE_NAME "UptimeClockState"
+#else
+#  define UCLOCK_STATE_NAME "/uclock-state"
+#endif
+
+// How many times a reader retries before giving up on a busy page, letting
+// the clock run in between in case it was interrupted in the middle
+#define UCLOCK_STATE_RETRIES 1000
+
+// A consistent copy of the clock's state as of its last tick
+typedef struct tagCLOCKSNAPSHOT {
+    unsigned long long wallTime;    // microseconds since the Unix epoch
+    unsigned long long ticks;       // milliseconds since boot
+    unsigned long long awakeTicks;  // same, not counting time suspended
+    long long lateness;             // how late the tick was, in usec
+    unsigned long long tickCount;   // ticks since the clock started
+    unsigned long long stalls;      // stalls reported since then
+    unsigned long long stallTime;   // total length of them, in usec
+    long long longestStall;         // in microseconds
+    unsigned long long lastStall;   // wall time of the last, or 0 if none
+    unsigned long long dropped;     // probe events dropped
+    unsigned int fAwakeValid;       // nonzero if awakeTicks is available
+    unsigned int fStopped;          // nonzero once the clock has exited
+} CLOCKSNAPSHOT;
+
+/*
+ * The page itself. The header is written once, before magic is set; the
+ * rest only under the sequence lock, on its own cache line so readers
+ * polling it don't share a line with anything else the clock touches.
+ */
+typedef struct tagCLOCKSTATEPAGE {
+    atomic_uint magic;
+    unsigned int version;
+    unsigned int size;              // sizeof(CLOCKSTATEPAGE)
+    unsigned int pid;               // process ID of the clock
+    _Alignas(64) atomic_uint sequence;  // odd while being written
+    unsigned int reserved;
+    atomic_ullong wallTime;
+    atomic_ullong ticks;
+    atomic_ullong awakeTicks;
+    atomic_llong lateness;
+    atomic_ullong tickCount;
+    atomic_ullong stalls;
+    atomic_ullong stallTime;
+    atomic_llong longestStall;
+    atomic_ullong lastStall;
+    atomic_ullong dropped;
+    atomic_uint fAwakeValid;
+    atomic_uint fStopped;
+} CLOCKSTATEPAGE;
+
+typedef struct tagCLOCKSTATEREADER {
+    const CLOCKSTATEPAGE *page;
+#ifdef _WIN32
+    HANDLE hMapping;
+#endif
+} CLOCKSTATEREADER;
+
+/*
+ * Open the clock's state page for reading.
+ * Returns 0 on success, -1 if the clock isn't running or the page is from
+ * an incompatible version.
+ */
+static inline int
+OpenClockStateReader(CLOCKSTATEREADER *reader, const char *name)
+{
+    CLOCKSTATEPAGE *page;
+#ifndef _WIN32
+    int fd;
+#endif
+
+    memset(reader, 0, sizeof(CLOCKSTATEREADER));
+
+#ifdef _WIN32
+    reader->hMapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+    if (reader->hMapping == NULL)
+        return -1;
+    page = MapViewOfFile(reader->hMapping, FILE_MAP_READ, 0, 0,
+                         sizeof(CLOCKSTATEPAGE));
+    if (page == NULL) {
+        CloseHandle(reader->hMapping);
+        reader->hMapping = NULL;
+        return -1;
+    }
+#else
+    fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+    page = mmap(NULL, sizeof(CLOCKSTATEPAGE), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);  // the mapping keeps the page
+    if (page == MAP_FAILED)
+        return -1;
+#endif
+
+    reader->page = page;
+    if (atomic_load_explicit(&page->magic, memory_order_acquire)
+            != UCLOCK_STATE_MAGIC
+        || page->version != UCLOCK_STATE_VERSION
+        || page->size != sizeof(CLOCKSTATEPAGE)) {
+#ifdef _WIN32
+        UnmapViewOfFile(page);
+        CloseHandle(reader->hMapping);
+#else
+        munmap(page, sizeof(CLOCKSTATEPAGE));
+#endif
+        memset(reader, 0, sizeof(CLOCKSTATEREADER));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Close the clock's state page.
+ * This is safe to call on a reader that failed to open.
+ */
+static inline void
+CloseClockStateReader(CLOCKSTATEREADER *reader)
+{
+    if (reader->page == NULL)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(reader->page);
+    CloseHandle(reader->hMapping);
+#else
+    munmap((void *) reader->page, sizeof(CLOCKSTATEPAGE));
+#endif
+    memset(reader, 0, sizeof(CLOCKSTATEREADER));
+}
+
+/*
+ * Read a consistent snapshot of the clock's state.
+ * Returns 0 on success, -1 if the clock was in the middle of writing the
+ * page on every try, which would mean it died doing so.
+ */
+static inline int
+ReadClockSnapshot(const CLOCKSTATEREADER *reader, CLOCKSNAPSHOT *snapshot)
+{
+#define UCLOCK_LOAD(field) \
+    atomic_load_explicit(&page->field, memory_order_relaxed)
+
+    // The page is mapped read-only, but C11 atomics take non-const pointers
+    CLOCKSTATEPAGE *page = (CLOCKSTATEPAGE *) reader->page;
+    unsigned int before, after;
+    int i;
+
+    for (i = 0; i < UCLOCK_STATE_RETRIES; ++i) {
+        before = atomic_load_explicit(&page->sequence, memory_order_acquire);
+        if (before & 1) {
+#ifdef _WIN32
+            Sleep(0);
+#else
+            sched_yield();
+#endif
+            continue;
+        }
+
+        snapshot->wallTime = UCLOCK_LOAD(wallTime);
+        snapshot->ticks = UCLOCK_LOAD(ticks);
+        snapshot->awakeTicks = UCLOCK_LOAD(awakeTicks);
+        snapshot->lateness = UCLOCK_LOAD(lateness);
+        snapshot->tickCount = UCLOCK_LOAD(tickCount);
+        snapshot->stalls = UCLOCK_LOAD(stalls);
+        snapshot->stallTime = UCLOCK_LOAD(stallTime);
+        snapshot->longestStall = UCLOCK_LOAD(longestStall);
+        snapshot->lastStall = UCLOCK_LOAD(lastStall);
+        snapshot->dropped = UCLOCK_LOAD(dropped);
+        snapshot->fAwakeValid = UCLOCK_LOAD(fAwakeValid);
+        snapshot->fStopped = UCLOCK_LOAD(fStopped);
+
+        // Keep the loads above from moving past the check below
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&page->sequence, memory_order_relaxed);
+        if (after == before)
+            return 0;
+    }
+    return -1;
+
+#undef UCLOCK_LOAD
+}
+
+#endif /* UCLOCKSTATE_H */
@@ -0,0 +1,298 @@
+/*
+ * Terminal front-end for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Usage: uclockterm [-a] [-u] [-l file] [-m port]
+ *
+ * Shows the clock on a terminal, for servers with only a serial console
+ * or an SSH session. Large digits are drawn with '#', or with block
+ * characters if the locale uses UTF-8; -a and -u force one or the other.
+ * With -l, clock changes and stalls are logged to the specified file.
+ * With -m, metrics are served for Prometheus on the specified port on
+ * 127.0.0.1 (see metrics.h). Press q to quit.
+ *
+ * Each tick sends only the characters that changed, in a single write(),
+ * so the clock keeps up even over a 9600-baud line.
+ */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE   // for pipe2()
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <langinfo.h>
+#include <locale.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "clockcore.h"
+#include "diag.h"
+#include "termscreen.h"
+#include "timestamp.h"
+
+// Size to assume if the terminal won't tell us
+#define DEFAULT_COLS 80
+#define DEFAULT_ROWS 24
+
+// Sent on startup and exit: switch to the alternate screen and hide the
+// cursor, and the reverse
+#define TERM_START "\033[?1049h\033[?25l"
+#define TERM_END   "\033[?25h\033[?1049l"
+
+static int OpenScreen(TERMSCREEN *screen, const char *szBlock);
+static int WriteAll(int fd, const char *buf, size_t len);
+static void UpdateTerm(TERMSCREEN *screen, CLOCKSTATE *state);
+static void HandleSignal(int sig);
+static void Usage(void);
+
+static DIAGNOSTICS diag;
+
+// Signals are passed to the event loop through this pipe
+static int signalPipe[2] = { -1, -1 };
+
+/*
+ * Size the screen to match the terminal.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+OpenScreen(TERMSCREEN *screen, const char *szBlock)
+{
+    struct winsize ws;
+    int cols = DEFAULT_COLS, rows = DEFAULT_ROWS;
+
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0
+        && ws.ws_col > 0 && ws.ws_row > 0) {
+        cols = ws.ws_col;
+        rows = ws.ws_row;
+    }
+
+    FreeTermScreen(screen);
+    return CreateTermScreen(screen, cols, rows, szBlock);
+}
+
+/*
+ * Write everything in a buffer, even if it takes more than one write().
+ * Returns 0 on success, -1 on failure.
+ */
+int
+WriteAll(int fd, const char *buf, size_t len)
+{
+    ssize_t cb;
+
+    while (len > 0) {
+        cb = write(fd, buf, len);
+        if (cb < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += cb;
+        len -= cb;
+    }
+    return 0;
+}
+
+/*
+ * Update the clock and send the terminal whatever changed.
+ */
+void
+UpdateTerm(TERMSCREEN *screen, CLOCKSTATE *state)
+{
+    size_t len;
+
+    UpdateClockState(state);
+    UpdateDiagnostics(&diag, state);
+
+    DrawTermClock(screen, state);
+    len = UpdateTermScreen(screen);
+    if (len > 0)
+        WriteAll(STDOUT_FILENO, screen->out, len);
+}
+
+/*
+ * Pass a signal to the event loop.
+ */
+void
+HandleSignal(int sig)
+{
+    unsigned char c = (unsigned char) sig;
+    int saved = errno;
+
+    if (write(signalPipe[1], &c, 1) < 0)
+        ;   // the loop already has one to read
+    errno = saved;
+}
+
+/*
+ * Print a usage message and exit.
+ */
+void
+Usage(void)
+{
+    fprintf(stderr, "Usage: uclockterm [-a] [-u] [-l file] [-m port]\n");
+    exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static CLOCKSTATE state;
+    TERMSCREEN screen;
+    TICKSCHEDULE schedule;
+    struct termios saved, raw;
+    struct sigaction sa;
+    struct pollfd fds[3];
+    const char *szBlock = NULL, *szDriftLog = NULL;
+    unsigned long long now;
+    long long lateness;
+    unsigned long port = 0;
+    int fRaw = 0, fRunning = 1, timeout;
+    unsigned char c;
+    char *end;
+
+    --argc;
+    ++argv;
+    while (argc > 0 && argv[0][0] == '-') {
+        if (strcmp(argv[0], "-a") == 0) {
+            szBlock = TERM_ASCII_BLOCK;
+        } else if (strcmp(argv[0], "-u") == 0) {
+            szBlock = TERM_UTF8_BLOCK;
+        } else if (strcmp(argv[0], "-l") == 0 && argc > 1) {
+            szDriftLog = argv[1];
+            --argc;
+            ++argv;
+        } else if (strcmp(argv[0], "-m") == 0 && argc > 1) {
+            port = strtoul(argv[1], &end, 10);
+            if (*end != '\0' || port == 0 || port > 65535)
+                Usage();
+            --argc;
+            ++argv;
+        } else {
+            Usage();
+        }
+        --argc;
+        ++argv;
+    }
+    if (argc > 0)
+        Usage();
+
+    // Only the character set; the clock and metrics are always in the
+    // C locale's format
+    setlocale(LC_CTYPE, "");
+    if (szBlock == NULL)
+        szBlock = (strcmp(nl_langinfo(CODESET), "UTF-8") == 0)
+                  ? TERM_UTF8_BLOCK : TERM_ASCII_BLOCK;
+
+    memset(&screen, 0, sizeof(screen));
+    if (OpenScreen(&screen, szBlock) != 0) {
+        perror("uclockterm");
+        return 1;
+    }
+
+    // Resizing or interrupting us wakes up the event loop
+    if (pipe2(signalPipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+        perror("uclockterm");
+        return 1;
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = HandleSignal;
+    sigaction(SIGWINCH, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+
+    InitTickSource();
+    InitTimestamps();
+    if (StartDiagnostics(&diag, szDriftLog, (unsigned short) port,
+                         UCLOCK_STATE_NAME) != 0) {
+        perror("uclockterm");
+        return 1;
+    }
+
+    // Read keys as they're typed, without echoing them
+    if (tcgetattr(STDIN_FILENO, &saved) == 0) {
+        raw = saved;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 0;
+        raw.c_cc[VTIME] = 0;
+        fRaw = (tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0);
+    }
+
+    WriteAll(STDOUT_FILENO, TERM_START, sizeof(TERM_START) - 1);
+    ScheduleNextTick(&schedule, GetWallTime(), GetMonotonicTime());
+    UpdateTerm(&screen, &state);
+
+    fds[0].fd = signalPipe[0];
+    fds[1].fd = STDIN_FILENO;
+    fds[2].fd = diag.uiProbe.fd;
+    fds[0].events = fds[1].events = fds[2].events = POLLIN;
+    while (fRunning) {
+        // Sleep until the next tick, or something else needs our attention
+        now = GetWallTime();
+        timeout = (schedule.due > now)
+                  ? (int) ((schedule.due - now + USEC_PER_MSEC - 1)
+                           / USEC_PER_MSEC)
+                  : 0;
+        if (timeout > MSEC_PER_SEC)
+            timeout = MSEC_PER_SEC;     // in case the clock was set back
+        if (poll(fds, 3, timeout) < 0 && errno != EINTR)
+            break;
+
+        if (fds[0].revents & POLLIN) {
+            while (read(signalPipe[0], &c, 1) == 1) {
+                if (c != SIGWINCH) {
+                    fRunning = 0;
+                } else if (OpenScreen(&screen, szBlock) != 0) {
+                    fRunning = 0;
+                } else {
+                    DrawTermClock(&screen, &state);
+                    WriteAll(STDOUT_FILENO, screen.out,
+                             UpdateTermScreen(&screen));
+                }
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            if (read(STDIN_FILENO, &c, 1) == 1 && (c == 'q' || c == 'Q'))
+                fRunning = 0;
+        } else if (fds[1].revents & (POLLHUP | POLLERR)) {
+            fds[1].fd = -1;     // stdin went away, but we can keep going
+        }
+        if (fds[2].revents & POLLIN)
+            ReadUIProbePings(&diag.uiProbe);
+
+        lateness = CompleteTick(&schedule, GetWallTime(), GetMonotonicTime());
+        if (fRunning && lateness >= 0) {
+            state.lateness = lateness;
+            UpdateTerm(&screen, &state);
+        }
+    }
+
+    WriteAll(STDOUT_FILENO, TERM_END, sizeof(TERM_END) - 1);
+    if (fRaw)
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+
+    StopDiagnostics(&diag);
+    FreeTermScreen(&screen);
+    return 0;
+}
@@ -0,0 +1,406 @@
+/*
+ * X11 front-end for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Usage: uclockx [-f] [-n] [-l file] [-m port] [-b frames]
+ *
+ * Shows the clock in an X window, laid out like the Windows version, for
+ * kiosks that run a bare X server. With -f, the window fills the screen.
+ * With -n, MIT-SHM isn't used even if it's available. With -l, clock
+ * changes and stalls are logged to the specified file. With -m, metrics
+ * are served for Prometheus on the specified port on 127.0.0.1 (see
+ * metrics.h). Press q to quit.
+ *
+ * With -b, instead ticks a simulated clock as fast as the server keeps up
+ * for the specified number of frames, and reports what each frame cost,
+ * including the round trip to wait for the server to finish it. This
+ * works under Xvfb, e.g.:
+ *
+ *   xvfb-run -s "-screen 0 1920x1080x24" ./uclockx -f -b 10000
+ */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE   // for pipe2()
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+#include "clockcore.h"
+#include "diag.h"
+#include "render.h"
+#include "simclock.h"
+#include "timestamp.h"
+#include "xface.h"
+
+// Window size if not full screen
+#define DEFAULT_WIDTH  640
+#define DEFAULT_HEIGHT 480
+
+// Full frames -b sends for comparison, as a fraction of the ticks
+#define FULL_FRAME_RATIO 10
+
+static Window CreateClockWindow(int fFullScreen);
+static int HandleEvent(XEvent *event);
+static void Benchmark(unsigned long cFrames);
+static double Seconds(void);
+static void HandleSignal(int sig);
+static void Usage(void);
+
+static Display *display;
+static Window window;
+static Atom wmDeleteWindow;
+static XFACE xface;
+static int fAllowShm = 1;
+static CLOCKSTATE state;
+static DIAGNOSTICS diag;
+
+// Signals are passed to the event loop through this pipe
+static int signalPipe[2] = { -1, -1 };
+
+/*
+ * Create and show the clock window.
+ */
+Window
+CreateClockWindow(int fFullScreen)
+{
+    int screen = DefaultScreen(display);
+    int width = DEFAULT_WIDTH, height = DEFAULT_HEIGHT;
+    XSetWindowAttributes attrs;
+    Atom wmState, fullScreen;
+    Window w;
+
+    if (fFullScreen) {
+        width = DisplayWidth(display, screen);
+        height = DisplayHeight(display, screen);
+    }
+
+    // We paint every pixel ourselves, so the server needn't clear them
+    attrs.background_pixmap = None;
+    attrs.event_mask = ExposureMask | StructureNotifyMask | KeyPressMask;
+    w = XCreateWindow(display, RootWindow(display, screen), 0, 0,
+                      width, height, 0, CopyFromParent, InputOutput,
+                      CopyFromParent, CWBackPixmap | CWEventMask, &attrs);
+    XStoreName(display, w, "Uptime Clock");
+
+    wmDeleteWindow = XInternAtom(display, "WM_DELETE_WINDOW", False);
+    XSetWMProtocols(display, w, &wmDeleteWindow, 1);
+
+    // Ask a window manager, if there is one, not to decorate it
+    if (fFullScreen) {
+        wmState = XInternAtom(display, "_NET_WM_STATE", False);
+        fullScreen = XInternAtom(display, "_NET_WM_STATE_FULLSCREEN", False);
+        XChangeProperty(display, w, wmState, XA_ATOM, 32, PropModeReplace,
+                        (unsigned char *) &fullScreen, 1);
+    }
+
+    XMapWindow(display, w);
+    return w;
+}
+
+/*
+ * Handle an X event.
+ * Returns zero if it's time to quit.
+ */
+int
+HandleEvent(XEvent *event)
+{
+    FBRECT rc;
+    KeySym key;
+    char c;
+
+    switch (event->type) {
+        case Expose:
+            rc.left = event->xexpose.x;
+            rc.top = event->xexpose.y;
+            rc.right = rc.left + event->xexpose.width;
+            rc.bottom = rc.top + event->xexpose.height;
+            PutXFace(&xface, &rc);
+            return 1;
+
+        case ConfigureNotify:
+            if (event->xconfigure.width == xface.face.fb.width
+                && event->xconfigure.height == xface.face.fb.height)
+                return 1;
+            FreeXFace(&xface);
+            if (CreateXFace(&xface, display, window, event->xconfigure.width,
+                            event->xconfigure.height, fAllowShm) != 0)
+                return 0;
+            DrawXFace(&xface, &state);
+            return 1;
+
+        case KeyPress:
+            if (XLookupString(&event->xkey, &c, 1, &key, NULL) == 1
+                && (c == 'q' || c == 'Q'))
+                return 0;
+            return 1;
+
+        case ClientMessage:
+            return (Atom) event->xclient.data.l[0] != wmDeleteWindow;
+
+        default:
+            HandleXFaceEvent(&xface, event);
+            return 1;
+    }
+}
+
+/*
+ * Measure what a frame costs, both a normal tick and a full repaint.
+ */
+void
+Benchmark(unsigned long cFrames)
+{
+    static SIMCLOCK sim;
+    FBRECT rcAll;
+    XEvent event;
+    unsigned long i, cPixels, cFull;
+    double start, tick, full;
+
+    // Wait for the window to appear
+    do {
+        XNextEvent(display, &event);
+        HandleXFaceEvent(&xface, &event);
+    } while (event.type != MapNotify);
+
+    state.source = &sim.source;
+    StartSimClock(&sim, (unsigned long long) time(NULL) * USEC_PER_SEC,
+                  123456789ULL, 0);
+    UpdateClockState(&state);
+    DrawXFace(&xface, &state);
+    XSync(display, False);
+
+    cPixels = xface.cPixelsSent;
+    start = Seconds();
+    for (i = 0; i < cFrames; ++i) {
+        AdvanceSimClock(&sim, USEC_PER_SEC);
+        UpdateClockState(&state);
+        DrawXFace(&xface, &state);
+        XSync(display, False);
+    }
+    tick = (Seconds() - start) / cFrames;
+    cPixels = (xface.cPixelsSent - cPixels) / cFrames;
+
+    rcAll.left = rcAll.top = 0;
+    rcAll.right = xface.face.fb.width;
+    rcAll.bottom = xface.face.fb.height;
+    cFull = cFrames / FULL_FRAME_RATIO + 1;
+    start = Seconds();
+    for (i = 0; i < cFull; ++i) {
+        RenderClockFace(&xface.face, &state, NULL);
+        PutXFace(&xface, &rcAll);
+        XSync(display, False);
+        while (XCheckTypedEvent(display, xface.shmCompletion, &event))
+            HandleXFaceEvent(&xface, &event);
+    }
+    full = (Seconds() - start) / cFull;
+
+    printf("%dx%d, %s\n", xface.face.fb.width, xface.face.fb.height,
+           xface.fShm ? "XShmPutImage" : "XPutImage");
+    printf("%-16s %10.1f us/frame %10lu pixels/frame\n",
+           "Tick", tick * 1e6, cPixels);
+    printf("%-16s %10.1f us/frame %10lu pixels/frame\n",
+           "Full frame", full * 1e6,
+           (unsigned long) rcAll.right * rcAll.bottom);
+}
+
+/*
+ * Return a monotonic timestamp in seconds.
+ */
+double
+Seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Pass a signal to the event loop.
+ */
+void
+HandleSignal(int sig)
+{
+    unsigned char c = (unsigned char) sig;
+    int saved = errno;
+
+    if (write(signalPipe[1], &c, 1) < 0)
+        ;   // the loop already has one to read
+    errno = saved;
+}
+
+/*
+ * Print a usage message and exit.
+ */
+void
+Usage(void)
+{
+    fprintf(stderr,
+            "Usage: uclockx [-f] [-n] [-l file] [-m port] [-b frames]\n");
+    exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+    TICKSCHEDULE schedule;
+    XWindowAttributes attrs;
+    XEvent event;
+    struct sigaction sa;
+    struct pollfd fds[3];
+    const char *szDriftLog = NULL;
+    unsigned long long now;
+    long long lateness;
+    unsigned long cFrames = 0, port = 0;
+    int fFullScreen = 0, fRunning = 1, timeout;
+    char *end;
+
+    --argc;
+    ++argv;
+    while (argc > 0 && argv[0][0] == '-') {
+        if (strcmp(argv[0], "-f") == 0) {
+            fFullScreen = 1;
+        } else if (strcmp(argv[0], "-n") == 0) {
+            fAllowShm = 0;
+        } else if (argc < 2) {
+            Usage();
+        } else if (strcmp(argv[0], "-l") == 0) {
+            szDriftLog = argv[1];
+            --argc;
+            ++argv;
+        } else if (strcmp(argv[0], "-m") == 0) {
+            port = strtoul(argv[1], &end, 10);
+            if (*end != '\0' || port == 0 || port > 65535)
+                Usage();
+            --argc;
+            ++argv;
+        } else if (strcmp(argv[0], "-b") == 0) {
+            cFrames = strtoul(argv[1], &end, 10);
+            if (*end != '\0' || cFrames == 0)
+                Usage();
+            --argc;
+            ++argv;
+        } else {
+            Usage();
+        }
+        --argc;
+        ++argv;
+    }
+    if (argc > 0)
+        Usage();
+
+    display = XOpenDisplay(NULL);
+    if (display == NULL) {
+        fprintf(stderr, "uclockx: can't open display %s\n",
+                XDisplayName(NULL));
+        return 1;
+    }
+
+    window = CreateClockWindow(fFullScreen);
+    XGetWindowAttributes(display, window, &attrs);
+    if (CreateXFace(&xface, display, window, attrs.width, attrs.height,
+                    fAllowShm) != 0) {
+        fprintf(stderr, "uclockx: display needs a 24-bit TrueColor visual\n");
+        return 1;
+    }
+
+    if (cFrames > 0) {
+        Benchmark(cFrames);
+        FreeXFace(&xface);
+        XCloseDisplay(display);
+        return 0;
+    }
+
+    // Interrupting us wakes up the event loop
+    if (pipe2(signalPipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+        perror("uclockx");
+        return 1;
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = HandleSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+
+    InitTickSource();
+    InitTimestamps();
+    if (StartDiagnostics(&diag, szDriftLog, (unsigned short) port,
+                         UCLOCK_STATE_NAME) != 0) {
+        perror("uclockx");
+        return 1;
+    }
+
+    ScheduleNextTick(&schedule, GetWallTime(), GetMonotonicTime());
+    UpdateClockState(&state);
+    UpdateDiagnostics(&diag, &state);
+    DrawXFace(&xface, &state);
+
+    fds[0].fd = signalPipe[0];
+    fds[1].fd = ConnectionNumber(display);
+    fds[2].fd = diag.uiProbe.fd;
+    fds[0].events = fds[1].events = fds[2].events = POLLIN;
+    while (fRunning) {
+        while (fRunning && XPending(display) > 0) {
+            XNextEvent(display, &event);
+            fRunning = HandleEvent(&event);
+        }
+        XFlush(display);
+        if (!fRunning)
+            break;
+
+        // Sleep until the next tick, or something else needs our attention
+        now = GetWallTime();
+        timeout = (schedule.due > now)
+                  ? (int) ((schedule.due - now + USEC_PER_MSEC - 1)
+                           / USEC_PER_MSEC)
+                  : 0;
+        if (timeout > MSEC_PER_SEC)
+            timeout = MSEC_PER_SEC;     // in case the clock was set back
+        if (poll(fds, 3, timeout) < 0 && errno != EINTR)
+            break;
+
+        if (fds[0].revents & POLLIN)
+            fRunning = 0;
+        if (fds[1].revents & (POLLHUP | POLLERR))
+            fRunning = 0;   // lost the server
+        if (fds[2].revents & POLLIN)
+            ReadUIProbePings(&diag.uiProbe);
+
+        lateness = CompleteTick(&schedule, GetWallTime(), GetMonotonicTime());
+        if (fRunning && lateness >= 0) {
+            state.lateness = lateness;
+            UpdateClockState(&state);
+            UpdateDiagnostics(&diag, &state);
+            DrawXFace(&xface, &state);
+        }
+    }
+
+    StopDiagnostics(&diag);
+    FreeXFace(&xface);
+    XCloseDisplay(display);
+    return 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * User interface responsiveness probe for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _WIN32
+#  define _GNU_SOURCE
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+#include "timestamp.h"
+#include "uiprobe.h"
+
+static void PingUI(void *arg);
+#ifndef _WIN32
+static int WritePing(void *arg, unsigned long timestamp);
+#endif
+
+/*
+ * Start pinging the UI thread every interval microseconds.
+ *
+ * Each ping is sent by calling post(arg, timestamp). The UI thread should
+ * pass the timestamp to RecordDispatch() when it receives the ping. On
+ * systems other than Windows, post may be NULL to send the pings through
+ * a pipe; the event loop should then call ReadUIProbePings() whenever
+ * probe->fd is readable.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+StartUIProbe(UIPROBE *probe, unsigned long interval,
+             UIPOSTPROC post, void *arg)
+{
+#ifndef _WIN32
+    int fds[2];
+#endif
+
+    InitHistogram(&probe->histogram);
+    atomic_init(&probe->fStop, 0);
+    probe->interval = interval;
+    probe->post = post;
+    probe->arg = arg;
+
+#ifndef _WIN32
+    probe->fd = probe->fdWrite = -1;
+    if (post == NULL) {
+        // Never let a stalled event loop block the probe thread
+        if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) != 0)
+            return -1;
+        probe->fd = fds[0];
+        probe->fdWrite = fds[1];
+        probe->post = WritePing;
+        probe->arg = probe;
+    }
+#endif
+
+    if (StartThread(&probe->thread, PingUI, probe) != 0) {
+        StopUIProbe(probe);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Stop pinging the UI thread.
+ * The histogram remains readable afterward.
+ */
+void
+StopUIProbe(UIPROBE *probe)
+{
+    atomic_store(&probe->fStop, 1);
+    JoinThread(&probe->thread);
+
+#ifndef _WIN32
+    if (probe->fd != -1)
+        close(probe->fd);
+    if (probe->fdWrite != -1)
+        close(probe->fdWrite);
+    probe->fd = probe->fdWrite = -1;
+#endif
+}
+
+/*
+ * Record that a ping was dispatched.
+ * Call this on the UI thread with the timestamp the ping was sent with.
+ */
+void
+RecordDispatch(UIPROBE *probe, unsigned long timestamp)
+{
+    // Unsigned subtraction also works if the timestamp was truncated
+    RecordValue(&probe->histogram,
+                (unsigned long) GetTimestamp() - timestamp);
+}
+
+#ifndef _WIN32
+/*
+ * Record every ping waiting in the pipe.
+ */
+void
+ReadUIProbePings(UIPROBE *probe)
+{
+    unsigned long timestamps[64];
+    ssize_t cb;
+    size_t i;
+
+    while ((cb = read(probe->fd, timestamps, sizeof(timestamps))) > 0)
+        for (i = 0; i < cb / sizeof(timestamps[0]); ++i)
+            RecordDispatch(probe, timestamps[i]);
+}
+
+int
+WritePing(void *arg, unsigned long timestamp)
+{
+    UIPROBE *probe = arg;
+
+    // Pings are smaller than PIPE_BUF, so they're never split
+    return (write(probe->fdWrite, &timestamp, sizeof(timestamp))
+            == sizeof(timestamp)) ? 0 : -1;
+}
+#endif
+
+/*
+ * Body of the probe thread.
+ */
+void
+PingUI(void *arg)
+{
+    UIPROBE *probe = arg;
+
+    RaiseThreadPriority();
+    while (!atomic_load_explicit(&probe->fStop, memory_order_relaxed)) {
+        probe->post(probe->arg, (unsigned long) GetTimestamp());
+        SleepMicroseconds(probe->interval);
+    }
+}
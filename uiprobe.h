@@ -0,0 +1,68 @@
+/*
+ * User interface responsiveness probe for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A frozen desktop often shows up first as a stalled message loop. This
+ * probe runs a helper thread that periodically sends the UI thread a
+ * timestamped "ping", and the UI thread records how long each one took
+ * to be dispatched. Pings keep being sent while the loop is stalled, so
+ * a long stall is counted once for every ping it delayed.
+ *
+ * On Windows, the front-end supplies a function that posts a window
+ * message carrying the timestamp. Elsewhere, the pings are written to a
+ * pipe that the front-end's event loop watches alongside everything else.
+ */
+
+#ifndef UIPROBE_H
+#define UIPROBE_H
+
+#include <stdatomic.h>
+
+#include "clockcore.h"
+#include "histogram.h"
+#include "thread.h"
+
+// How often to ping the UI thread, in microseconds
+#define UIPROBE_INTERVAL 100000
+
+#define UIPROBE_LABEL CTEXT("UI latency")
+
+// Sends a ping; returns 0 on success, -1 on failure
+typedef int (*UIPOSTPROC)(void *arg, unsigned long timestamp);
+
+typedef struct tagUIPROBE {
+    HISTOGRAM histogram;        // written only by the UI thread
+    THREAD thread;
+    atomic_int fStop;
+    unsigned long interval;     // ping interval in microseconds
+    UIPOSTPROC post;
+    void *arg;
+#ifndef _WIN32
+    int fd;                     // read end of the ping pipe
+    int fdWrite;
+#endif
+} UIPROBE;
+
+int StartUIProbe(UIPROBE *probe, unsigned long interval,
+                 UIPOSTPROC post, void *arg);
+void StopUIProbe(UIPROBE *probe);
+void RecordDispatch(UIPROBE *probe, unsigned long timestamp);
+#ifndef _WIN32
+void ReadUIProbePings(UIPROBE *probe);
+#endif
+
+#endif /* UIPROBE_H */
@@ -0,0 +1,340 @@
+/*
+ * X11 display for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h> // for malloc()
+#include <string.h> // for memset()
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/Xutil.h>
+
+#include "xface.h"
+
+static int CreateShmImage(XFACE *xface, Visual *visual, int depth,
+                          int width, int height);
+static int CreatePlainImage(XFACE *xface, Visual *visual, int depth,
+                            int width, int height);
+static int IsUsableImage(const XImage *image);
+static int GetNativeByteOrder(void);
+static void PutRects(XFACE *xface, const FBRECT *rects, int cRects);
+static void WaitForImage(XFACE *xface);
+static Bool IsShmCompletion(Display *display, XEvent *event, XPointer arg);
+static int CatchAttachError(Display *display, XErrorEvent *error);
+
+// Set if XShmAttach() fails, as it does for a server on another machine
+static int fAttachFailed;
+
+/*
+ * Create a clock face to show in the specified window.
+ * Unless fAllowShm is zero, it's kept in shared memory if possible.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+CreateXFace(XFACE *xface, Display *display, Window window,
+            int width, int height, int fAllowShm)
+{
+    int screen = DefaultScreen(display);
+    Visual *visual = DefaultVisual(display, screen);
+    int depth = DefaultDepth(display, screen);
+
+    memset(xface, 0, sizeof(XFACE));
+    xface->display = display;
+    xface->window = window;
+
+    if (width < 1)
+        width = 1;
+    if (height < 1)
+        height = 1;
+
+    if (visual->class != TrueColor)
+        return -1;
+    if (fAllowShm && XShmQueryExtension(display)
+        && CreateShmImage(xface, visual, depth, width, height) == 0) {
+        xface->fShm = 1;
+        xface->shmCompletion = XShmGetEventBase(display) + ShmCompletion;
+    } else if (CreatePlainImage(xface, visual, depth, width, height) != 0) {
+        return -1;
+    }
+
+    xface->gc = XCreateGC(display, window, 0, NULL);
+    CreateClockFaceIn(&xface->face, width, height,
+                      (PIXEL *) xface->image->data);
+    return 0;
+}
+
+/*
+ * Free a clock face shown in a window.
+ * The window itself is left alone.
+ */
+void
+FreeXFace(XFACE *xface)
+{
+    if (xface->image != NULL) {
+        WaitForImage(xface);
+        if (xface->fShm) {
+            XShmDetach(xface->display, &xface->shmInfo);
+            shmdt(xface->shmInfo.shmaddr);
+            xface->image->data = NULL;
+        }
+        XDestroyImage(xface->image);    // frees a plain image's pixels
+    }
+    if (xface->gc != NULL)
+        XFreeGC(xface->display, xface->gc);
+
+    FreeClockFace(&xface->face);
+    memset(xface, 0, sizeof(XFACE));
+}
+
+/*
+ * Draw the clock, and send the server whatever changed.
+ * The first time, the whole face is drawn and sent.
+ */
+void
+DrawXFace(XFACE *xface, const CLOCKSTATE *state)
+{
+    FBRECT rects[MAX_FACE_CHANGES];
+    int i, cRects;
+
+    // Don't draw over the image while the server's still reading it
+    WaitForImage(xface);
+
+    cRects = GetClockFaceChanges(&xface->face, state, rects);
+    if (!xface->fDrawn) {
+        rects[0].left = rects[0].top = 0;
+        rects[0].right = xface->face.fb.width;
+        rects[0].bottom = xface->face.fb.height;
+        RenderClockFace(&xface->face, state, NULL);
+        PutRects(xface, rects, 1);
+        xface->fDrawn = 1;
+        return;
+    }
+
+    for (i = 0; i < cRects; ++i)
+        RenderClockFace(&xface->face, state, &rects[i]);
+    PutRects(xface, rects, cRects);
+}
+
+/*
+ * Send part of the face to the server again, such as after an Expose.
+ */
+void
+PutXFace(XFACE *xface, const FBRECT *rect)
+{
+    PutRects(xface, rect, 1);
+}
+
+/*
+ * Handle an event meant for the face.
+ * Returns nonzero if it was one, and zero otherwise.
+ */
+int
+HandleXFaceEvent(XFACE *xface, const XEvent *event)
+{
+    if (!xface->fShm || event->type != xface->shmCompletion)
+        return 0;
+
+    if (xface->cPending > 0)
+        --xface->cPending;
+    return 1;
+}
+
+/*
+ * Create an image in memory shared with the server.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+CreateShmImage(XFACE *xface, Visual *visual, int depth,
+               int width, int height)
+{
+    XShmSegmentInfo *shmInfo = &xface->shmInfo;
+    XErrorHandler oldHandler;
+    XImage *image;
+
+    image = XShmCreateImage(xface->display, visual, depth, ZPixmap, NULL,
+                            shmInfo, width, height);
+    if (image == NULL)
+        return -1;
+    if (!IsUsableImage(image) || image->byte_order != GetNativeByteOrder()) {
+        XDestroyImage(image);
+        return -1;
+    }
+
+    shmInfo->shmid = shmget(IPC_PRIVATE,
+                            (size_t) image->bytes_per_line * image->height,
+                            IPC_CREAT | 0600);
+    if (shmInfo->shmid == -1) {
+        XDestroyImage(image);
+        return -1;
+    }
+    shmInfo->shmaddr = image->data = shmat(shmInfo->shmid, NULL, 0);
+    if (shmInfo->shmaddr == (char *) -1) {
+        shmctl(shmInfo->shmid, IPC_RMID, NULL);
+        image->data = NULL;
+        XDestroyImage(image);
+        return -1;
+    }
+    shmInfo->readOnly = False;
+
+    // A remote server can't attach, and tells us so with an error
+    XSync(xface->display, False);
+    fAttachFailed = 0;
+    oldHandler = XSetErrorHandler(CatchAttachError);
+    XShmAttach(xface->display, shmInfo);
+    XSync(xface->display, False);
+    XSetErrorHandler(oldHandler);
+
+    // Either way, the segment goes away once everyone detaches
+    shmctl(shmInfo->shmid, IPC_RMID, NULL);
+    if (fAttachFailed) {
+        shmdt(shmInfo->shmaddr);
+        image->data = NULL;
+        XDestroyImage(image);
+        return -1;
+    }
+
+    xface->image = image;
+    return 0;
+}
+
+/*
+ * Create an image in our own memory.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+CreatePlainImage(XFACE *xface, Visual *visual, int depth,
+                 int width, int height)
+{
+    XImage *image;
+    char *pixels;
+
+    pixels = malloc((size_t) width * height * sizeof(PIXEL));
+    if (pixels == NULL)
+        return -1;
+
+    image = XCreateImage(xface->display, visual, depth, ZPixmap, 0, pixels,
+                         width, height, 32, width * sizeof(PIXEL));
+    if (image == NULL) {
+        free(pixels);
+        return -1;
+    }
+
+    // Xlib converts to the server's byte order if it's different
+    image->byte_order = GetNativeByteOrder();
+    if (!IsUsableImage(image)) {
+        XDestroyImage(image);
+        return -1;
+    }
+
+    xface->image = image;
+    return 0;
+}
+
+/*
+ * Return nonzero if the renderer can draw straight into an image.
+ */
+int
+IsUsableImage(const XImage *image)
+{
+    return image->bits_per_pixel == 32
+           && image->bytes_per_line == image->width * (int) sizeof(PIXEL)
+           && image->red_mask == 0xFF0000
+           && image->green_mask == 0x00FF00
+           && image->blue_mask == 0x0000FF;
+}
+
+/*
+ * Return the byte order PIXELs are stored in, as LSBFirst or MSBFirst.
+ */
+int
+GetNativeByteOrder(void)
+{
+    const PIXEL one = 1;
+
+    return (*(const unsigned char *) &one == 1) ? LSBFirst : MSBFirst;
+}
+
+/*
+ * Send parts of the image to the server.
+ */
+void
+PutRects(XFACE *xface, const FBRECT *rects, int cRects)
+{
+    FBRECT rc;
+    int i;
+
+    for (i = 0; i < cRects; ++i) {
+        rc = rects[i];
+        if (rc.left < 0)
+            rc.left = 0;
+        if (rc.top < 0)
+            rc.top = 0;
+        if (rc.right > xface->face.fb.width)
+            rc.right = xface->face.fb.width;
+        if (rc.bottom > xface->face.fb.height)
+            rc.bottom = xface->face.fb.height;
+        if (rc.left >= rc.right || rc.top >= rc.bottom)
+            continue;
+
+        if (xface->fShm) {
+            XShmPutImage(xface->display, xface->window, xface->gc,
+                         xface->image, rc.left, rc.top, rc.left, rc.top,
+                         rc.right - rc.left, rc.bottom - rc.top, True);
+            ++xface->cPending;
+        } else {
+            XPutImage(xface->display, xface->window, xface->gc,
+                      xface->image, rc.left, rc.top, rc.left, rc.top,
+                      rc.right - rc.left, rc.bottom - rc.top);
+        }
+        xface->cPixelsSent += (unsigned long) (rc.right - rc.left)
+                              * (rc.bottom - rc.top);
+    }
+}
+
+/*
+ * Wait for the server to finish reading the shared image.
+ * Other events stay queued.
+ */
+void
+WaitForImage(XFACE *xface)
+{
+    XEvent event;
+
+    while (xface->cPending > 0) {
+        XIfEvent(xface->display, &event, IsShmCompletion, (XPointer) xface);
+        --xface->cPending;
+    }
+}
+
+/*
+ * Predicate for XIfEvent() matching ShmCompletion events.
+ */
+Bool
+IsShmCompletion(Display *display, XEvent *event, XPointer arg)
+{
+    const XFACE *xface = (const XFACE *) arg;
+
+    return event->type == xface->shmCompletion;
+}
+
+/*
+ * Error handler used while attaching shared memory.
+ */
+int
+CatchAttachError(Display *display, XErrorEvent *error)
+{
+    fAttachFailed = 1;
+    return 0;
+}
@@ -0,0 +1,64 @@
+/*
+ * X11 display for the Uptime Clock.
+ * Copyright (c) 2023, 2024 Benjamin Johnson <bmjcode@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Shows a clock face drawn by the software renderer in an X window.
+ *
+ * The face draws straight into an XImage, which lives in memory shared
+ * with the server if the MIT-SHM extension is available. Each tick we
+ * redraw only the rectangles that changed and send just those, one
+ * XShmPutImage() each -- a handful of requests per frame, and no round
+ * trips. Without shared memory (say, over the network), we fall back to
+ * XPutImage(), which copies the same rectangles through the connection.
+ *
+ * The renderer draws 0x00RRGGBB pixels, so this needs a 24-bit TrueColor
+ * visual with 32 bits per pixel, which is what any X server has used by
+ * default for decades.
+ */
+
+#ifndef XFACE_H
+#define XFACE_H
+
+#include <X11/Xlib.h>
+#include <X11/extensions/XShm.h>
+
+#include "clockcore.h"
+#include "render.h"
+
+typedef struct tagXFACE {
+    Display *display;
+    Window window;
+    GC gc;
+    XImage *image;              // holds face.fb.pixels
+    XShmSegmentInfo shmInfo;
+    int fShm;                   // nonzero if image is in shared memory
+    int shmCompletion;          // event type of ShmCompletion
+    int cPending;               // shared puts the server has yet to finish
+    int fDrawn;                 // nonzero after the first full frame
+    CLOCKFACE face;
+    unsigned long cPixelsSent;  // total pixels sent, for benchmarking
+} XFACE;
+
+int CreateXFace(XFACE *xface, Display *display, Window window,
+                int width, int height, int fAllowShm);
+void FreeXFace(XFACE *xface);
+
+void DrawXFace(XFACE *xface, const CLOCKSTATE *state);
+void PutXFace(XFACE *xface, const FBRECT *rect);
+int HandleXFaceEvent(XFACE *xface, const XEvent *event);
+
+#endif /* XFACE_H */